@@ -6,6 +6,20 @@
 
 #define C_TO_F(t)	((t)*1.8 + 32.0)
 
+/* Curves for other probes, from the nominal resistance at 25C and Beta value */
+typedef struct {
+	const char *name;
+	double r25;
+	double beta;
+} beta_curve_t;
+
+const beta_curve_t beta_curves[] = {
+	{ "10k B3950", 10000.0, 3950.0 },
+	{ "5k B3950", 5000.0, 3950.0 },
+};
+
+#define NO_OF_BETA_CURVES	(sizeof(beta_curves)/sizeof(beta_curves[0]))
+
 /**
  * Convert A/D value to probe resistance value
  * @param ad_value The A/D value (0-1024)
@@ -15,9 +29,59 @@ double ad_to_r(int ad_value){
 	return (((R0 * AD_MAX) / ad_value) - R0);
 }
 
+/**
+ * Convert probe resistance to temperature, using the Beta model
+ * @param r The probe resistance (in Ohm)
+ * @param curve The probe
+ * @return The temperature (in Celsius)
+ */
+double beta_rtot(double r, const beta_curve_t *curve){
+	return 1.0 / (1.0 / 298.15 + log(r / curve->r25) / curve->beta) - 273.15;
+}
+
+/**
+ * Compress a delta between lookup table points to a byte, as decoded by ntc_delta() in page0.c.
+ * Deltas up to 127 are kept as they are, larger deltas in steps of 4 with bit 7 set.
+ * @param delta The delta (0-508)
+ * @return The delta byte
+ */
+int compress_delta(int delta){
+	if(delta < 0 || delta > 508){
+		printf("Delta %d out of range, lookup table can not be compressed\n", delta);
+		exit(-1);
+	}
+	if(delta < 128){
+		return delta;
+	}
+	return 0x80 | ((delta + 2) >> 2);
+}
+
+int expand_delta(int data){
+	return (data & 0x80) ? ((data & 0x7f) << 2) : data;
+}
+
+/**
+ * Print a lookup table (Celsius) compressed to 32 bytes, the value of point 1
+ * (least significant byte first) followed by the deltas to points 2 to 31.
+ * The delta rounding error is carried to the next point, so it does not add up.
+ * @param name Printed as a comment
+ * @param lut The lookup table
+ */
+void print_compressed(const char *name, int lut[32]){
+	int i, data, value = lut[1];
+
+	printf("\t// %s\n\t%d, %d", name, lut[1] & 0xff, (lut[1] >> 8) & 0xff);
+	for(i=2; i<32; i++){
+		data = compress_delta(lut[i] - value);
+		value += expand_delta(data);
+		printf(", %d", data);
+	}
+	printf(",\n");
+}
+
 int main(int argc, char *argv[]){
 	double r;
-	int i;
+	int i, j;
 	int lut_c[32];
 	int lut_f[32];
 	const int ad_lookup_c[32] = { 0, -470, -357, -273, -206, -152, -104, -61, -22, 16, 51, 85, 119, 151, 185, 217, 250, 283, 318, 354, 391, 431, 473, 519, 568, 624, 688, 763, 857, 975, 1150, 1400 };
@@ -61,5 +125,16 @@ int main(int argc, char *argv[]){
 	}
 	printf(" };\n");
 
+	// Curve 0 is the Celsius (or Fahrenheit) table above as it is, only the other curves are compressed
+	printf("//Compressed (PROBE_CURVES), curves 1 and up\n");
+	printf("const unsigned char ntc_curves[] = {\n");
+	for(j=0; j<NO_OF_BETA_CURVES; j++){
+		for(i=1; i<32; i++){
+			lut_c[i] = (int)round(beta_rtot(ad_to_r(i*32), &beta_curves[j]) * 10.0);
+		}
+		print_compressed(beta_curves[j].name, lut_c);
+	}
+	printf("};\n");
+
 }
 
@@ -33,8 +33,69 @@
 /* Define STC-1000+ version number (XYY, X=major, YY=minor) and EEROM revision */
 #define STC1000P_MAGIC_F		0x192C
 #define STC1000P_MAGIC_C		0x26D3
+/* Generated by build.sh, from stc1000p.h and the FEATURES of the HEX data below */
 #define STC1000P_VERSION		107
-#define STC1000P_EEPROM_VERSION	10
+#define STC1000P_EEPROM_VERSION	11
+#define STC1000P_EEPROM_LAYOUT	0x3FFF
+/* End of generated definitions */
+
+/* Firmware built with UNIT_MENU has one image for both units (EEPROM_UNIT_ADDRESS is generated above),
+ * with the unit in bit 1 of the power on word in EEPROM.
+ */
+#ifdef EEPROM_UNIT_ADDRESS
+#define EEPROM_UNIT_FAHRENHEIT	0x02
+#define hex_fahrenheit			hex_celsius
+#endif
+
+/* EEPROM layout of 1.07, 6 profiles of 19 words followed by 14 set menu words. Firmware built with
+ * features that change the layout (EEPROM_MIGRATE_PROFILES and friends are generated above) has its data
+ * converted by 'b' and 'g'. The layout of the firmware on a unit is kept in user ID 2, erased (as
+ * earlier sketches leave it) for the layout of 1.07.
+ */
+#define OLD_NO_OF_PROFILES		6
+#define OLD_PROFILE_WORDS		19
+#define EEPROM_LAYOUT_1_07		0x3FFF
+
+/* What eeprom_needs_migration() finds */
+#define EEPROM_KEEP				0		/* Same layout, or no STC-1000+ firmware */
+#define EEPROM_CONVERT			1		/* Layout of 1.07, converted to the one of the sketch */
+#define EEPROM_DIFFERENT		2		/* Some other layout, that can not be converted */
+
+/* Telemetry from firmware built with TELEMETRY, sent as 1000 baud serial on ICSPCLK once a second */
+#define TELEMETRY_FRAME_SIZE	12
+#define TELEMETRY_FRAMES		8		/* Frames buffered until they are sent to host */
+#define TELEMETRY_GAP			50		/* ms without bytes that ends a frame */
+#define TELEMETRY_BIT_US		1000
+
+/* Oscillator calibration of firmware built with OSC_CAL, which toggles ICSPCLK every ms after power on
+ * when ICSPCLK is held high as it powers up */
+#define OSC_CAL_PERIODS			2000	/* Periods timed, 2ms each */
+#define OSC_CAL_BYTE			254		/* EEPROM address of the calibration word */
+#define OSC_CAL_TICKS_PER_HOUR	60000
+#define OSC_CAL_MIN				57000
+#define OSC_CAL_MAX				63000
+#define OSC_CAL_REQUEST_MS		350		/* ICSPCLK held high after power on (the bootloader takes 0.2s), within the 500ms hold of the firmware */
+
+/* Bootloader (src/bootloader.asm), entered with ICSPCLK and ICSPDAT held high through power on.
+ * Rows are clocked in like low voltage programming (ICSPDAT is read as ICSPCLK falls, LSB first),
+ * each with its CRC-16, and the bootloader replies with two bits on ICSPDAT.
+ */
+#define BOOT_START				0x0780	/* Word address of the bootloader, to the end of page 0 */
+#define BOOT_END				0x0800
+#define BOOT_APP_CRC			(BOOT_START - 3)	/* Three words that make the CRC of the firmware 0 */
+#define BOOT_ROW_WORDS			32
+#define BOOT_ROWS				(PROGRAM_MEMORY_WORDS / BOOT_ROW_WORDS)
+#define BOOT_GOTO				(0x2800 | BOOT_START)	/* Word 0, in place of the nop of the firmware */
+#define BOOT_CLK_HIGH_US		10
+#define BOOT_CLK_LOW_US			20
+#define BOOT_BYTE_GAP_US		50		/* The bootloader adds each byte to the CRC, about 25us */
+#define BOOT_ROW_MS				3		/* Row erase, and row write (2.5ms maximum) */
+#define BOOT_ENTRY_MS			5		/* Reset, ICSPDAT is let go before a firmware drives it for long */
+#define BOOT_REPLY_US			100
+#define BOOT_CHECK_MS			500		/* CRC of the firmware at power on, about 0.2s */
+#define BOOT_RETRIES			3
+#define BOOT_ACK				0x2		/* High then low */
+#define BOOT_NAK				0x1		/* Low then high */
 
 /* Pin configuration */
 #define ICSPCLK 9
@@ -44,6 +105,38 @@
 #define VDD3    4
 #define nMCLR   3 
 
+/* Multi target programming, set NO_OF_TARGETS to program up to 5 STC-1000 at once.
+ * All targets share ICSPCLK, nMCLR and VDD (more than one target needs a separate supply),
+ * each target has its own ICSPDAT pin from target_dat[]. Commands and data are clocked
+ * out to all targets at the same time, and data read back is checked for each target.
+ */
+#ifndef NO_OF_TARGETS
+#define NO_OF_TARGETS	1
+#endif
+const unsigned char target_dat[] = { ICSPDAT, 7, 10, 11, 12 };
+unsigned int target_read[NO_OF_TARGETS];	/* Last data read from each target */
+unsigned char target_failed;				/* Bit set for each target that failed validation */
+
+/* Hex file word addresses (byte address / 2) of configuration space and EEPROM data */
+#define HEX_CONFIG_WORD		0x8000
+#define HEX_EEPROM_WORD		0xF000
+
+/* Memory read back by the 'x' command */
+#define PROGRAM_MEMORY_WORDS	4096
+#define CONFIG_WORDS			9		/* User IDs, reserved, revision ID, device ID and configuration words */
+#define EEPROM_BYTES			256
+#define HEX_RECORD_WORDS		8
+#define BLANK_WORD				0x3FFF
+
+unsigned long hex_base;		/* Upper bits of hex file address, from record type 02 or 04 */
+unsigned int device_pc;		/* Device address (PC) while programming */
+
+/* Buffer shared by the data of a hex record being uploaded, a hex record being dumped, EEPROM data
+ * being converted, a bootloader row and the telemetry frames, only one of them is used at a time.
+ */
+#define LINE_BUFFER_SIZE	256
+unsigned char line_buffer[LINE_BUFFER_SIZE];
+
 /* Delays */
 #define TDLY()  delayMicroseconds(1)    /* 1.0us minimum */
 #define TCKH()  delayMicroseconds(1)    /* 100ns minimum */
@@ -72,7 +165,7 @@
 #define BULK_ERASE_DATA_MEMORY              0x0B    /* Internally Timed */
 #define ROW_ERASE_PROGRAM_MEMORY            0x11    /* Internally Timed */
 
-/* declare hex data */
+/* declare hex data, the firmware is the same for Celsius and Fahrenheit (unit is set in EEPROM) */
 extern const char hex_celsius[] PROGMEM;
 extern const char hex_fahrenheit[] PROGMEM;
 extern const char hex_eeprom_celsius[] PROGMEM;
@@ -86,8 +179,8 @@ extern const char hex_eeprom_fahrenheit[] PROGMEM;
 void setup() {
 	pinMode(ICSPCLK, INPUT);
 	digitalWrite(ICSPCLK, LOW); // Disable pull-up
-	pinMode(ICSPDAT, INPUT);
-	digitalWrite(ICSPDAT, LOW); // Disable pull-up
+	dat_mode(INPUT);
+	dat_write(LOW); // Disable pull-up
 	pinMode(nMCLR, INPUT);
 	digitalWrite(nMCLR, LOW); // Disable pull-up
 
@@ -95,19 +188,19 @@ void setup() {
 
 	delay(2);
 
-	Serial.println("STC-1000+ firmware sketch.");
-	Serial.println("Copyright 2014 Mats Staffansson");
-	Serial.println("");
-	Serial.println("Send 'd' to check for STC-1000");
+	Serial.println(F("STC-1000+ firmware sketch."));
+	Serial.println(F("Copyright 2014 Mats Staffansson"));
+	Serial.println(F(""));
+	Serial.println(F("Send 'd' to check for STC-1000"));
 
 #if AUTOMATIC_UPLOAD_CELSIUS || AUTOMATIC_UPLOAD_FAHRENHEIT
 	{
-		unsigned int magic, ver, deviceid;
+		unsigned int magic, ver, layout, deviceid;
 		delay(100); // Make sure STC has time to wake up.
-		get_device_id(&magic, &ver, &deviceid);
+		get_device_id(&magic, &ver, &layout, &deviceid);
 
 		if((deviceid & 0x3FE0) == 0x27C0) {
-			Serial.println("STC-1000 detected");
+			Serial.println(F("STC-1000 detected"));
 			lvp_entry();
 			bulk_erase_device();
 #ifdef AUTOMATIC_UPLOAD_FAHRENHEIT
@@ -120,9 +213,10 @@ void setup() {
 			write_magic(STC1000P_MAGIC_C);
 #endif
 			write_version(STC1000P_VERSION);
+			write_layout(STC1000P_EEPROM_LAYOUT);
 			p_exit();
 		} else {
-			Serial.println("No STC-1000 detected");
+			Serial.println(F("No STC-1000 detected"));
 		}
 	}
 #endif
@@ -132,6 +226,7 @@ void setup() {
 void loop() {
 	if (Serial.available() > 0) {
 		char command = Serial.read();
+		unsigned char migrate;
 		switch (command) {
 		case 'h':
 			hvp_entry();
@@ -166,6 +261,35 @@ void loop() {
 			upload_hex_file_to_device();
 			p_exit();
 			break;
+		case 'r':
+			lvp_entry();
+			dump_data_memory();
+			p_exit();
+			break;
+		case 'x':
+			lvp_entry();
+			dump_hex();
+			p_exit();
+			break;
+		case 'm':
+			monitor_telemetry();
+			break;
+		case 'o':
+#if NO_OF_TARGETS > 1
+			// ICSPCLK is shared between targets
+			Serial.println(F("Not available with multiple targets."));
+			break;
+#endif
+			calibrate_oscillator();
+			break;
+		case 'n':
+#if NO_OF_TARGETS > 1
+			// ICSPCLK is shared between targets
+			Serial.println(F("Not available with multiple targets."));
+			break;
+#endif
+			boot_upload(hex_celsius);
+			break;
 		case 'a':
 			lvp_entry();
 			bulk_erase_device();
@@ -173,65 +297,108 @@ void loop() {
 			upload_hex_from_progmem (hex_eeprom_celsius);
 			write_magic(STC1000P_MAGIC_C);
 			write_version(STC1000P_VERSION);
+			write_layout(STC1000P_EEPROM_LAYOUT);
 			p_exit();
 			break;
 		case 'b':
+#if NO_OF_TARGETS > 1
+			// EEPROM data differs between targets and can not be kept in lockstep
+			Serial.println(F("Not available with multiple targets, use 'a' or 'f'."));
+			break;
+#endif
 			lvp_entry();
+			migrate = eeprom_needs_migration();
+			if (migrate == EEPROM_DIFFERENT) {
+				p_exit();
+				Serial.println(F("EEPROM layout differs and can not be converted, use 'a' or 'f'."));
+				break;
+			}
 			load_configuration(0);
 			bulk_erase_program_memory();
 			reset_address();
-			upload_hex_from_progmem(hex_celsius);
-			write_magic(STC1000P_MAGIC_C);
-			write_version(STC1000P_VERSION);
+			if (upload_hex_from_progmem(hex_celsius)) {
+				if (migrate == EEPROM_CONVERT) {
+					migrate_eeprom(0);
+				}
+				write_magic(STC1000P_MAGIC_C);
+				write_version(STC1000P_VERSION);
+				write_layout(STC1000P_EEPROM_LAYOUT);
+			}
 			p_exit();
 			break;
 		case 'd': {
-			unsigned int magic, ver, deviceid;
-			get_device_id(&magic, &ver, &deviceid);
-			Serial.print("Device ID is: 0x");
+			unsigned int magic, ver, layout, deviceid;
+			get_device_id(&magic, &ver, &layout, &deviceid);
+			Serial.print(F("Device ID is: 0x"));
 			Serial.println(deviceid, HEX);
+#if NO_OF_TARGETS > 1
+			for (unsigned char t = 0; t < NO_OF_TARGETS; t++) {
+				Serial.print(F("Target "));
+				Serial.print(t, DEC);
+				Serial.print(F(" device ID is: 0x"));
+				Serial.println(target_read[t], HEX);
+			}
+#endif
 			if ((deviceid & 0x3FE0) == 0x27C0) {
-				Serial.println("STC-1000 detected.");
+				Serial.println(F("STC-1000 detected."));
 				if (magic == STC1000P_MAGIC_C || magic == STC1000P_MAGIC_F) {
-					Serial.print("STC-1000+ ");
+					Serial.print(F("STC-1000+ "));
 					if (magic == STC1000P_MAGIC_F) {
-						Serial.print("Fahrenheit ");
+						Serial.print(F("Fahrenheit "));
 					} else {
-						Serial.print("Celsius ");
+						Serial.print(F("Celsius "));
 					}
-					Serial.print("firmware with version ");
+					Serial.print(F("firmware with version "));
 					Serial.print(ver / 100, DEC);
-					Serial.print(".");
+					Serial.print(F("."));
 					Serial.print((ver % 100) / 10, DEC);
 					Serial.print((ver % 10), DEC);
-					Serial.println(" detected.");
-					if (ver < STC1000P_EEPROM_VERSION) {
-						Serial.println(
-								"EEPROM has changes, consider initializing EEPROM when flashing.");
+					Serial.println(F(" detected."));
+					if (ver < STC1000P_EEPROM_VERSION || layout != STC1000P_EEPROM_LAYOUT) {
+#ifdef EEPROM_MIGRATE_PROFILES
+						if (layout == EEPROM_LAYOUT_1_07) {
+							Serial.println(
+									F("EEPROM has changes, 'b' and 'g' convert EEPROM data when flashing."));
+						} else
+#endif
+						if (layout != STC1000P_EEPROM_LAYOUT) {
+							Serial.println(
+									F("EEPROM layout differs, initialize EEPROM when flashing ('b' and 'g' refuse)."));
+						} else {
+							Serial.println(
+									F("EEPROM has changes, consider initializing EEPROM when flashing."));
+						}
 					}
 
 				} else {
-					Serial.println("No previous STC-1000+ firmware detected.");
+					Serial.println(F("No previous STC-1000+ firmware detected."));
 					Serial.println(
-							"Consider initializing EEPROM when flashing.");
+							F("Consider initializing EEPROM when flashing."));
 				}
-				Serial.print("Sketch has version ");
+				Serial.print(F("Sketch has version "));
 				Serial.print(STC1000P_VERSION / 100, DEC);
-				Serial.print(".");
+				Serial.print(F("."));
 				Serial.print((STC1000P_VERSION % 100) / 10, DEC);
 				Serial.print((STC1000P_VERSION % 10), DEC);
-				Serial.println("");
-				Serial.println("");
+				Serial.println(F(""));
+				Serial.println(F(""));
 				Serial.println(
-						"Send 'a' to upload Celsius version and initialize EEPROM data.");
+						F("Send 'a' to upload Celsius version and initialize EEPROM data."));
 				Serial.println(
-						"Send 'b' to upload Celsius version (program memory only).");
+						F("Send 'b' to upload Celsius version (program memory only)."));
 				Serial.println(
-						"Send 'f' to upload Fahrenheit version and initialize EEPROM data.");
+						F("Send 'f' to upload Fahrenheit version and initialize EEPROM data."));
+#ifdef EEPROM_UNIT_ADDRESS
 				Serial.println(
-						"Send 'g' to upload Fahrenheit version (program memory only).");
+						F("Send 'g' to upload Fahrenheit version (program memory only, sets unit to Fahrenheit)."));
+				Serial.println(
+						F("Temperature unit can also be changed later in the settings menu (CF)."));
+#else
+				Serial.println(
+						F("Send 'g' to upload Fahrenheit version (program memory only)."));
+#endif
 			} else {
-				Serial.println("STC-1000 NOT detected. Check wiring.");
+				Serial.println(F("STC-1000 NOT detected. Check wiring."));
 			}
 		}
 			break;
@@ -242,16 +409,36 @@ void loop() {
 			upload_hex_from_progmem (hex_eeprom_fahrenheit);
 			write_magic(STC1000P_MAGIC_F);
 			write_version(STC1000P_VERSION);
+			write_layout(STC1000P_EEPROM_LAYOUT);
 			p_exit();
 			break;
 		case 'g':
+#if NO_OF_TARGETS > 1
+			// EEPROM data differs between targets and can not be kept in lockstep
+			Serial.println(F("Not available with multiple targets, use 'a' or 'f'."));
+			break;
+#endif
 			lvp_entry();
+			migrate = eeprom_needs_migration();
+			if (migrate == EEPROM_DIFFERENT) {
+				p_exit();
+				Serial.println(F("EEPROM layout differs and can not be converted, use 'a' or 'f'."));
+				break;
+			}
 			load_configuration(0);
 			bulk_erase_program_memory();
 			reset_address();
-			upload_hex_from_progmem(hex_fahrenheit);
-			write_magic(STC1000P_MAGIC_F);
-			write_version(STC1000P_VERSION);
+			if (upload_hex_from_progmem(hex_fahrenheit)) {
+				if (migrate == EEPROM_CONVERT) {
+					migrate_eeprom(1);
+				}
+#ifdef EEPROM_UNIT_ADDRESS
+				write_eeprom_unit_fahrenheit();
+#endif
+				write_magic(STC1000P_MAGIC_F);
+				write_version(STC1000P_VERSION);
+				write_layout(STC1000P_EEPROM_LAYOUT);
+			}
 			p_exit();
 			break;
 		default:
@@ -275,218 +462,264 @@ unsigned char parse_hex() {
 	return data;
 }
 
+/* Check data read back from each target, report and mark the targets that failed.
+ * Targets that failed are still clocked along with the others, but not checked again.
+ * return: 1 when all targets have failed
+ */
+unsigned char verify_targets(const __FlashStringHelper *what, unsigned int address, unsigned int data_out, unsigned int mask) {
+	unsigned char t;
+
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		unsigned int data_in = target_read[t] & mask;
+		if (!(target_failed & (1 << t)) && data_in != data_out) {
+			target_failed |= (1 << t);
+#if NO_OF_TARGETS > 1
+			Serial.print(F("Target "));
+			Serial.print(t, DEC);
+			Serial.print(F(": "));
+#endif
+			Serial.print(F("Validation failed for "));
+			Serial.print(what);
+			Serial.print(F(" 0x"));
+			Serial.print(address, HEX);
+			Serial.print(F(" wrote 0x"));
+			Serial.print(data_out, HEX);
+			Serial.print(F(" but read back 0x"));
+			Serial.println(data_in, HEX);
+		}
+	}
+
+	return target_failed == ((1 << NO_OF_TARGETS) - 1);
+}
+
+/* Move the device address (PC) to pc, with as few increments as possible.
+ * Configuration space (0x8000 and up) is entered with load_configuration(),
+ * reset_address() goes back to 0. EEPROM only uses the low 8 bits of the PC,
+ * so for EEPROM the PC may also be moved forward to any address with the same low bits.
+ */
+void seek_device_address(unsigned int pc, unsigned char eeprom) {
+	if (pc >= HEX_CONFIG_WORD) {
+		if (device_pc < HEX_CONFIG_WORD || pc < device_pc) {
+			load_configuration(0);
+			device_pc = HEX_CONFIG_WORD;
+		}
+	} else if (eeprom) {
+		if (device_pc >= HEX_CONFIG_WORD || ((pc - device_pc) & 0xff) > pc) {
+			reset_address();
+			device_pc = 0;
+		}
+		pc = device_pc + ((pc - device_pc) & 0xff);
+	} else if (device_pc >= HEX_CONFIG_WORD || pc < device_pc) {
+		reset_address();
+		device_pc = 0;
+	}
+
+	while (device_pc != pc) {
+		increment_address();
+		device_pc++;
+	}
+}
+
 unsigned char handle_hex_file_line(unsigned char bytecount,
 		unsigned int address, unsigned char recordtype, unsigned char data[]) {
-	static unsigned int device_address = 0;
-	unsigned char i;
+	unsigned long word_address;
+	unsigned int i;
 
 	if (recordtype == 1) {
 		reset_address();
-		device_address = 0;
-		Serial.println("Programming done");
-		return 1;
-	} else if (recordtype == 04) {
-		if (data[1] == 0) {
-			Serial.println("Programming program memory");
-			reset_address();
-			device_address = 0;
-		} else if (data[1] == 1) {
-			Serial.println("Programming config memory");
-			load_configuration(0);
-			device_address = 0;
+		device_pc = 0;
+		Serial.println(F("Programming done"));
+#if NO_OF_TARGETS > 1
+		for (i = 0; i < NO_OF_TARGETS; i++) {
+			Serial.print(F("Target "));
+			Serial.print(i, DEC);
+			Serial.println((target_failed & (1 << i)) ? F(" FAILED") : F(" OK"));
 		}
-	} else if (recordtype == 00) {
-		if (address >= 0xE000) {
-			Serial.print("Programming ");
+#endif
+		return 1;
+	} else if (recordtype == 2) {
+		// Extended segment address, bits 4-19
+		hex_base = ((unsigned long) ((data[0] << 8) | data[1])) << 4;
+	} else if (recordtype == 4) {
+		// Extended linear address, bits 16-31
+		hex_base = ((unsigned long) ((data[0] << 8) | data[1])) << 16;
+	} else if (recordtype == 0) {
+		// Hex file addresses are in bytes, two per device word
+		word_address = (hex_base + address) >> 1;
+
+		if (word_address >= HEX_EEPROM_WORD) {
+			Serial.print(F("Programming "));
 			Serial.print(bytecount >> 1, DEC);
-			Serial.print(" bytes at EEPROM address 0x");
-			Serial.println((address & 0x1FFF) >> 1, HEX);
-
-			if (device_address != ((address & 0x1FFF) >> 1)
-					|| ((address & 0x1FFF) >> 1) == 0) {
-				Serial.println("Resetting address for EEPROM");
-				reset_address();
-				device_address = 0;
-			}
-			while (device_address != ((address & 0x1FFF) >> 1)) {
-				increment_address();
-				device_address++;
-				Serial.print("Incrementing address to 0x");
-				Serial.println(device_address, HEX);
-			}
+			Serial.print(F(" bytes at EEPROM address 0x"));
+			Serial.println(word_address - HEX_EEPROM_WORD, HEX);
+
+			seek_device_address(word_address - HEX_EEPROM_WORD, 1);
 
 			for (i = 0; i < bytecount; i += 2) {
 				unsigned char data_out = data[i];
-				unsigned char data_in;
 				load_data_for_data_memory(data_out);
 				begin_internally_timed_programming();
-				data_in = read_data_from_data_memory();
-				if (data_in != data_out) {
-					Serial.print("Validation failed for EEPROM address 0x");
-					Serial.print(device_address, HEX);
-					Serial.print(" wrote 0x");
-					Serial.print(data_out, HEX);
-					Serial.print(" but read back 0x");
-					Serial.println(data_in, HEX);
+				read_data_from_data_memory();
+				if (verify_targets(F("EEPROM address"), device_pc & 0xff, data_out, 0xff)) {
 					return 1;
 				}
 				increment_address();
-				device_address++;
+				device_pc++;
 			}
 		} else {
-			Serial.print("Programming ");
+			Serial.print(F("Programming "));
 			Serial.print(bytecount >> 1, DEC);
-			Serial.print(" words at address 0x");
-			Serial.println(address >> 1, HEX);
+			Serial.print(F(" words at address 0x"));
+			Serial.println(word_address, HEX);
 
-			while (device_address != (address >> 1)) {
-				increment_address();
-				device_address++;
-				Serial.print("Incrementing address to 0x");
-				Serial.println(device_address, HEX);
-			}
+			seek_device_address(word_address, 0);
 
 			for (i = 0; i < bytecount; i += 2) {
 				unsigned int data_word_out = (((unsigned int) data[i + 1]) << 8)
 						| data[i];
-				unsigned int data_word_in;
 				load_data_for_program_memory(data_word_out);
 				begin_internally_timed_programming();
-				data_word_in = read_data_from_program_memory();
-				if (data_word_in != data_word_out) {
-					Serial.print("Validation failed for address 0x");
-					Serial.print(device_address, HEX);
-					Serial.print(" wrote 0x");
-					Serial.print(data_word_out, HEX);
-					Serial.print(" but read back 0x");
-					Serial.println(data_word_in, HEX);
+				read_data_from_program_memory();
+				if (verify_targets(F("address"), device_pc, data_word_out, 0x3fff)) {
 					return 1;
 				}
 				increment_address();
-				device_address++;
+				device_pc++;
 			}
 		}
 	}
 	return 0;
 }
 
-void upload_hex_file_to_device() {
+/* Next byte of a hex record, from program memory if hexdata is set or else
+ * from serial (as two hex digits).
+ */
+unsigned char hex_record_byte(PGM_P *hexdata) {
+	if (*hexdata) {
+		return pgm_read_byte((*hexdata)++);
+	}
+	return parse_hex();
+}
+
+/* Parse hex records and program them as they come, until the end of file record.
+ * Records from serial start with ':', records in program memory are stored without it.
+ * Each record is checked before it is programmed, so the data of one record is kept
+ * (in line_buffer), records may have up to 255 bytes.
+ * return: 1 when all records were programmed and verified on all targets
+ */
+unsigned char upload_hex(PGM_P hexdata) {
+	unsigned char *data = line_buffer;
 	unsigned char done = 0;
 
-	Serial.println("Waiting for hex data...");
+	hex_base = 0;
+	reset_address();
+	device_pc = 0;
 
 	while (!done) {
 		unsigned char bytecount;
 		unsigned int address;
 		unsigned char recordtype;
-		unsigned char data[16];
 		unsigned char checksum;
 		unsigned char i;
 
-		// Read start of line
-		while (1) {
-			while (Serial.available() < 1)
-				;
-			char rx = Serial.read();
-			if (rx == ':') {
-				break;
+		if (!hexdata) {
+			// Read start of line
+			while (1) {
+				while (Serial.available() < 1)
+					;
+				char rx = Serial.read();
+				if (rx == ':') {
+					break;
+				}
 			}
 		}
 
 		// Read bytecount
-		bytecount = parse_hex();
+		bytecount = hex_record_byte(&hexdata);
 		checksum = bytecount;
 
 		// Read address
-		address = ((unsigned int) parse_hex()) << 8;
-		address |= parse_hex();
+		address = ((unsigned int) hex_record_byte(&hexdata)) << 8;
+		address |= hex_record_byte(&hexdata);
 		checksum += ((unsigned char) (address >> 8));
 		checksum += ((unsigned char) (address));
 
 		// Read recordtype
-		recordtype = parse_hex();
+		recordtype = hex_record_byte(&hexdata);
 		checksum += recordtype;
 
 		for (i = 0; i < bytecount; i++) {
-			data[i] = parse_hex();
+			data[i] = hex_record_byte(&hexdata);
 			checksum += data[i];
 		}
 
 		// Read checksum
-		i = parse_hex();
+		i = hex_record_byte(&hexdata);
 		checksum += i;
 
 		if (checksum) {
-			Serial.println("Checksum error!");
+			Serial.println(F("Checksum error!"));
+			break;
+		}
+
+		// Program memory words are two bytes
+		if (recordtype == 0 && (bytecount & 1) && ((hex_base + address) >> 1) < HEX_EEPROM_WORD) {
+			Serial.println(F("Odd byte count in program memory record!"));
 			break;
 		}
 
 		done = handle_hex_file_line(bytecount, address, recordtype, data);
 	}
-}
-
-void upload_hex_from_progmem(PGM_P hexdata) {
-	unsigned char done = 0;
-
-	Serial.println("Programming hex data...");
-
-	while (!done) {
-		unsigned char bytecount;
-		unsigned int address;
-		unsigned char recordtype;
-		unsigned char data[16];
-		unsigned char checksum;
-		unsigned char i;
-
-		// Read bytecount
-		bytecount = pgm_read_byte(hexdata++);
-		checksum = bytecount;
-
-		// Read address
-		address = ((unsigned int) pgm_read_byte(hexdata++)) << 8;
-		address |= pgm_read_byte(hexdata++);
-		checksum += ((unsigned char) (address >> 8));
-		checksum += ((unsigned char) (address));
 
-		// Read recordtype
-		recordtype = pgm_read_byte(hexdata++);
-		checksum += recordtype;
-
-		for (i = 0; i < bytecount; i++) {
-			data[i] = pgm_read_byte(hexdata++);
-			checksum += data[i];
-		}
+	return done && !target_failed;
+}
 
-		// Read checksum
-		i = pgm_read_byte(hexdata++);
-		checksum += i;
+unsigned char upload_hex_file_to_device() {
+	Serial.println(F("Waiting for hex data..."));
+	return upload_hex(NULL);
+}
 
-		if (checksum) {
-			Serial.println("Checksum error!");
-			break;
-		}
+unsigned char upload_hex_from_progmem(PGM_P hexdata) {
+	Serial.println(F("Programming hex data..."));
+	return upload_hex(hexdata);
+}
 
-		done = handle_hex_file_line(bytecount, address, recordtype, data);
+/* ICSPDAT of all targets */
+void dat_mode(unsigned char mode) {
+	unsigned char t;
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pinMode(target_dat[t], mode);
 	}
+}
 
+void dat_write(unsigned char bit) {
+	unsigned char t;
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		digitalWrite(target_dat[t], bit ? HIGH : LOW);
+	}
 }
 
 /* low level bit transfer */
 void write_bit(unsigned char bit) {
 	digitalWrite(ICSPCLK, HIGH);
-	digitalWrite(ICSPDAT, bit ? HIGH : LOW);
+	dat_write(bit);
 	TCKH();
 	digitalWrite(ICSPCLK, LOW);
 	TCKL();
 	//  digitalWrite(ICSPDAT,LOW); // REM?
 }
 
+/* Read one bit from all targets, bit t of the result is from target t */
 unsigned char read_bit() {
-	unsigned char rv;
+	unsigned char rv = 0, t;
 
 	digitalWrite(ICSPCLK, HIGH);
 	TCKH();
-	rv = (digitalRead(ICSPDAT) == HIGH);
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		if (digitalRead(target_dat[t]) == HIGH) {
+			rv |= (1 << t);
+		}
+	}
 	digitalWrite(ICSPCLK, LOW);
 	TCKL();
 
@@ -496,13 +729,13 @@ unsigned char read_bit() {
 /* Program/verify mode entry and exit */
 void hvp_entry() {
 
-	Serial.println("Enter high voltage programming mode");
+	Serial.println(F("Enter high voltage programming mode"));
 
 	pinMode(ICSPCLK, OUTPUT);
 	pinMode(VDD1, OUTPUT);
 	pinMode(VDD2, OUTPUT);
 	pinMode(VDD3, OUTPUT);
-	pinMode(ICSPDAT, OUTPUT);
+	dat_mode(OUTPUT);
 	// Set VPP to VIHH (9v)
 
 	TENTS();
@@ -516,7 +749,8 @@ void lvp_entry() {
 	unsigned long LVP_magic = 0b01001101010000110100100001010000;
 	unsigned char i;
 
-	Serial.println("Enter low voltage programming mode");
+	Serial.println(F("Enter low voltage programming mode"));
+	target_failed = 0;
 
 	pinMode(nMCLR, OUTPUT);
 	pinMode(VDD1, OUTPUT);
@@ -530,7 +764,7 @@ void lvp_entry() {
 	TENTS();
 	digitalWrite(nMCLR, LOW);
 	pinMode(ICSPCLK, OUTPUT);
-	pinMode(ICSPDAT, OUTPUT);
+	dat_mode(OUTPUT);
 	TENTH();
 
 	// Send "MCHP" backwards, to unlock LVP mode
@@ -542,11 +776,11 @@ void lvp_entry() {
 
 void p_exit() {
 
-	Serial.println("Leaving programming mode");
+	Serial.println(F("Leaving programming mode"));
 
 	digitalWrite(nMCLR, LOW); // LVP mode
 	digitalWrite(ICSPCLK, LOW);
-	digitalWrite(ICSPDAT, LOW);
+	dat_write(LOW);
 	digitalWrite(VDD1, LOW);
 	digitalWrite(VDD2, LOW);
 	digitalWrite(VDD3, LOW);
@@ -557,7 +791,7 @@ void p_exit() {
 	pinMode(VDD1, INPUT);
 	pinMode(VDD2, INPUT);
 	pinMode(VDD3, INPUT);
-	pinMode(ICSPDAT, INPUT);
+	dat_mode(INPUT);
 }
 
 /* low level command transfer */
@@ -583,23 +817,29 @@ void write_command_with_data(unsigned char command, unsigned int data) {
 	write_bit(0);
 }
 
+/* Data read from each target is kept in target_read[], the data from the first target is returned */
 unsigned int read_command(unsigned char command) {
-	unsigned char i;
-	unsigned int data = 0;
+	unsigned char i, t, bits;
 
 	write_command(command);
 
-	pinMode(ICSPDAT, INPUT);
+	dat_mode(INPUT);
 
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		target_read[t] = 0;
+	}
 	read_bit();
 	for (i = 0; i < 14; i++) {
-		data |= ((unsigned int) (read_bit() & 0x1) << i);
+		bits = read_bit();
+		for (t = 0; t < NO_OF_TARGETS; t++) {
+			target_read[t] |= ((unsigned int) ((bits >> t) & 0x1) << i);
+		}
 	}
 	read_bit();
 
-	pinMode(ICSPDAT, OUTPUT);
+	dat_mode(OUTPUT);
 
-	return data;
+	return target_read[0];
 }
 
 /* high level commands */
@@ -647,13 +887,13 @@ void end_externally_timed_programming() {
 }
 
 void bulk_erase_program_memory() {
-	Serial.println("Bulk erasing program memory");
+	Serial.println(F("Bulk erasing program memory"));
 	write_command(BULK_ERASE_PROGRAM_MEMORY);
 	TERAB();
 }
 
 void bulk_erase_data_memory() {
-	Serial.println("Bulk erasing data memory");
+	Serial.println(F("Bulk erasing data memory"));
 	write_command(BULK_ERASE_DATA_MEMORY);
 	TERAB();
 }
@@ -665,20 +905,21 @@ void row_erase_program_memory() {
 
 /* algorithms */
 void bulk_erase_device() {
-	Serial.println("Bulk erasing device");
+	Serial.println(F("Bulk erasing device"));
 	load_configuration(0);
 	bulk_erase_program_memory();
 	bulk_erase_data_memory();
 }
 
 void get_device_id(unsigned int *magic, unsigned int *version,
-		unsigned int *deviceid) {
+		unsigned int *layout, unsigned int *deviceid) {
 	lvp_entry();
 	load_configuration(0);
 	*magic = read_data_from_program_memory();
 	increment_address();
 	*version = read_data_from_program_memory();
 	increment_address();
+	*layout = read_data_from_program_memory();
 
 	increment_address();
 	increment_address();
@@ -691,14 +932,755 @@ void get_device_id(unsigned int *magic, unsigned int *version,
 }
 
 void write_magic(unsigned int data_word_out) {
-	Serial.println("Writing magic.");
+	Serial.println(F("Writing magic."));
+	load_configuration(0);
+	load_data_for_program_memory(data_word_out);
+	begin_internally_timed_programming();
+}
+
+#ifdef EEPROM_UNIT_ADDRESS
+/* Set temperature unit to Fahrenheit in EEPROM, keeping the power on state.
+ * Used when only program memory is uploaded, to keep EEPROM data from
+ * earlier (Fahrenheit only) firmware in the right unit.
+ */
+void write_eeprom_unit_fahrenheit() {
+	unsigned char i, data_out;
+	Serial.println(F("Setting temperature unit to Fahrenheit."));
+	reset_address();
+	for (i = 0; i < EEPROM_UNIT_ADDRESS; i++) {
+		increment_address();
+	}
+	data_out = EEPROM_UNIT_FAHRENHEIT | (read_data_from_data_memory() & 0x1);
+	load_data_for_data_memory(data_out);
+	begin_internally_timed_programming();
+	increment_address();
+	load_data_for_data_memory(0);
+	begin_internally_timed_programming();
+	reset_address();
+}
+#endif
+
+/* Print all of EEPROM as hex, 16 bytes per line prefixed by the address.
+ * Used to read out data kept by the firmware, such as the hourly history.
+ */
+void dump_data_memory() {
+	unsigned int i;
+	unsigned char data_in;
+	reset_address();
+	for (i = 0; i < 256; i++) {
+		if ((i & 0xf) == 0) {
+			if (i < 0x10) {
+				Serial.print('0');
+			}
+			Serial.print(i, HEX);
+			Serial.print(':');
+		}
+		data_in = read_data_from_data_memory();
+		Serial.print(' ');
+		if (data_in < 0x10) {
+			Serial.print('0');
+		}
+		Serial.print(data_in, HEX);
+		if ((i & 0xf) == 0xf) {
+			Serial.println();
+		}
+		increment_address();
+	}
+	reset_address();
+}
+
+/* Intel hex output, the checksum is kept while the record is sent */
+unsigned char hex_out_checksum;
+
+void print_hex_byte(unsigned char data) {
+	static const char digits[] PROGMEM = "0123456789ABCDEF";
+
+	Serial.write(pgm_read_byte(&digits[data >> 4]));
+	Serial.write(pgm_read_byte(&digits[data & 0xf]));
+	hex_out_checksum -= data;
+}
+
+void print_hex_record(unsigned int address, unsigned char recordtype, unsigned char data[], unsigned char bytecount) {
+	unsigned char i;
+
+	hex_out_checksum = 0;
+	Serial.write(':');
+	print_hex_byte(bytecount);
+	print_hex_byte(address >> 8);
+	print_hex_byte(address);
+	print_hex_byte(recordtype);
+	for (i = 0; i < bytecount; i++) {
+		print_hex_byte(data[i]);
+	}
+	print_hex_byte(hex_out_checksum);
+	Serial.println();
+}
+
+/* Read a device word and store it in a hex record, least significant byte first */
+unsigned int read_hex_word(unsigned char eeprom, unsigned char *data) {
+	unsigned int word = eeprom ? read_data_from_data_memory() : read_data_from_program_memory();
+
+	increment_address();
+	data[0] = word;
+	data[1] = word >> 8;
+
+	return word;
+}
+
+/* Read all of program memory, configuration words and EEPROM (of the first target) and send
+ * them as an Intel hex file, with the same addresses as the hex files built for upload.
+ * Blank program memory is left out, as in the built hex file. The 16 bit sum of all program
+ * memory words (blank words included) is printed after the end of file record.
+ */
+void dump_hex() {
+	unsigned char *data = line_buffer;
+	unsigned int pc, sum = 0;
+	unsigned char i, blank;
+
+	reset_address();
+	for (pc = 0; pc < PROGRAM_MEMORY_WORDS; pc += HEX_RECORD_WORDS) {
+		blank = 1;
+		for (i = 0; i < HEX_RECORD_WORDS; i++) {
+			unsigned int word = read_hex_word(0, &data[i << 1]);
+			sum += word;
+			if (word != BLANK_WORD) {
+				blank = 0;
+			}
+		}
+		if (!blank) {
+			print_hex_record(pc << 1, 0, data, HEX_RECORD_WORDS << 1);
+		}
+	}
+
+	// Configuration space and EEPROM are above 64k (byte address), in the same extended linear segment
+	data[0] = 0;
+	data[1] = HEX_CONFIG_WORD >> 15;
+	print_hex_record(0, 4, data, 2);
+
+	load_configuration(0);
+	for (i = 0; i < CONFIG_WORDS; i++) {
+		read_hex_word(0, &data[i << 1]);
+	}
+	print_hex_record((unsigned int) (HEX_CONFIG_WORD << 1), 0, data, CONFIG_WORDS << 1);
+
+	reset_address();
+	for (pc = 0; pc < EEPROM_BYTES; pc += HEX_RECORD_WORDS) {
+		for (i = 0; i < HEX_RECORD_WORDS; i++) {
+			read_hex_word(1, &data[i << 1]);
+		}
+		print_hex_record((unsigned int) ((HEX_EEPROM_WORD + pc) << 1), 0, data, HEX_RECORD_WORDS << 1);
+	}
+	reset_address();
+
+	print_hex_record(0, 1, data, 0);
+	Serial.print(F("Program memory checksum: 0x"));
+	Serial.println(sum, HEX);
+}
+
+/* Frame n of the ring buffer, in line_buffer */
+#define telemetry_frame(n)	(&line_buffer[(n) * TELEMETRY_FRAME_SIZE])
+#if TELEMETRY_FRAMES * TELEMETRY_FRAME_SIZE > LINE_BUFFER_SIZE
+#error "Telemetry frames do not fit in line_buffer"
+#endif
+
+void print_tenths(int value) {
+	if (value < 0) {
+		Serial.print('-');
+		value = -value;
+	}
+	Serial.print(value / 10, DEC);
+	Serial.print('.');
+	Serial.print(value % 10, DEC);
+}
+
+int frame_word(unsigned char *data) {
+	return (int) ((((unsigned int) data[0]) << 8) | data[1]);
+}
+
+void print_telemetry_frame(unsigned char *frame) {
+	print_tenths(frame_word(&frame[0]));
+	Serial.print(',');
+	print_tenths(frame_word(&frame[2]));
+	Serial.print(',');
+	print_tenths(frame_word(&frame[4]));
+	Serial.print(',');
+	Serial.print(frame[6] & 0x1, DEC);
+	Serial.print(',');
+	Serial.print((frame[6] >> 1) & 0x1, DEC);
+	Serial.print(',');
+	Serial.print((frame[6] >> 2) & 0x1, DEC);
+	Serial.print(',');
+	Serial.print(((frame[6] >> 3) & 0x1) ? 'F' : 'C');
+	Serial.print(',');
+	Serial.print(frame[7], DEC);
+	Serial.print(',');
+	Serial.print(frame[8], DEC);
+	Serial.print(',');
+	Serial.println((unsigned int) frame_word(&frame[9]), DEC);
+}
+
+/* Receive one telemetry byte, after the start of its start bit.
+ * Each bit is sampled in its middle.
+ * return: the byte, or -1 if there is no stop bit
+ */
+int telemetry_byte() {
+	unsigned long start = micros();
+	unsigned char i, data = 0;
+
+	for (i = 1; i <= 8; i++) {
+		while (micros() - start < TELEMETRY_BIT_US * i + TELEMETRY_BIT_US / 2)
+			;
+		data >>= 1;
+		if (digitalRead(ICSPCLK) == HIGH) {
+			data |= 0x80;
+		}
+	}
+	while (micros() - start < TELEMETRY_BIT_US * 9 + TELEMETRY_BIT_US / 2)
+		;
+	return digitalRead(ICSPCLK) == HIGH ? data : -1;
+}
+
+/* Receive telemetry frames and forward them to host as CSV, until a character is received.
+ * The controller sends a frame once a second as 1000 baud serial on ICSPCLK. Frames are
+ * checked and put in a ring buffer, which is only sent to host in the gap between frames,
+ * so serial output does not make us miss a start bit.
+ */
+void monitor_telemetry() {
+	unsigned char frame[TELEMETRY_FRAME_SIZE];
+	unsigned char head = 0, tail = 0, count = 0, i, sum;
+	int data;
+	unsigned long last_byte = millis();
+
+	pinMode(ICSPCLK, INPUT);
+	pinMode(ICSPDAT, INPUT);
+	Serial.println(F("Monitoring telemetry, send any character to stop."));
+	Serial.println(F("temperature,temperature2,setpoint,cooling,heating,alarm,unit,run_mode,step,duration"));
+
+	while (Serial.available() == 0) {
+		if (digitalRead(ICSPCLK) == LOW) {
+			data = telemetry_byte();
+			if (data < 0) {
+				// Framing error, such as probe 2 pulling the line low between frames
+				count = TELEMETRY_FRAME_SIZE + 1;
+				continue;
+			}
+			last_byte = millis();
+			if (count < TELEMETRY_FRAME_SIZE) {
+				frame[count] = data;
+			}
+			if (++count == TELEMETRY_FRAME_SIZE) {
+				sum = 0;
+				for (i = 0; i < TELEMETRY_FRAME_SIZE; i++) {
+					sum += frame[i];
+				}
+				if (sum == 0) {
+					memcpy(telemetry_frame(head), frame, TELEMETRY_FRAME_SIZE);
+					head = (head + 1) % TELEMETRY_FRAMES;
+					if (head == tail) {
+						// Buffer full, drop oldest frame
+						tail = (tail + 1) % TELEMETRY_FRAMES;
+					}
+				}
+			} else if (count > TELEMETRY_FRAME_SIZE) {
+				count = TELEMETRY_FRAME_SIZE + 1;
+			}
+		} else if (millis() - last_byte > TELEMETRY_GAP) {
+			// Between frames, drop any partial frame and send a buffered frame to host
+			count = 0;
+			if (tail != head) {
+				print_telemetry_frame(telemetry_frame(tail));
+				tail = (tail + 1) % TELEMETRY_FRAMES;
+			}
+		}
+	}
+	Serial.read();
+	Serial.println(F("Monitoring stopped."));
+}
+
+/* Wait for a rising edge on ICSPCLK.
+ * return: 0 if none within timeout ms
+ */
+unsigned char wait_rising_edge(unsigned long timeout) {
+	unsigned long start = millis();
+
+	while (digitalRead(ICSPCLK) == HIGH) {
+		if (millis() - start > timeout) {
+			return 0;
+		}
+	}
+	while (digitalRead(ICSPCLK) == LOW) {
+		if (millis() - start > timeout) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Power up the STC-1000 (not connected to mains) and time the calibration signal from
+ * firmware built with OSC_CAL against the Arduino clock. The number of 60ms ticks
+ * in a real hour is written to the last EEPROM word, where the firmware picks it up at power on.
+ * Needs an Arduino with a crystal (not a ceramic resonator) to be worthwhile.
+ */
+void calibrate_oscillator() {
+	unsigned long start, elapsed;
+	unsigned int i, ticks;
+
+	Serial.println(F("Calibrating oscillator."));
+
+	// Ask for the calibration signal by holding ICSPCLK high at power on, the firmware
+	// drives it high as well until we let go. ICSPDAT low keeps a bootloader out of the way,
+	// it checks the firmware (about 0.2s) and starts it while ICSPCLK is still held.
+	digitalWrite(ICSPCLK, HIGH);
+	pinMode(ICSPCLK, OUTPUT);
+	dat_mode(OUTPUT);
+	dat_write(LOW);
+	pinMode(nMCLR, OUTPUT);
+	pinMode(VDD1, OUTPUT);
+	pinMode(VDD2, OUTPUT);
+	pinMode(VDD3, OUTPUT);
+	digitalWrite(nMCLR, HIGH);
+	digitalWrite(VDD1, HIGH);
+	digitalWrite(VDD2, HIGH);
+	digitalWrite(VDD3, HIGH);
+	delay(OSC_CAL_REQUEST_MS);
+	pinMode(ICSPCLK, INPUT);
+	dat_mode(INPUT);
+
+	// Skip the first period, then time the rest
+	if (!wait_rising_edge(1000)) {
+		p_exit();
+		Serial.println(F("No calibration signal, is the firmware built with OSC_CAL and Pb 0?"));
+		return;
+	}
+	start = micros();
+	for (i = 0; i < OSC_CAL_PERIODS; i++) {
+		if (!wait_rising_edge(10)) {
+			p_exit();
+			Serial.println(F("Calibration signal lost."));
+			return;
+		}
+	}
+	elapsed = micros() - start;
+	p_exit();
+
+	// Ticks per hour scale with the oscillator frequency, nominal time is 2000us per period
+	ticks = (unsigned int) ((float) OSC_CAL_TICKS_PER_HOUR * (OSC_CAL_PERIODS * 2000.0) / elapsed + 0.5);
+	Serial.print(F("Measured "));
+	Serial.print(elapsed, DEC);
+	Serial.print(F("us, expected "));
+	Serial.print(OSC_CAL_PERIODS * 2000UL, DEC);
+	Serial.print(F("us, "));
+	Serial.print(ticks, DEC);
+	Serial.println(F(" ticks per hour."));
+	if (ticks < OSC_CAL_MIN || ticks > OSC_CAL_MAX) {
+		Serial.println(F("Out of range, not written."));
+		return;
+	}
+
+	lvp_entry();
+	reset_address();
+	for (i = 0; i < OSC_CAL_BYTE; i++) {
+		increment_address();
+	}
+	write_eeprom_byte(ticks);
+	write_eeprom_byte(ticks >> 8);
+	reset_address();
+	p_exit();
+	Serial.println(F("Calibration written."));
+}
+
+void write_eeprom_byte(unsigned char data_out) {
+	load_data_for_data_memory(data_out);
+	begin_internally_timed_programming();
+	increment_address();
+}
+
+#define boot_row		line_buffer			/* Row being collected from the hex data, low byte first */
+unsigned int boot_crc;						/* CRC of the firmware, in the order the bootloader works it out */
+
+#define BOOT_CRC_PAGE1			0
+#define BOOT_CRC_PAGE0			1
+#define BOOT_SEND				2
+
+/* The CRC is linear, so the CRC over the firmware followed by the low bytes of the three words at
+ * BOOT_APP_CRC (high bytes 0) comes out 0 when those bytes are the xor of boot_crc_fix[i] for each
+ * bit i set in the CRC over the firmware followed by six zero bytes. boot_crc_fix[i] gives a CRC
+ * of just bit i, found by Gaussian elimination over the CRCs of the single bits of those bytes.
+ */
+const unsigned char boot_crc_fix[16][3] PROGMEM = {
+	{ 0xDE, 0x57, 0x00 }, { 0x00, 0x4E, 0x04 }, { 0xD6, 0x2B, 0x00 }, { 0x99, 0x17, 0x04 },
+	{ 0x58, 0x79, 0x04 }, { 0x66, 0x45, 0x00 }, { 0x45, 0x2B, 0x00 }, { 0x8A, 0x56, 0x00 },
+	{ 0xA8, 0x4C, 0x04 }, { 0xB3, 0x6E, 0x04 }, { 0x85, 0x2A, 0x04 }, { 0x60, 0x03, 0x04 },
+	{ 0x9F, 0x10, 0x00 }, { 0x0B, 0x61, 0x04 }, { 0xC0, 0x75, 0x00 }, { 0x3C, 0x0A, 0x04 }
+};
+
+/* CRC-16 (0x1021), as the bootloader and EEPROM_CRC work it out */
+unsigned int boot_crc_byte(unsigned int crc, unsigned char data) {
+	unsigned char i;
+
+	crc ^= ((unsigned int) data) << 8;
+	for (i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/* Clock a byte in to the bootloader, and add it to the CRC */
+unsigned int boot_write(unsigned int crc, unsigned char data) {
+	unsigned char i;
+
+	for (i = 0; i < 8; i++) {
+		digitalWrite(ICSPCLK, HIGH);
+		dat_write((data >> i) & 1);
+		delayMicroseconds(BOOT_CLK_HIGH_US);
+		digitalWrite(ICSPCLK, LOW);
+		delayMicroseconds(BOOT_CLK_LOW_US);
+	}
+	delayMicroseconds(BOOT_BYTE_GAP_US);
+	return boot_crc_byte(crc, data);
+}
+
+/* Let go of ICSPDAT and clock out the reply of the bootloader
+ * return: BOOT_ACK, BOOT_NAK, or anything else without a bootloader
+ */
+unsigned char boot_reply() {
+	unsigned char reply = 0, i;
+
+	dat_mode(INPUT);
+	delayMicroseconds(BOOT_REPLY_US);
+	for (i = 0; i < 2; i++) {
+		reply = (reply << 1) | (digitalRead(ICSPDAT) == HIGH);
+		digitalWrite(ICSPCLK, HIGH);
+		delayMicroseconds(BOOT_CLK_HIGH_US);
+		digitalWrite(ICSPCLK, LOW);
+		delayMicroseconds(BOOT_CLK_LOW_US);
+	}
+	return reply;
+}
+
+void boot_blank_row() {
+	unsigned char i;
+
+	for (i = 0; i < BOOT_ROW_WORDS * 2; i += 2) {
+		boot_row[i] = BLANK_WORD & 0xff;
+		boot_row[i + 1] = BLANK_WORD >> 8;
+	}
+}
+
+/* Send the collected row at address, until the bootloader acknowledges it
+ * return: 0 on error
+ */
+unsigned char boot_send_row(unsigned int address) {
+	unsigned char retry, i;
+
+	for (retry = 0; retry < BOOT_RETRIES; retry++) {
+		unsigned int crc = 0;
+
+		dat_mode(OUTPUT);
+		crc = boot_write(crc, address & 0xff);
+		crc = boot_write(crc, address >> 8);
+		delay(BOOT_ROW_MS);
+		for (i = 0; i < BOOT_ROW_WORDS * 2; i++) {
+			crc = boot_write(crc, boot_row[i]);
+		}
+		delay(BOOT_ROW_MS);
+		boot_write(0, crc >> 8);
+		boot_write(0, crc & 0xff);
+		if (boot_reply() == BOOT_ACK) {
+			Serial.print('.');
+			return 1;
+		}
+		Serial.print('x');
+	}
+	Serial.println();
+	Serial.print(F("No ACK for the row at address 0x"));
+	Serial.println(address, HEX);
+	return 0;
+}
+
+/* Add a collected row to the CRC of the firmware (BOOT_CRC_PAGE1 and then BOOT_CRC_PAGE0, in
+ * the order the bootloader works it out), or send it to the bootloader (BOOT_SEND), with the words
+ * that make the CRC 0. Word 0 of row 0 is the jump to the bootloader, the rows of the bootloader
+ * itself are skipped.
+ * return: 0 on error
+ */
+unsigned char boot_end_row(unsigned char row, unsigned char mode) {
+	unsigned int address = row * BOOT_ROW_WORDS;
+	unsigned char i;
+
+	if (address >= BOOT_START && address < BOOT_END) {
+		boot_blank_row();
+		return 1;
+	}
+	if (row == 0) {
+		if (mode != BOOT_SEND && (boot_row[0] || boot_row[1])) {
+			Serial.println(F("Firmware does not start with a nop, there is no room for the jump to the bootloader."));
+			return 0;
+		}
+		boot_row[0] = BOOT_GOTO & 0xff;
+		boot_row[1] = BOOT_GOTO >> 8;
+	}
+	if (mode == BOOT_SEND) {
+		if (row == BOOT_APP_CRC / BOOT_ROW_WORDS) {
+			unsigned int crc = boot_crc;
+
+			for (i = 0; i < 6; i++) {
+				crc = boot_crc_byte(crc, 0);
+			}
+			for (i = 0; i < 6; i += 2) {
+				unsigned char j, fix = 0;
+
+				for (j = 0; j < 16; j++) {
+					if (crc & (1U << j)) {
+						fix ^= pgm_read_byte(&boot_crc_fix[j][i / 2]);
+					}
+				}
+				boot_row[(BOOT_APP_CRC % BOOT_ROW_WORDS) * 2 + i] = fix;
+				boot_row[(BOOT_APP_CRC % BOOT_ROW_WORDS) * 2 + i + 1] = 0;
+			}
+		}
+		if (!boot_send_row(address)) {
+			return 0;
+		}
+	} else if ((address >= BOOT_END) == (mode == BOOT_CRC_PAGE1)) {
+		for (i = 0; i < BOOT_ROW_WORDS * 2; i++) {
+			if (address + i / 2 < BOOT_APP_CRC || address >= BOOT_END) {
+				boot_crc = boot_crc_byte(boot_crc, boot_row[i]);
+			}
+		}
+	}
+	boot_blank_row();
+	return 1;
+}
+
+/* Collect the program memory records of hex data in program memory into rows, all the rows
+ * of program memory (blank where there is no data), and pass them to boot_end_row().
+ * Configuration and EEPROM records are skipped, records have to come in address order.
+ * return: 0 on error
+ */
+unsigned char boot_hex_rows(PGM_P hexdata, unsigned char mode) {
+	unsigned int base = 0;
+	unsigned char row = 0;
+
+	boot_blank_row();
+	while (1) {
+		unsigned char bytecount = pgm_read_byte(hexdata++);
+		unsigned int address = ((unsigned int) pgm_read_byte(hexdata++)) << 8;
+		unsigned char recordtype;
+		unsigned int i;
+
+		address |= pgm_read_byte(hexdata++);
+		recordtype = pgm_read_byte(hexdata++);
+		if (recordtype == 1) {
+			break;
+		} else if (recordtype == 4) {
+			base = (((unsigned int) pgm_read_byte(hexdata)) << 8) | pgm_read_byte(hexdata + 1);
+		} else if (recordtype == 0 && base == 0) {
+			for (i = 0; i < bytecount; i += 2) {
+				unsigned int word_address = (address + i) >> 1;
+
+				if (word_address >= BOOT_APP_CRC && word_address < BOOT_END) {
+					Serial.print(F("Firmware overlaps the bootloader at address 0x"));
+					Serial.print(word_address, HEX);
+					Serial.println(F(", build it with BOOTLOADER=1."));
+					return 0;
+				}
+				if (word_address / BOOT_ROW_WORDS < row) {
+					Serial.println(F("Hex data not in address order."));
+					return 0;
+				}
+				while (word_address / BOOT_ROW_WORDS > row) {
+					if (!boot_end_row(row++, mode)) {
+						return 0;
+					}
+				}
+				boot_row[(word_address % BOOT_ROW_WORDS) * 2] = pgm_read_byte(hexdata + i);
+				boot_row[(word_address % BOOT_ROW_WORDS) * 2 + 1] = pgm_read_byte(hexdata + i + 1);
+			}
+		}
+		hexdata += bytecount + 1; // Data and checksum
+	}
+	while (row < BOOT_ROWS) {
+		if (!boot_end_row(row++, mode)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Power up the STC-1000 with ICSPCLK high, and ICSPDAT high to ask for the bootloader */
+void boot_power_up(unsigned char dat) {
+	pinMode(nMCLR, OUTPUT);
+	pinMode(VDD1, OUTPUT);
+	pinMode(VDD2, OUTPUT);
+	pinMode(VDD3, OUTPUT);
+	digitalWrite(nMCLR, LOW);
+	digitalWrite(VDD1, HIGH);
+	digitalWrite(VDD2, HIGH);
+	digitalWrite(VDD3, HIGH);
+	pinMode(ICSPCLK, OUTPUT);
+	digitalWrite(ICSPCLK, dat);
+	dat_mode(dat ? OUTPUT : INPUT);
+	dat_write(dat);
+	delay(10);
+	digitalWrite(nMCLR, HIGH);
+}
+
+/* Update program memory through the bootloader, which has to be uploaded first
+ * (see src/bootloader.asm). The STC-1000 is powered up into the bootloader and all rows
+ * outside the bootloader are sent, each acknowledged by the bootloader. It is then powered
+ * up again, to see that the bootloader finds the CRC of the firmware right and starts it.
+ * EEPROM, configuration words and the version in the user IDs are left as they are.
+ */
+void boot_upload(PGM_P hexdata) {
+	unsigned char reply;
+
+	Serial.println(F("Updating firmware through the bootloader."));
+	boot_crc = 0;
+	if (!boot_hex_rows(hexdata, BOOT_CRC_PAGE1) || !boot_hex_rows(hexdata, BOOT_CRC_PAGE0)) {
+		return;
+	}
+
+	// ICSPCLK and ICSPDAT high through reset keep the bootloader from starting the firmware,
+	// it answers with an ACK
+	boot_power_up(HIGH);
+	delay(BOOT_ENTRY_MS);
+	if (boot_reply() != BOOT_ACK) {
+		p_exit();
+		Serial.println(F("No bootloader, upload it with 'u' first."));
+		return;
+	}
+	reply = boot_hex_rows(hexdata, BOOT_SEND);
+	Serial.println();
+	p_exit();
+	if (!reply) {
+		Serial.println(F("Update failed, send 'n' again (the bootloader keeps the firmware from starting until then)."));
+		return;
+	}
+
+	// Without ICSPDAT held high, the bootloader checks the firmware and starts it, or NAKs
+	boot_power_up(LOW);
+	delay(BOOT_CHECK_MS);
+	reply = boot_reply();
+	p_exit();
+	Serial.println(reply == BOOT_NAK ? F("Firmware check failed, send 'n' again.") : F("Firmware updated."));
+}
+
+/* Check magic and the layout in user ID 2, before program memory is erased.
+ * return: EEPROM_CONVERT if the device has EEPROM data in the layout of 1.07 (or earlier) and
+ * the sketch has another layout, EEPROM_DIFFERENT if it has some other layout than the sketch
+ */
+unsigned char eeprom_needs_migration() {
+	unsigned int magic, layout;
+
+	load_configuration(0);
+	magic = read_data_from_program_memory();
+	increment_address();
+	increment_address();
+	layout = read_data_from_program_memory();
+	if ((magic != STC1000P_MAGIC_C && magic != STC1000P_MAGIC_F) || layout == STC1000P_EEPROM_LAYOUT) {
+		return EEPROM_KEEP;
+	}
+	return layout == EEPROM_LAYOUT_1_07 ? EEPROM_CONVERT : EEPROM_DIFFERENT;
+}
+
+#ifdef EEPROM_MIGRATE_PROFILES
+const unsigned char migrate_set_menu[] PROGMEM = EEPROM_MIGRATE_SET_MENU_1_07;
+const int migrate_defaults[2][EEPROM_MIGRATE_SET_MENU_WORDS] PROGMEM = {
+	EEPROM_MIGRATE_SET_MENU_C, EEPROM_MIGRATE_SET_MENU_F
+};
+#if !defined(EEPROM_MIGRATE_PACKED_SP_OFFSET) && EEPROM_MIGRATE_PROFILES > OLD_NO_OF_PROFILES
+#error "Only packed profiles can be added"
+#endif
+
+/* Convert EEPROM data of 1.07 to the layout of the sketch, after the new firmware has been uploaded,
+ * so profiles and settings are kept when only program memory is uploaded. Profiles that no longer
+ * fit are dropped and profiles that are added (packed only) are cleared, set menu items that are new
+ * get their defaults (in Fahrenheit if fahrenheit is set) and thermostat mode is moved to its new value.
+ */
+void migrate_eeprom(unsigned char fahrenheit) {
+	unsigned char *eeprom_data = line_buffer;
+	unsigned int i, sp, dh;
+	unsigned char p, s;
+
+	Serial.println(F("Converting EEPROM data."));
+	reset_address();
+	for (i = 0; i < 256; i++) {
+		eeprom_data[i] = read_data_from_data_memory();
+		increment_address();
+	}
+
+	reset_address();
+#ifdef EEPROM_MIGRATE_PACKED_SP_OFFSET
+	for (p = 0; p < EEPROM_MIGRATE_PROFILES; p++) {
+		for (s = 0; s < 10; s++) {
+			sp = EEPROM_MIGRATE_PACKED_SP_OFFSET;
+			dh = 0;
+			if (p < OLD_NO_OF_PROFILES) {
+				i = (p * OLD_PROFILE_WORDS + (s << 1)) << 1;
+				sp += eeprom_data[i] | (eeprom_data[i + 1] << 8);
+				dh = eeprom_data[i + 2] | (eeprom_data[i + 3] << 8);
+			}
+			write_eeprom_byte(sp);
+			if (s < 9) {
+				write_eeprom_byte(((sp >> 8) & 0x0f) | ((dh >> 4) & 0xf0));
+				write_eeprom_byte(dh);
+			} else {
+				write_eeprom_byte((sp >> 8) & 0x0f);
+			}
+		}
+	}
+#else
+	// Profiles as they are, the set menu starts earlier
+	for (i = 0; i < (EEPROM_MIGRATE_PROFILES * OLD_PROFILE_WORDS) << 1; i++) {
+		write_eeprom_byte(eeprom_data[i]);
+	}
+#endif
+
+	for (s = 0; s < EEPROM_MIGRATE_SET_MENU_WORDS; s++) {
+		p = pgm_read_byte(&migrate_set_menu[s]);
+		if (p == 255) {
+			dh = pgm_read_word(&migrate_defaults[fahrenheit][s]);
+		} else {
+			i = (OLD_NO_OF_PROFILES * OLD_PROFILE_WORDS + p) << 1;
+			dh = eeprom_data[i] | (eeprom_data[i + 1] << 8);
+		}
+		// Thermostat mode, or a profile that did not fit
+		if (s == EEPROM_MIGRATE_RUN_MODE && (dh >= OLD_NO_OF_PROFILES || dh >= EEPROM_MIGRATE_PROFILES)) {
+			dh = EEPROM_MIGRATE_PROFILES;
+		}
+		write_eeprom_byte(dh);
+		write_eeprom_byte(dh >> 8);
+	}
+
+	for (s = 0; s < EEPROM_MIGRATE_CLEAR_WORDS; s++) {
+		write_eeprom_byte(0);
+		write_eeprom_byte(0);
+	}
+	for (s = 0; s < EEPROM_MIGRATE_CRC_WORDS; s++) {
+		write_eeprom_byte(0xff);
+		write_eeprom_byte(0xff);
+	}
+	reset_address();
+}
+#else
+/* Firmware with the EEPROM layout of 1.07, there is nothing to convert to */
+void migrate_eeprom(unsigned char fahrenheit) {
+}
+#endif
+
+/* EEPROM layout of the firmware (STC1000P_EEPROM_LAYOUT), in user ID 2 */
+void write_layout(unsigned int data_word_out) {
+	Serial.println(F("Writing EEPROM layout."));
 	load_configuration(0);
+	increment_address();
+	increment_address();
 	load_data_for_program_memory(data_word_out);
 	begin_internally_timed_programming();
 }
 
 void write_version(unsigned int data_word_out) {
-	Serial.println("Writing version.");
+	Serial.println(F("Writing version."));
 	load_configuration(0);
 	increment_address();
 	load_data_for_program_memory(data_word_out);
@@ -0,0 +1,430 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Profile compiler.
+ *
+ * Reads a description of the profiles and set menu values, simulates a profile run
+ * using update_profile() from the firmware sources and writes the EEPROM image as
+ * Intel HEX, for upload with the 'v' command of the sketch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../src/stc1000p.h"
+
+#define PROFILE_ITEMS		19		// SP0, dh0, ..., dh8, SP9
+#define MAX_HOURS			10000	// More than 9 steps of 999 hours
+#define HEX_EEPROM_ADDRESS	0xE000	// EEPROM (0xF000) as byte address in the lower 64k of the HEX file
+#define HEX_LINE_BYTES		8		// EEPROM bytes per HEX line (each takes a word)
+
+/* EEPROM data by config address, 16 bit like on the controller */
+static short config[256];
+
+/* Set menu names and data, from the same table as the firmware */
+#define TO_NAME(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    #name,
+#define TO_MENU(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    { type, minv, maxv, dvc, dvf },
+
+static const char *setmenu_name[] = {
+	SET_MENU_DATA(TO_NAME)
+};
+
+static const struct {
+	unsigned char type;
+	int min, max, dvc, dvf;
+} setmenu[] = {
+	SET_MENU_DATA(TO_MENU)
+};
+
+/* Functions used by update_profile() */
+unsigned int eeprom_read_config(unsigned char eeprom_address){
+	return config[eeprom_address];
+}
+
+void eeprom_write_config(unsigned char eeprom_address, unsigned int data){
+	config[eeprom_address] = data;
+}
+
+#include "../src/profile.h"
+
+static const char *filename;
+static int line_no;
+
+static void error(const char *msg, const char *arg){
+	fprintf(stderr, "%s:%d: %s '%s'\n", filename, line_no, msg, arg);
+	exit(1);
+}
+
+/* Convert a limit (in Celsius) to Fahrenheit, the same way as the firmware */
+static int limit_to_fahrenheit(int value, unsigned char type){
+	if(type == type_temp){
+		return (int)lround(value * 1.8) + 320;
+	}
+	if(type == type_temp_diff){
+		return (int)lround(value * 1.8);
+	}
+	return value;
+}
+
+/* Parse a value, temperatures (with one decimal) are returned multiplied by 10 */
+static int parse_value(const char *s, unsigned char type, int min, int max, int fahrenheit){
+	char *end;
+	double v = strtod(s, &end);
+	int value;
+
+	if(end == s || *end){
+		error("bad value", s);
+	}
+	if(type <= type_temp_diff){
+		v *= 10.0;
+	} else if(v != floor(v)){
+		error("value must be an integer", s);
+	}
+	value = (int)lround(v);
+
+	if(fahrenheit){
+		min = limit_to_fahrenheit(min, type);
+		max = limit_to_fahrenheit(max, type);
+	}
+	if(value < min || value > max){
+		error("value out of range", s);
+	}
+	return value;
+}
+
+/* Read the description file.
+ * Lines are a name followed by values, '#' starts a comment.
+ * 	PrN SP0 dh0 SP1 dh1 ... SP9		Profile N, missing values are 0
+ * 	<set menu item> value			For example 'SP 20.0', 'CF F' (UNIT_MENU) or 'rn Pr2'
+ */
+static void read_description(FILE *f){
+	char line[512];
+	char *tok[PROFILE_ITEMS + 1];
+	int given[SET_MENU_ITEMS] = { 0 };
+	int values[SET_MENU_ITEMS];
+	static char profile_lines[NO_OF_PROFILES][512];
+	static int profile_line_no[NO_OF_PROFILES];
+	static char set_lines[SET_MENU_ITEMS][512];
+	static int set_line_no[SET_MENU_ITEMS];
+	int fahrenheit = 0;	// Unit set to Fahrenheit with CF, limits are converted from Celsius
+#ifdef FAHRENHEIT
+	int defaults_f = 1;	// Fahrenheit build, limits are in Fahrenheit already
+#else
+	int defaults_f = 0;
+#endif
+	int i, j, n;
+
+	// Collect lines first, as the unit must be known before values are parsed
+	for(line_no = 1; fgets(line, sizeof(line), f); line_no++){
+		char *c = strchr(line, '#');
+		char *name;
+		if(c){
+			*c = 0;
+		}
+		name = strtok(line, " \t\r\n");
+		if(!name){
+			continue;
+		}
+		c = strtok(NULL, "");
+		if(!c){
+			error("missing value for", name);
+		}
+
+		if(name[0] == 'P' && name[1] == 'r' && name[2] >= '0' && name[2] <= '9' && !name[3]){
+			i = name[2] - '0';
+			if(i >= NO_OF_PROFILES){
+				error("no such profile", name);
+			}
+			strcpy(profile_lines[i], c);
+			profile_line_no[i] = line_no;
+			continue;
+		}
+
+		for(i = 0; i < SET_MENU_ITEMS && strcmp(name, setmenu_name[i]); i++)
+			;
+		if(i == SET_MENU_ITEMS){
+			error("unknown item", name);
+		}
+		if(i == St || i == dh){
+			error("set by the run mode, can not be given", name);
+		}
+		c = strtok(c, " \t\r\n");
+		if(!c || strtok(NULL, " \t\r\n")){
+			error("expected one value for", name);
+		}
+		strcpy(set_lines[i], c);
+		set_line_no[i] = line_no;
+		given[i] = 1;
+	}
+
+#ifdef UNIT_MENU
+	// Temperature unit, the defaults of CF are the power on word for the unit
+	if(given[CF]){
+		line_no = set_line_no[CF];
+		if(!strcmp(set_lines[CF], "F") || !strcmp(set_lines[CF], "1")){
+			fahrenheit = 1;
+		} else if(strcmp(set_lines[CF], "C") && strcmp(set_lines[CF], "0")){
+			error("unit must be C or F", set_lines[CF]);
+		}
+		given[CF] = 0;
+	}
+	defaults_f = fahrenheit;
+#endif
+
+	// Set menu
+	for(i = 0; i < SET_MENU_ITEMS; i++){
+		values[i] = defaults_f ? setmenu[i].dvf : setmenu[i].dvc;
+		if(!given[i]){
+			continue;
+		}
+		line_no = set_line_no[i];
+		if(i == rn){
+			if(!strcmp(set_lines[i], "th")){
+				values[i] = THERMOSTAT_MODE;
+				continue;
+			}
+			if(set_lines[i][0] == 'P' && set_lines[i][1] == 'r'){
+				memmove(set_lines[i], set_lines[i] + 2, strlen(set_lines[i]) - 1);
+			}
+		}
+		values[i] = parse_value(set_lines[i], setmenu[i].type, setmenu[i].min, setmenu[i].max, fahrenheit);
+	}
+	for(i = 0; i < SET_MENU_ITEMS; i++){
+		config[EEADR_SET_MENU_ITEM(i)] = values[i];
+	}
+#ifndef UNIT_MENU
+	config[EEADR_POWER_ON] = POWER_ON_BIT;
+#endif
+
+	// Profiles
+	for(i = 0; i < NO_OF_PROFILES; i++){
+		line_no = profile_line_no[i];
+		n = 0;
+		for(tok[n] = strtok(profile_lines[i], " \t\r\n"); tok[n]; tok[n] = strtok(NULL, " \t\r\n")){
+			if(++n > PROFILE_ITEMS){
+				error("too many values for profile", "");
+			}
+		}
+		for(j = 0; j < n; j++){
+			if(j & 0x1){
+				config[EEADR_PROFILE_SETPOINT(i, 0) + j] = parse_value(tok[j], type_hours, 0, 999, 0);
+			} else {
+				config[EEADR_PROFILE_SETPOINT(i, 0) + j] = parse_value(tok[j], type_temp, TEMP_MIN, TEMP_MAX, fahrenheit);
+			}
+		}
+	}
+}
+
+/* Start running a profile, as when run mode is set in the menu */
+static void start_profile(unsigned char profile){
+	config[EEADR_SET_MENU_ITEM(St)] = 0;
+	config[EEADR_SET_MENU_ITEM(dh)] = 0;
+	config[EEADR_SET_MENU_ITEM(rn)] = profile;
+	if(profile < THERMOSTAT_MODE){
+		config[EEADR_SET_MENU_ITEM(SP)] = config[EEADR_PROFILE_SETPOINT(profile, 0)];
+		if(config[EEADR_PROFILE_DURATION(profile, 0)] == 0){
+			config[EEADR_SET_MENU_ITEM(rn)] = THERMOSTAT_MODE;
+		}
+	}
+}
+
+static void print_temperature(int value){
+	printf("%s%d.%d", value < 0 ? "-" : "", abs(value) / 10, abs(value) % 10);
+}
+
+/* Run a profile, calling update_profile() every hour, and print the setpoint trajectory */
+static void simulate(unsigned char profile){
+	short saved[256];
+	int hour;
+
+	memcpy(saved, config, sizeof(config));
+	start_profile(profile);
+
+	printf("hour,step,duration,setpoint\n");
+	for(hour = 0; hour < MAX_HOURS; hour++){
+		int running = (unsigned char)config[EEADR_SET_MENU_ITEM(rn)] < THERMOSTAT_MODE;
+		if(running){
+			printf("%d,%d,%d,", hour, config[EEADR_SET_MENU_ITEM(St)], config[EEADR_SET_MENU_ITEM(dh)]);
+		} else {
+			printf("%d,th,,", hour);
+		}
+		print_temperature(config[EEADR_SET_MENU_ITEM(SP)]);
+		printf("\n");
+		if(!running){
+			break;
+		}
+		update_profile();
+	}
+
+	memcpy(config, saved, sizeof(config));
+}
+
+/* Pack the configuration into the EEPROM layout (see stc1000p.h) */
+static int pack_eeprom(unsigned char *eeprom){
+	int p, s, i, n = 0;
+
+	for(p = 0; p < NO_OF_PROFILES; p++){
+#ifdef PACKED_EEPROM
+		for(s = 0; s < 9; s++){
+			unsigned int sp = config[EEADR_PROFILE_SETPOINT(p, s)] + SP_OFFSET;
+			unsigned int dh = config[EEADR_PROFILE_DURATION(p, s)];
+			eeprom[n++] = sp & 0xff;
+			eeprom[n++] = ((sp >> 8) & 0x0f) | ((dh >> 4) & 0xf0);
+			eeprom[n++] = dh & 0xff;
+		}
+		i = config[EEADR_PROFILE_SETPOINT(p, 9)] + SP_OFFSET;
+		eeprom[n++] = i & 0xff;
+		eeprom[n++] = (i >> 8) & 0x0f;
+#else
+		for(s = 0; s < PROFILE_ITEMS; s++){
+			unsigned int w = config[EEADR_PROFILE_SETPOINT(p, 0) + s];
+			eeprom[n++] = w & 0xff;
+			eeprom[n++] = (w >> 8) & 0xff;
+		}
+#endif
+	}
+
+	// Set menu, followed by statistics, health counters and history (all cleared)
+	for(i = 0; i < EEPROM_WORD_ITEMS; i++){
+		unsigned int w = config[EEADR_SET_MENU + i];
+		eeprom[n++] = w & 0xff;
+		eeprom[n++] = (w >> 8) & 0xff;
+	}
+
+#ifdef EEPROM_CRC
+	// CRC of each profile and the set menu
+	for(p = 0; p <= CRC_BLOCK_SET_MENU; p++){
+		unsigned int crc = 0, end = (p == CRC_BLOCK_SET_MENU) ? EEPROM_CRC_SET_MENU_END : (p + 1) * PROFILE_BYTES;
+		int b;
+		for(i = p * PROFILE_BYTES; i < end; i++){
+			crc ^= eeprom[i] << 8;
+			for(b = 0; b < 8; b++){
+				crc = (crc & 0x8000) ? ((crc << 1) ^ EEPROM_CRC_POLY) : (crc << 1);
+			}
+			crc &= 0xffff;
+		}
+		i = EEPROM_SET_MENU_BYTE + ((EEADR_CRC(p) - EEADR_SET_MENU) << 1);
+		eeprom[i] = crc & 0xff;
+		eeprom[i + 1] = crc >> 8;
+	}
+#endif
+
+	return n;
+}
+
+static void hex_record(FILE *f, unsigned char type, unsigned int address, const unsigned char *data, int len){
+	unsigned char sum = len + (address >> 8) + address + type;
+	int i;
+
+	fprintf(f, ":%02X%04X%02X", len, address & 0xffff, type);
+	for(i = 0; i < len; i++){
+		fprintf(f, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(f, "%02X\n", (unsigned char)-sum);
+}
+
+/* Write EEPROM image as Intel HEX, laid out like SDCC output of eepromdata.c */
+static void write_hex(FILE *f){
+	static const unsigned char upper[2][2] = { { 0x00, 0x00 }, { 0x00, 0x01 } };
+	unsigned char eeprom[256];
+	unsigned char data[HEX_LINE_BYTES * 2];
+	int n = pack_eeprom(eeprom);
+	int i, j;
+
+	hex_record(f, 4, 0, upper[0], 2);
+	hex_record(f, 4, 0, upper[1], 2);
+	for(i = 0; i < n; i += HEX_LINE_BYTES){
+		int len = (n - i < HEX_LINE_BYTES) ? n - i : HEX_LINE_BYTES;
+		for(j = 0; j < len; j++){
+			data[j << 1] = eeprom[i + j];
+			data[(j << 1) + 1] = 0x34; // retlw, as emitted by SDCC
+		}
+		hex_record(f, 0, HEX_EEPROM_ADDRESS + (i << 1), data, len << 1);
+	}
+	hex_record(f, 1, 0, NULL, 0);
+}
+
+static void usage(const char *name){
+	fprintf(stderr, "Usage: %s [-p profile] [-o eeprom.hex] description\n", name);
+	fprintf(stderr, "  -p N  Simulate profile N (default is the run mode in the description)\n");
+	fprintf(stderr, "  -o F  Write EEPROM image as Intel HEX to F\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]){
+	const char *hexname = NULL;
+	int profile = -1;
+	FILE *f;
+	int i;
+
+	for(i = 1; i < argc - 1 && argv[i][0] == '-'; i++){
+		if(!strcmp(argv[i], "-p") && i < argc - 2){
+			profile = atoi(argv[++i]);
+			if(profile < 0 || profile >= NO_OF_PROFILES){
+				usage(argv[0]);
+			}
+		} else if(!strcmp(argv[i], "-o") && i < argc - 2){
+			hexname = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(i != argc - 1){
+		usage(argv[0]);
+	}
+
+	filename = argv[i];
+	f = fopen(filename, "r");
+	if(!f){
+		perror(filename);
+		return 1;
+	}
+	read_description(f);
+	fclose(f);
+
+	// A running profile starts from the beginning when the image is loaded
+	start_profile(config[EEADR_SET_MENU_ITEM(rn)]);
+
+	if(profile < 0){
+		profile = config[EEADR_SET_MENU_ITEM(rn)];
+	}
+	if(profile < NO_OF_PROFILES){
+		simulate(profile);
+	}
+
+	if(hexname){
+		f = fopen(hexname, "w");
+		if(!f){
+			perror(hexname);
+			return 1;
+		}
+		write_hex(f);
+		fclose(f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+;
+; STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+;
+; Copyright 2014 Mats Staffansson
+;
+; This file is part of STC1000+.
+;
+; STC1000+ is free software: you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation, either version 3 of the License, or
+; (at your option) any later version.
+;
+; STC1000+ is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+;
+
+; Bootloader, updates the firmware without low voltage programming.
+;
+; The bootloader takes the last four rows of page 0, from BOOT_START up, and only rewrites
+; the rows below and above it. The three words below it, from APP_CRC, make the CRC-16
+; (0x1021, as EEPROM_CRC) of the firmware come out 0. The firmware is linked with all of
+; that reserved (make BOOTLOADER=1, see Makefile). Word 0 holds a jump to the bootloader, in
+; place of the nop SDCC puts there, and the bootloader starts the firmware at word 1 (PCLATH
+; is still 0 from reset).
+;
+; At power on, the bootloader waits for an update when the host holds both ICSPCLK (RA1)
+; and ICSPDAT (RA0) high, and not after a watchdog time-out. It first replies ACK, so the
+; host knows there is a bootloader before it sends anything. Otherwise it works out the CRC
+; of page 1 and then page 0 up to BOOT_START (about 0.2s), and starts the firmware only if
+; the CRC comes out 0. If it does not, the firmware is half written or missing, and the
+; bootloader stays with the relays off and replies NAK.
+;
+; The host clocks the data in like low voltage programming: ICSPDAT is read as ICSPCLK
+; falls, least significant bit first. A row is sent as its address (low byte first),
+; 32 words (low byte first) and the CRC-16 over all of that (high byte first). The row is
+; erased after the address and written after the last word, the host waits 2.5ms for each.
+; WREN is left clear for the rows of the bootloader itself, so they are never erased.
+; The bootloader then replies on ICSPDAT, two bits the host clocks out like data: ACK is
+; high then low, NAK (CRC error or a row of the bootloader) is low then high. A NAKed row
+; is written all the same, but the CRC of the firmware keeps it from starting until the
+; row is sent again. If the host stops clocking, the watchdog (about 2s) resets the
+; bootloader, which then starts the firmware only if its CRC is right. So power can fail
+; at any time during an update, except while row 0 (with the jump) is rewritten and
+; until it is acknowledged.
+;
+; Build with gpasm (make bootloader) and upload with the 'u' command of the sketch.
+; The firmware can then be updated with the 'n' command.
+
+	list	p=16f1828
+#include <p16f1828.inc>
+	errorlevel	-302
+
+; Same configuration as the application (page0.c), it can not be changed by self write
+	__CONFIG	_CONFIG1, 0x0FD4
+	__CONFIG	_CONFIG2, 0x3AFF
+
+BOOT_START	equ	0x0780		; A multiple of 128, rows are told apart by address >> 7
+APP_CRC		equ	BOOT_START - 3
+ROW_WORDS	equ	D'32'
+APP_START	equ	1			; After the jump to the bootloader
+
+	cblock	0x70			; Common RAM
+	rx_byte
+	bit_count
+	crc_hi
+	crc_lo
+	endc
+
+; Reset vector, kept in word 0 whatever the firmware puts there
+	org	0x0000
+	goto	boot
+
+	org	BOOT_START
+boot:
+	banksel	OSCCON
+	movlw	b'01111010'		; 16MHz
+	movwf	OSCCON
+	banksel	ANSELA
+	clrf	ANSELA
+	banksel	PORTA
+	btfss	STATUS, NOT_TO		; Watchdog time-out, the host has gone
+	bra	check_app
+	btfss	PORTA, 1
+	bra	check_app
+	btfss	PORTA, 0
+	bra	check_app
+	movlw	1			; ACK, the bootloader is there
+	bra	reply
+
+; CRC of page 1 and then page 0 below the bootloader, APP_CRC included
+check_app:
+	banksel	EEADRL
+	clrf	crc_hi
+	clrf	crc_lo
+	bsf	EECON1, EEPGD
+	movlw	high 0x0800
+	movwf	EEADRH
+	clrf	EEADRL
+app_word:
+	bsf	EECON1, RD
+	nop
+	nop
+	movf	EEDATL, W
+	call	crc_byte
+	movf	EEDATH, W
+	call	crc_byte
+	incf	EEADRL, F
+	btfsc	STATUS, Z
+	incf	EEADRH, F
+	bcf	EEADRH, 4		; From the end of page 1 on to word 0
+	lslf	EEADRL, W
+	rlf	EEADRH, W
+	xorlw	BOOT_START >> 7
+	btfss	STATUS, Z
+	bra	app_word
+	movf	crc_hi, W
+	iorwf	crc_lo, W
+	btfsc	STATUS, Z
+	goto	APP_START
+
+; Reply low then high (NAK, W = 0) or high then low (ACK, W = 1) and wait for the next row
+nak:
+	movlw	0
+reply:
+	banksel	PORTA
+	movwf	PORTA
+	banksel	TRISA
+	bcf	TRISA, 0
+	call	clock
+	incf	PORTA, F
+	call	clock
+	banksel	TRISA
+	bsf	TRISA, 0
+
+row:
+	clrf	crc_hi
+	clrf	crc_lo
+	call	rx
+	movwf	EEADRL
+	call	rx
+	movwf	EEADRH
+	movlw	(1 << EEPGD) | (1 << FREE)
+	movwf	EECON1
+	lslf	EEADRL, W		; Not the rows of the bootloader
+	rlf	EEADRH, W
+	xorlw	BOOT_START >> 7
+	btfss	STATUS, Z
+	bsf	EECON1, WREN
+	call	unlock
+	bsf	EECON1, LWLO
+row_word:
+	call	rx
+	movwf	EEDATL
+	call	rx
+	movwf	EEDATH
+	comf	EEADRL, W		; Write the row with the last word
+	andlw	ROW_WORDS - 1
+	btfsc	STATUS, Z
+	bcf	EECON1, LWLO
+	call	unlock
+	incf	EEADRL, F
+	btfsc	EECON1, LWLO
+	bra	row_word
+	call	rx
+	call	rx
+	movf	crc_hi, W		; CRC over the row and its CRC is 0
+	iorwf	crc_lo, W
+	btfss	STATUS, Z
+	bra	nak
+	btfss	EECON1, WREN
+	bra	nak
+	movlw	1
+	bra	reply
+
+; Erase (FREE set), load the latch (LWLO set) or write the row at EEADR
+unlock:
+	movlw	0x55
+	movwf	EECON2
+	movlw	0xAA
+	movwf	EECON2
+	bsf	EECON1, WR
+	nop
+	nop
+	return
+
+; Wait for ICSPCLK to go high and low, returns in bank 0
+clock:
+	banksel	PORTA
+clock_high:
+	btfss	PORTA, 1
+	bra	clock_high
+clock_low:
+	btfsc	PORTA, 1
+	bra	clock_low
+	return
+
+; Clock a byte in on RA0 into W and add it to the CRC, returns in the bank of the flash registers
+rx:
+	movlw	8
+	movwf	bit_count
+rx_bit:
+	call	clock
+	lsrf	rx_byte, F
+	btfsc	PORTA, 0
+	bsf	rx_byte, 7
+	decfsz	bit_count, F
+	bra	rx_bit
+	clrwdt
+	banksel	EEADRL
+	movf	rx_byte, W
+
+; Add W to the CRC, returns rx_byte in W
+crc_byte:
+	xorwf	crc_hi, F
+	movlw	8
+	movwf	bit_count
+crc_bit:
+	lslf	crc_lo, F
+	rlf	crc_hi, F
+	movlw	0x10
+	btfsc	STATUS, C
+	xorwf	crc_hi, F
+	movlw	0x21
+	btfsc	STATUS, C
+	xorwf	crc_lo, F
+	decfsz	bit_count, F
+	bra	crc_bit
+	movf	rx_byte, W
+	return
+
+	if	$ > 0x0800
+	error	"Bootloader does not fit in page 0"
+	endif
+
+	end
@@ -20,16 +20,69 @@
 # along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
 
 # This is a simple script to make building STC-1000+ releases easier.
+# Optional features are passed in FEATURES, e.g. FEATURES=-DUNIT_MENU sh build.sh
+# BOOTLOADER=1 sh build.sh links the firmware around the bootloader (see bootloader.asm)
 
-# Build HEX files
-make clean all
+# Build HEX files, and the definitions the sketch needs for them
+make clean all layout FEATURES="$FEATURES" BOOTLOADER="$BOOTLOADER"
 
-# Extract version info from stc1000p.h
-v=`cat stc1000p.h | grep STC1000P_VERSION`
-e=`cat stc1000p.h | grep STC1000P_EEPROM_VERSION`
+# With UNIT_MENU, there is only one firmware image for both units
+images="build/stc1000p_celsius.hex"
+if [ -f build/stc1000p_fahrenheit.hex ]; then
+	images="$images build/stc1000p_fahrenheit.hex"
+fi
 
-# Remove embedded HEX data from previous sketch and insert version info
-cat ../picprog.ino | sed -n '/^const char hex_celsius\[\] PROGMEM/q;p' | sed "s/^#define STC1000P_VERSION.*/$v/" | sed "s/^#define STC1000P_EEPROM_REV.*/$e/" >> picprog.tmp
+# Merge consecutive data records into records of up to 64 bytes, fewer records for the sketch to parse
+for h in $images build/eedata_celsius.hex build/eedata_fahrenheit.hex; do
+	awk -v MAX=64 '
+	function hex(s,    i, v) {
+		v = 0;
+		for (i = 1; i <= length(s); i++) {
+			v = v * 16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1;
+		}
+		return v;
+	}
+	function flush(    i, sum, line) {
+		if (n == 0) {
+			return;
+		}
+		sum = n + int(start / 256) + start % 256;
+		line = sprintf(":%02X%04X00", n, start);
+		for (i = 0; i < n; i++) {
+			line = line sprintf("%02X", d[i]);
+			sum += d[i];
+		}
+		print line sprintf("%02X", (256 - sum % 256) % 256);
+		n = 0;
+	}
+	/^:/ {
+		count = hex(substr($0, 2, 2));
+		address = hex(substr($0, 4, 4));
+		if (hex(substr($0, 8, 2)) != 0) {
+			flush();
+			print substr($0, 1, 11 + 2 * count);
+			next;
+		}
+		if (n > 0 && (address != start + n || n + count > MAX)) {
+			flush();
+		}
+		if (n == 0) {
+			start = address;
+		}
+		for (i = 0; i < count; i++) {
+			d[n++] = hex(substr($0, 10 + 2 * i, 2));
+		}
+	}
+	END { flush(); }' $h > $h.tmp && mv -f $h.tmp $h
+done
+
+# Remove embedded HEX data from previous sketch and replace the generated definitions (versions and layout)
+awk -v gen=build/layout.h '
+/^\/\* Generated by build.sh/ { skip = 1; while ((getline l < gen) > 0) print l; next; }
+skip && /^\/\* End of generated definitions/ { skip = 0; next; }
+skip { next; }
+/^const char hex_celsius\[\] PROGMEM/ { exit; }
+{ print; }' ../picprog.ino > picprog.tmp
 
 # Insert new HEX data
 echo "const char hex_celsius[] PROGMEM = {" >> picprog.tmp; 
@@ -38,11 +91,13 @@ for l in `cat build/stc1000p_celsius.hex | sed 's/^://' | sed 's/\(..\)/0\x\1\,/
 done; 
 echo "};" >> picprog.tmp
 
-echo "const char hex_fahrenheit[] PROGMEM = {" >> picprog.tmp; 
-for l in `cat build/stc1000p_fahrenheit.hex | sed 's/^://' | sed 's/\(..\)/0\x\1\,/g'`; do 
-	echo "   $l" | sed 's/0x00,0x00,0x00,0x01,0xFF,/0x00,0x00,0x00,0x01,0xFF/' >> picprog.tmp; 
-done; 
-echo "};" >> picprog.tmp
+if [ -f build/stc1000p_fahrenheit.hex ]; then
+	echo "const char hex_fahrenheit[] PROGMEM = {" >> picprog.tmp; 
+	for l in `cat build/stc1000p_fahrenheit.hex | sed 's/^://' | sed 's/\(..\)/0\x\1\,/g'`; do 
+		echo "   $l" | sed 's/0x00,0x00,0x00,0x01,0xFF,/0x00,0x00,0x00,0x01,0xFF/' >> picprog.tmp; 
+	done; 
+	echo "};" >> picprog.tmp
+fi
 
 echo "const char hex_eeprom_celsius[] PROGMEM = {" >> picprog.tmp; 
 for l in `cat build/eedata_celsius.hex | sed 's/^://' | sed 's/\(..\)/0\x\1\,/g'`; do 
@@ -69,5 +124,33 @@ do
 done;
 echo "total $s";
 
+# Words used in each page of program memory (2048 words each, page 0 less the 131 words
+# of the bootloader and the CRC of the firmware with BOOTLOADER), from the HEX files
+for h in $images; do
+	echo -n "$h: "
+	awk -v boot="$BOOTLOADER" '
+	function hex(s,    i, v) {
+		v = 0;
+		for (i = 1; i <= length(s); i++) {
+			v = v * 16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1;
+		}
+		return v;
+	}
+	/^:/ {
+		type = hex(substr($0, 8, 2));
+		if (type == 4) {
+			upper = hex(substr($0, 10, 4));
+		} else if (type == 0 && upper == 0) {
+			w = hex(substr($0, 4, 4)) / 2;
+			for (i = 0; i < hex(substr($0, 2, 2)) / 2; i++) {
+				if (w + i < 4096) {
+					used[int((w + i) / 2048)]++;
+				}
+			}
+		}
+	}
+	END { printf("page0 %d/%d words, page1 %d/2048 words\n", used[0], boot ? 1917 : 2048, used[1]); }' $h
+done
+
 make clean
 
@@ -23,30 +23,95 @@
 #include "stc1000p.h"
 
 
-#define EEPROM_DEFAULTS_F(name, led10ch, led1ch, led01ch, minv, maxv, dvc, dvf) \
-    dvf,
-#define EEPROM_DEFAULTS_C(name, led10ch, led1ch, led01ch, minv, maxv, dvc, dvf) \
-    dvc,
+/* Pack data as stored in EEPROM (see "EEPROM layout" in stc1000p.h) */
+#define EE_WORD(w) \
+    ((w) & 0xff), (((w) >> 8) & 0xff),
+#ifdef PACKED_EEPROM
+#define EE_STEP(sp, dh) \
+    (((sp) + SP_OFFSET) & 0xff), ((((sp) + SP_OFFSET) >> 8) & 0x0f) | (((dh) >> 4) & 0xf0), ((dh) & 0xff),
+#define EE_LAST_SP(sp) \
+    EE_WORD((sp) + SP_OFFSET)
+#else
+#define EE_STEP(sp, dh) \
+    EE_WORD(sp) EE_WORD(dh)
+#define EE_LAST_SP(sp) \
+    EE_WORD(sp)
+#endif
+#define EE_PROFILE(sp0, dh0, sp1, dh1, sp2, dh2, sp3, dh3, sp4, dh4, sp5, dh5, sp6, dh6, sp7, dh7, sp8, dh8, sp9) \
+    EE_STEP(sp0, dh0) EE_STEP(sp1, dh1) EE_STEP(sp2, dh2) EE_STEP(sp3, dh3) EE_STEP(sp4, dh4) \
+    EE_STEP(sp5, dh5) EE_STEP(sp6, dh6) EE_STEP(sp7, dh7) EE_STEP(sp8, dh8) EE_LAST_SP(sp9)
+
+#define EEPROM_DEFAULTS_F(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    EE_WORD(dvf)
+#define EEPROM_DEFAULTS_C(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    EE_WORD(dvc)
+#define EEPROM_STATS(name, led10ch, led1ch, led01ch) \
+    EE_WORD(0)
+#define EE_HISTORY_BUCKET \
+    EE_WORD(0) EE_WORD(0) EE_WORD(0) EE_WORD(0)
 
 /* Initial EEPROM data, note temperatures are multiplied by 10 (for 1 decimal point precision) */
 #ifdef FAHRENHEIT
-	__code const int __at(0xF000) eedata[] = {
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr0 (SP0, dh0, ..., dh8, SP9)
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr1 (SP0, dh0, ..., dh8, SP9)
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr2 (SP0, dh0, ..., dh8, SP9)
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr3 (SP0, dh0, ..., dh8, SP9)
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr4 (SP0, dh0, ..., dh8, SP9)
-			600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0, // Pr5 (SP0, dh0, ..., dh8, SP9)
-			SET_MENU_DATA(EEPROM_DEFAULTS_F)
-};
+#define EE_DEFAULT_PROFILE	EE_PROFILE(600, 24, 620, 24, 640, 24, 660, 24, 680, 144, 770, 48, 400, 0, 0, 0, 0, 0, 0)
+#define EE_SET_MENU			SET_MENU_DATA(EEPROM_DEFAULTS_F)
 #else // CELSIUS
-	__code const int __at(0xF000) eedata[] = {
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr0 (SP0, dh0, ..., dh8, SP9)
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr1 (SP0, dh0, ..., dh8, SP9)
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr2 (SP0, dh0, ..., dh8, SP9)
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr3 (SP0, dh0, ..., dh8, SP9)
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr4 (SP0, dh0, ..., dh8, SP9)
-			160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0, // Pr5 (SP0, dh0, ..., dh8, SP9)
-			SET_MENU_DATA(EEPROM_DEFAULTS_C)
-	};
+#define EE_DEFAULT_PROFILE	EE_PROFILE(160, 24, 170, 24, 180, 24, 190, 24, 200, 144, 250, 48, 40, 0, 0, 0, 0, 0, 0)
+#define EE_SET_MENU			SET_MENU_DATA(EEPROM_DEFAULTS_C)
+#endif
+
+	__code const unsigned char __at(0xF000) eedata[] = {
+			EE_DEFAULT_PROFILE // Pr0 (SP0, dh0, ..., dh8, SP9)
+			EE_DEFAULT_PROFILE // Pr1
+			EE_DEFAULT_PROFILE // Pr2
+			EE_DEFAULT_PROFILE // Pr3
+#if NO_OF_PROFILES > 4
+			EE_DEFAULT_PROFILE // Pr4
+#endif
+#if NO_OF_PROFILES > 5
+			EE_DEFAULT_PROFILE // Pr5
+#endif
+#if NO_OF_PROFILES > 6
+			EE_DEFAULT_PROFILE // Pr6
+#endif
+			EE_SET_MENU
+#ifndef UNIT_MENU
+			EE_WORD(POWER_ON_BIT) // Power on state
+#endif
+			STATS_DATA(EEPROM_STATS)
+#ifdef HEALTH
+			EE_WORD(0) EE_WORD(0) EE_WORD(0) // Health counters kept in EEPROM (EP, ES, tO)
+#endif
+#ifdef HISTORY
+			EE_HISTORY_BUCKET EE_HISTORY_BUCKET EE_HISTORY_BUCKET EE_HISTORY_BUCKET
+#if HISTORY_HOURS > 4
+			EE_HISTORY_BUCKET
 #endif
+#if HISTORY_HOURS > 5
+			EE_HISTORY_BUCKET
+#endif
+#if HISTORY_HOURS > 6
+			EE_HISTORY_BUCKET
+#endif
+#if HISTORY_HOURS > 7
+			EE_HISTORY_BUCKET
+#endif
+#if HISTORY_HOURS > 8
+			EE_HISTORY_BUCKET
+#endif
+			EE_WORD(0) // Latest history bucket, none written
+#endif
+#ifdef EEPROM_CRC
+			// CRC of each profile and the set menu, calculated at first power on
+			EE_WORD(EEPROM_CRC_UNSET) EE_WORD(EEPROM_CRC_UNSET) EE_WORD(EEPROM_CRC_UNSET) EE_WORD(EEPROM_CRC_UNSET)
+#if NO_OF_PROFILES > 4
+			EE_WORD(EEPROM_CRC_UNSET)
+#endif
+#if NO_OF_PROFILES > 5
+			EE_WORD(EEPROM_CRC_UNSET)
+#endif
+#if NO_OF_PROFILES > 6
+			EE_WORD(EEPROM_CRC_UNSET)
+#endif
+			EE_WORD(EEPROM_CRC_UNSET)
+#endif
+	};
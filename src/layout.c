@@ -0,0 +1,130 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Print the definitions picprog.ino needs about the firmware it embeds. Built for the host,
+ * with the same FEATURES as the firmware (make layout), and inserted in the sketch by build.sh.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stc1000p.h"
+
+#define SET_MENU_DEFAULTS(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    { dvc, dvf },
+
+#define SET_MENU_NAMES(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    #name,
+
+static const int set_menu_defaults[][2] = {
+    SET_MENU_DATA(SET_MENU_DEFAULTS)
+#ifndef UNIT_MENU
+    { POWER_ON_BIT, POWER_ON_BIT },
+#endif
+};
+
+static const char *set_menu_names[] = {
+    SET_MENU_DATA(SET_MENU_NAMES)
+};
+
+/* Set menu of 1.07, in the order of its EEPROM words (the last one is the power on state) */
+static const int set_menu_1_07[] = { hy, hy2, tc, tc2, SA, SP, St, dh, cd, hd, rP, Pb, rn, SET_MENU_WORDS - 1 };
+#define SET_MENU_1_07_WORDS	(int)(sizeof(set_menu_1_07)/sizeof(set_menu_1_07[0]))
+
+/* Print the set menu word of 1.07 each word is converted from (255 for none), or its defaults */
+static void print_set_menu(const char *name, int column){
+	int w, i;
+
+	printf("#define %s\t{", name);
+	for(w=0; w<SET_MENU_WORDS; w++){
+		if(column < 0){
+			for(i=0; i<SET_MENU_1_07_WORDS && set_menu_1_07[i] != w; i++);
+			printf(" %d,", i < SET_MENU_1_07_WORDS ? i : 255);
+		} else {
+			printf(" %d,", set_menu_defaults[w][column]);
+		}
+	}
+	printf(" }\n");
+}
+
+static unsigned int crc_bytes(unsigned int crc, const char *data, int n){
+	int i;
+
+	while(n--){
+		crc ^= ((unsigned char)*data++) << 8;
+		for(i=0; i<8; i++){
+			crc = (crc & 0x8000) ? (crc << 1) ^ EEPROM_CRC_POLY : crc << 1;
+		}
+	}
+	return crc & 0xffff;
+}
+
+/* 14 bit word that tells EEPROM layouts apart, kept in user ID 2 by picprog. 0x3FFF (erased, as left
+ * by earlier versions of picprog) is the layout of 1.07, any other layout gets a CRC over what decides it.
+ */
+static unsigned int eeprom_layout(void){
+	const char counts[] = { NO_OF_PROFILES, PROFILE_BYTES, CRC_BLOCK_BYTES, OSC_CAL_BYTES,
+			SET_MENU_WORDS, STATS_ITEMS, HEALTH_EE_ITEMS, HISTORY_WORDS,
+#ifdef PACKED_EEPROM
+			1,
+#endif
+	};
+	unsigned int crc, i;
+
+	if(STC1000P_EEPROM_VERSION == 11){
+		return 0x3fff;
+	}
+	crc = crc_bytes(0, counts, sizeof(counts));
+	for(i=0; i<sizeof(set_menu_names)/sizeof(set_menu_names[0]); i++){
+		crc = crc_bytes(crc, set_menu_names[i], strlen(set_menu_names[i]) + 1);
+	}
+	crc &= 0x3fff;
+	return crc == 0x3fff ? 0 : crc;
+}
+
+int main(void){
+	printf("/* Generated by build.sh, from stc1000p.h and the FEATURES of the HEX data below */\n");
+	printf("#define STC1000P_VERSION\t\t%d\n", STC1000P_VERSION);
+	printf("#define STC1000P_EEPROM_VERSION\t%d\n", STC1000P_EEPROM_VERSION);
+	printf("#define STC1000P_EEPROM_LAYOUT\t0x%04X\n", eeprom_layout());
+#ifdef UNIT_MENU
+	printf("/* One firmware image for both units, the unit is kept in the EEPROM word with the power on state */\n");
+	printf("#define EEPROM_UNIT_ADDRESS\t\t%d\n", EEPROM_POWER_ON_BYTE);
+#endif
+	if(STC1000P_EEPROM_VERSION != 11){
+		printf("/* EEPROM layout not the one of 1.07, 'b' and 'g' convert EEPROM data from 1.07 to it */\n");
+		printf("#define EEPROM_MIGRATE_PROFILES\t\t%d\n", NO_OF_PROFILES);
+#ifdef PACKED_EEPROM
+		printf("#define EEPROM_MIGRATE_PACKED_SP_OFFSET\t%d\n", SP_OFFSET);
+#endif
+		printf("#define EEPROM_MIGRATE_SET_MENU_WORDS\t%d\n", SET_MENU_WORDS);
+		printf("#define EEPROM_MIGRATE_RUN_MODE\t\t%d\n", rn);
+		print_set_menu("EEPROM_MIGRATE_SET_MENU_1_07", -1);
+		print_set_menu("EEPROM_MIGRATE_SET_MENU_C", 0);
+		print_set_menu("EEPROM_MIGRATE_SET_MENU_F", 1);
+		printf("/* Words after the set menu, cleared, and the CRC (if any), unset */\n");
+		printf("#define EEPROM_MIGRATE_CLEAR_WORDS\t%d\n", EEPROM_WORD_ITEMS - SET_MENU_WORDS - CRC_WORDS);
+		printf("#define EEPROM_MIGRATE_CRC_WORDS\t%d\n", CRC_WORDS);
+	}
+	printf("/* End of generated definitions */\n");
+	return 0;
+}
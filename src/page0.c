@@ -27,17 +27,45 @@
 /* Defines */
 #define ClrWdt() { __asm CLRWDT __endasm; }
 
+#if defined(UNIT_MENU) && defined(FAHRENHEIT)
+#error "With UNIT_MENU the unit is selected at runtime, FAHRENHEIT only selects the EEPROM defaults (eepromdata.c)"
+#endif
+
 /* Configuration words */
 unsigned int __at _CONFIG1 __CONFIG1 = 0xFD4;
 unsigned int __at _CONFIG2 __CONFIG2 = 0x3AFF;
 
-/* Temperature lookup table  */
+#ifdef PROBE_CURVES
+/* Temperature lookup tables (Celsius, converted in ad_to_temp() when unit is Fahrenheit), generated by NTC/lut,
+ * for curves 1 and up. Curve 0 is ad_lookup below, as it is. Each curve is 32 bytes, the temperature at
+ * point 1 (least significant byte first) followed by the deltas to points 2 to 31, decoded by ntc_delta().
+ */
+const unsigned char ntc_curves[] = {
+	// 10k B3950
+	148, 254, 108, 70, 54, 45, 40, 36, 33, 31, 30, 28, 28, 28, 27, 28, 28, 28, 30, 30, 32, 33, 36, 38, 43, 47, 54, 64, 78, 103, 166, 197,
+	// 5k B3950
+	54, 254, 99, 64, 50, 41, 36, 33, 30, 28, 27, 26, 26, 25, 25, 25, 25, 25, 27, 27, 29, 30, 32, 34, 38, 42, 49, 57, 69, 91, 161, 189,
+};
+#endif
+
 #ifdef FAHRENHEIT
+/* Temperature lookup table  */
 const int ad_lookup[] = { 0, -555, -319, -167, -49, 48, 134, 211, 282, 348, 412, 474, 534, 593, 652, 711, 770, 831, 893, 957, 1025, 1096, 1172, 1253, 1343, 1444, 1559, 1694, 1860, 2078, 2397, 2987 };
 #else  // CELSIUS
+/* Temperature lookup table (converted in ad_to_temp() when unit is Fahrenheit, with UNIT_MENU) */
 const int ad_lookup[] = { 0, -486, -355, -270, -205, -151, -104, -61, -21, 16, 51, 85, 119, 152, 184, 217, 250, 284, 318, 354, 391, 431, 473, 519, 569, 624, 688, 763, 856, 977, 1154, 1482 };
 #endif
 
+#ifdef UNIT_MENU
+/* Type of each item in the set menu, used when converting between Celsius and Fahrenheit */
+#define TO_TYPE(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    type,
+
+static const unsigned char setmenu_type[] = {
+	SET_MENU_DATA(TO_TYPE)
+};
+#endif
+
 /* LED character lookup table (0-15), includes hex */
 //unsigned const char led_lookup[] = { 0x3, 0xb7, 0xd, 0x25, 0xb1, 0x61, 0x41, 0x37, 0x1, 0x21, 0x5, 0xc1, 0xcd, 0x85, 0x9, 0x59 };
 /* LED character lookup table (0-9) */
@@ -57,80 +85,396 @@ static int temperature2=0;
  * decrease overhead. Refer to SDCC manual for more info.
  */
 
+/* Read one byte from EEPROM.
+ * arguments: EEPROM byte address
+ * return: the read data
+ */
+static unsigned char eeprom_read_byte(unsigned char eeprom_address){
+	EEADRL = eeprom_address; // Data Memory Address to read
+	CFGS = 0; // Deselect config space
+	EEPGD = 0; // Point to DATA memory
+	RD = 1; // Enable read
+
+	return EEDATL; // Return data
+}
+
+/* Write one byte to EEPROM, if it differs from current data.
+ * arguments: EEPROM byte address, data
+ * return: nothing
+ */
+#ifdef EEPROM_CRC
+unsigned int eeprom_crc;				// CRC of the block being written
+static unsigned char eeprom_crc_end;	// End of the block being written, 0 when not in a block
+
+/* Shift bits of zeros through the CRC.
+ * arguments: CRC, number of bits
+ * return: the new CRC
+ */
+static unsigned int crc_shift(unsigned int crc, unsigned int bits){
+	for(; bits; bits--){
+		if(crc & 0x8000){
+			crc = (crc << 1) ^ EEPROM_CRC_POLY;
+		} else {
+			crc <<= 1;
+		}
+	}
+	return crc;
+}
+#endif
+
+static void eeprom_write_byte(unsigned char eeprom_address, unsigned char data){
+#ifdef EEPROM_CRC
+	unsigned char old = eeprom_read_byte(eeprom_address);
+
+	// Avoid unnecessary EEPROM writes
+	if(data == old){
+		return;
+	}
+
+	// The CRC changes by the CRC of the changed bits, followed by zeros up to the end of the block
+	if(eeprom_address < eeprom_crc_end){
+		eeprom_crc ^= crc_shift(((unsigned int)(old ^ data)) << 8, ((unsigned int)(eeprom_crc_end - eeprom_address)) << 3);
+	}
+#else
+	// Avoid unnecessary EEPROM writes
+	if(data == eeprom_read_byte(eeprom_address)){
+		return;
+	}
+#endif
+
+	// Address to write
+	EEADRL = eeprom_address;
+	// Data to write
+	EEDATL = data;
+	// Deselect configuration space
+	CFGS = 0;
+	//Point to DATA memory
+	EEPGD = 0;
+	// Enable write
+	WREN = 1;
+
+	// Disable interrupts during write
+	GIE = 0;
+
+	// Write magic words to EECON2
+	EECON2 = 0x55;
+	EECON2 = 0xAA;
+
+	// Initiate a write cycle
+	WR = 1;
+
+	// Re-enable interrupts
+	GIE = 1;
+
+	// Disable writes
+	WREN = 0;
+
+	// Wait for write to complete
+	while(WR);
+
+	// Clear write complete flag (not really needed
+	// as we use WR for check, but is nice)
+	EEIF=0;
+}
+
+/* Get the EEPROM byte address for a config address (see EEPROM layout in stc1000p.h).
+ * For packed profile data, this is the address of the first byte of the step.
+ * arguments: Config address
+ * return: EEPROM byte address
+ */
+#ifdef PACKED_EEPROM
+static unsigned char eeprom_byte_address(unsigned char eeprom_address){
+	if(eeprom_address < EEADR_SET_MENU){
+		unsigned char profile = (eeprom_address >> 5);
+		unsigned char step = ((eeprom_address & 0x1f) >> 1);
+		// profile * 29 + step * 3
+		return (profile << 5) - (profile << 1) - profile + (step << 1) + step;
+	}
+	return EEPROM_SET_MENU_BYTE + ((eeprom_address - EEADR_SET_MENU) << 1);
+}
+#else
+#define eeprom_byte_address(eeprom_address)	((eeprom_address) << 1)
+#endif
+
 /* Read one configuration data from specified address.
- * arguments: Config address (0-127)
+ * arguments: Config address
  * return: the read data
  */
 unsigned int eeprom_read_config(unsigned char eeprom_address){
-	unsigned int data = 0;
-	eeprom_address = (eeprom_address << 1);
+	unsigned char adr = eeprom_byte_address(eeprom_address);
+	unsigned int nibbles = eeprom_read_byte(adr + 1);
+
+#ifdef PACKED_EEPROM
+	if(eeprom_address < EEADR_SET_MENU){
+		if(eeprom_address & 0x1){
+			// Duration, high nibble of middle byte and last byte
+			return ((nibbles & 0xf0) << 4) | eeprom_read_byte(adr + 2);
+		}
+		// Setpoint, first byte and low nibble of middle byte
+		return (((nibbles & 0x0f) << 8) | eeprom_read_byte(adr)) - SP_OFFSET;
+	}
+#endif
 
-	do {
-		EEADRL = eeprom_address; // Data Memory Address to read
-		CFGS = 0; // Deselect config space
-		EEPGD = 0; // Point to DATA memory
-		RD = 1; // Enable read
+	// Word, low byte first
+	return (nibbles << 8) | eeprom_read_byte(adr);
+}
 
-		data = ((((unsigned int) EEDATL) << 8) | (data >> 8));
-	} while(!(eeprom_address++ & 0x1));
+#ifdef EEPROM_CRC
+/* Find the CRC block (a profile or the set menu) of an EEPROM byte address,
+ * and set eeprom_crc_end to the end of it (0 if the byte is not in a block).
+ * arguments: EEPROM byte address
+ * return: the block
+ */
+static unsigned char eeprom_crc_block(unsigned char adr){
+	unsigned char block;
+
+	eeprom_crc_end = 0;
+	for(block=0; block<CRC_BLOCK_SET_MENU; block++){
+		eeprom_crc_end += PROFILE_BYTES;
+		if(adr < eeprom_crc_end){
+			return block;
+		}
+	}
 
-	return data; // Return data
+	eeprom_crc_end = (adr < EEPROM_CRC_SET_MENU_END) ? EEPROM_CRC_SET_MENU_END : 0;
+	return block;
 }
 
-/* Store one configuration data to the specified address.
- * arguments: Config address (0-127), data
+/* Write the CRC word of a block.
+ * arguments: block, CRC
  * return: nothing
  */
-void eeprom_write_config(unsigned char eeprom_address,unsigned int data)
-{
-	// Avoid unnecessary EEPROM writes
-	if(data == eeprom_read_config(eeprom_address)){
-		return;
+static void eeprom_write_crc(unsigned char block, unsigned int crc){
+	unsigned char adr = eeprom_byte_address(EEADR_CRC(block));
+
+	eeprom_write_byte(adr, crc);
+	eeprom_write_byte(adr + 1, crc >> 8);
+}
+#endif
+
+/* Store one configuration data to the specified address, without any checks.
+ * arguments: Config address, data
+ * return: nothing
+ */
+static void eeprom_store_config(unsigned char eeprom_address, unsigned int data){
+	unsigned char adr = eeprom_byte_address(eeprom_address);
+	unsigned char nibbles;
+#ifdef EEPROM_CRC
+	unsigned char block = eeprom_crc_block(adr);
+
+	if(eeprom_crc_end){
+		eeprom_crc = eeprom_read_config(EEADR_CRC(block));
 	}
+#endif
 
-	// multiply address by 2 to get eeprom address, as we will be storing 2 bytes.
-	eeprom_address = (eeprom_address << 1);
+#ifdef PACKED_EEPROM
+	if(eeprom_address < EEADR_SET_MENU){
+		nibbles = eeprom_read_byte(adr + 1);
+		if(eeprom_address & 0x1){
+			eeprom_write_byte(adr + 2, data);
+			nibbles = (nibbles & 0x0f) | ((data >> 4) & 0xf0);
+		} else {
+			data += SP_OFFSET;
+			eeprom_write_byte(adr, data);
+			nibbles = (nibbles & 0xf0) | ((data >> 8) & 0x0f);
+		}
+	} else
+#endif
+	{
+		eeprom_write_byte(adr, data);
+		nibbles = data >> 8;
+	}
 
-	do {
-		// Address to write
-	    EEADRL = eeprom_address;
-	    // Data to write
-	    EEDATL = (unsigned char) data;
-	    // Deselect configuration space
-	    CFGS = 0;
-	    //Point to DATA memory
-	    EEPGD = 0;
-	    // Enable write
-	    WREN = 1;
+	eeprom_write_byte(adr + 1, nibbles);
 
-	    // Disable interrupts during write
-	    GIE = 0;
+#ifdef EEPROM_CRC
+	if(eeprom_crc_end){
+		eeprom_crc_end = 0;
+		eeprom_write_crc(block, eeprom_crc);
+	}
+#endif
+}
 
-	    // Write magic words to EECON2
-	    EECON2 = 0x55;
-	    EECON2 = 0xAA;
+#ifdef EEPROM_CRC
+/* Set menu defaults, used when the CRC of the set menu does not match */
+#ifdef UNIT_MENU
+#define TO_DEFAULT(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    { dvc, dvf },
+static const int setmenu_default[][2] = {
+	SET_MENU_DATA(TO_DEFAULT)
+};
+#define SETMENU_DEFAULT(i, fahrenheit)	setmenu_default[i][fahrenheit]
+#else
+#ifdef FAHRENHEIT
+#define TO_DEFAULT(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    dvf,
+#else
+#define TO_DEFAULT(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    dvc,
+#endif
+static const int setmenu_default[] = {
+	SET_MENU_DATA(TO_DEFAULT)
+};
+#define SETMENU_DEFAULT(i, fahrenheit)	setmenu_default[i]
+#endif
 
-	    // Initiate a write cycle
-	    WR = 1;
+/* Check the CRC of a block and store the CRC of its current data.
+ * arguments: block, first and end byte address of the block
+ * return: 1 if the stored CRC did not match, 0 if it did or was unset
+ */
+static unsigned char eeprom_check_block(unsigned char block, unsigned char adr, unsigned char end){
+	unsigned int crc = 0, stored = eeprom_read_config(EEADR_CRC(block));
 
-	    // Re-enable interrupts
-	    GIE = 1;
+	for(; adr<end; adr++){
+		crc = crc_shift(crc ^ (((unsigned int)eeprom_read_byte(adr)) << 8), 8);
+	}
+	eeprom_write_crc(block, crc);
 
-	    // Disable writes
-	    WREN = 0;
+	return stored != EEPROM_CRC_UNSET && stored != crc;
+}
 
-	    // Wait for write to complete
-	    while(WR);
+/* Check the CRC of each block at power on, and recover only a block that does not match.
+ * The set menu is restored to defaults (which runs thermostat mode), keeping the power on state
+ * (and unit). A profile is kept, but if it is running, thermostat mode is run instead.
+ * arguments: none
+ * return: nothing
+ */
+static void eeprom_check_crc(){
+	unsigned char i, adr;
 
-	    // Clear write complete flag (not really needed
-	    // as we use WR for check, but is nice)
-	    EEIF=0;
+	// The set menu first, as recovering a profile may change it
+	if(eeprom_check_block(CRC_BLOCK_SET_MENU, EEPROM_SET_MENU_BYTE, EEPROM_CRC_SET_MENU_END)){
+		for(i=0; i<SET_MENU_WORDS-1; i++){
+			eeprom_store_config(EEADR_SET_MENU_ITEM(i), SETMENU_DEFAULT(i, UNIT_IS_FAHRENHEIT()));
+		}
+		eeprom_check_block(CRC_BLOCK_SET_MENU, EEPROM_SET_MENU_BYTE, EEPROM_CRC_SET_MENU_END);
+	}
+
+	for(i=0, adr=0; i<NO_OF_PROFILES; i++, adr+=PROFILE_BYTES){
+		if(eeprom_check_block(i, adr, adr + PROFILE_BYTES) && (unsigned char)eeprom_read_config(EEADR_SET_MENU_ITEM(rn)) == i){
+			eeprom_store_config(EEADR_SET_MENU_ITEM(rn), THERMOSTAT_MODE);
+		}
+	}
+}
+#endif
+
+#ifdef HEALTH
+/* Firmware health counters.
+ * Timer1 runs free at FOSC/4 with prescale 1:8, one tick is 8us and it wraps every ~524ms.
+ * The ISR counts the wraps, so times of a full Timer1 period or more saturate at 0xffff
+ * instead of reading as what is left over after the last wrap.
+ */
+#define HEALTH_T4_LATE			11250	// 1.5 x 60ms in Timer1 ticks
+#define HEALTH_T6_LATE			21000	// 1.5 x 112ms in Timer1 ticks
+#define HEALTH_EE_FLUSH			0xf		// Write lifetime counters to EEPROM once every 16 writes
+
+unsigned int health[HEALTH_ITEMS];
+static unsigned int health_last_tick[2];
+static unsigned char health_last_wraps[2];
+static unsigned char health_sync=0x3;
+static unsigned char health_wraps;		// Timer1 overflows, counted in the ISR
+static unsigned char health_now_wraps;	// Overflow count that goes with the last health_now()
+
+/* Read Timer1, making sure the high byte did not change while reading the low byte */
+static unsigned int read_tmr1(){
+	unsigned char h, l;
+	do {
+		h = TMR1H;
+		l = TMR1L;
+	} while(h != TMR1H);
+	return (((unsigned int) h) << 8) | l;
+}
+
+/* Read Timer1 and its overflow count (left in health_now_wraps) as one snapshot.
+ * An overflow the ISR has not counted yet is counted here if Timer1 was read after it.
+ */
+static unsigned int health_now(){
+	unsigned int now;
+	unsigned char pending;
+	do {
+		health_now_wraps = health_wraps;
+		now = read_tmr1();
+		pending = TMR1IF;
+	} while(health_now_wraps != health_wraps);
+	if(pending && !(now & 0x8000)){
+		health_now_wraps++;
+	}
+	return now;
+}
 
-	    // Shift data for next pass
-	    data = data >> 8;
+/* Timer1 ticks since a snapshot from health_now(), saturating at 0xffff */
+static unsigned int health_since(unsigned int start, unsigned char start_wraps){
+	unsigned int now = health_now();
+	unsigned char wraps = health_now_wraps - start_wraps;
+	if(now < start){
+		wraps--;
+	}
+	if(wraps){
+		return 0xffff;
+	}
+	return now - start;
+}
 
-	} while(!(eeprom_address++ & 0x01)); // Run twice for 16 bits
+/* Increment a health counter, saturating at max value */
+static void health_inc(unsigned char item){
+	if(health[item] != 0xffff){
+		health[item]++;
+	}
+}
 
+/* Keep the longest time since start (in Timer1 ticks) in a health counter */
+static void health_max(unsigned char item, unsigned int start, unsigned char start_wraps){
+	start = health_since(start, start_wraps);
+	if(start > health[item]){
+		health[item] = start;
+	}
+}
+
+/* To be called on each timer tick (t4 or t6), counts the tick as late
+ * if more than limit Timer1 ticks have passed since the last one.
+ */
+static void health_tick(unsigned char item, unsigned int limit){
+	unsigned char i = item - t4;
+	if(health_sync & (i+1)){
+		// First tick after (re)start, nothing to compare with
+		health_sync &= ~(i+1);
+	} else if(health_since(health_last_tick[i], health_last_wraps[i]) > limit){
+		health_inc(item);
+	}
+	health_last_tick[i] = health_now();
+	health_last_wraps[i] = health_now_wraps;
+}
+#endif // HEALTH
+
+/* Store one configuration data to the specified address.
+ * arguments: Config address, data
+ * return: nothing
+ */
+void eeprom_write_config(unsigned char eeprom_address,unsigned int data)
+{
+	// Avoid unnecessary EEPROM writes
+	if(data == eeprom_read_config(eeprom_address)){
+		return;
+	}
+
+#ifdef HEALTH
+	{
+		unsigned char item = (eeprom_address < EEADR_SET_MENU) ? EP : ES;
+		unsigned int start = health_now();
+		unsigned char start_wraps = health_now_wraps;
+
+		eeprom_store_config(eeprom_address, data);
+		health_max(Et, start, start_wraps);
+
+		// Lifetime counters are only written to EEPROM now and then to save wear
+		health_inc(item);
+		if((health[item] & HEALTH_EE_FLUSH) == 0){
+			eeprom_store_config(EEADR_HEALTH(item), health[item]);
+		}
+	}
+#else
+	eeprom_store_config(eeprom_address, data);
+#endif
 }
 
 #if 1
@@ -147,6 +491,123 @@ static unsigned int divu10(unsigned int n) {
 #define divu10(x)	((x)/10)
 #endif
 
+#ifdef UNIT_MENU
+static unsigned int divu9(unsigned int n) {
+	unsigned int q, r;
+	q = n - (n >> 3);
+	q = q + (q >> 6);
+	q = q + (q >> 12);
+	q = q >> 3;
+	r = n - ((q << 3) + q);
+	return q + ((r + 7) >> 4);
+}
+#endif
+
+#if defined(UNIT_MENU) || (defined(PROBE_CURVES) && defined(FAHRENHEIT))
+/* Scale a temperature difference between Celsius and Fahrenheit, rounded.
+ * arguments: value (multiplied by 10), 1 to scale by 9/5 or 0 to scale by 5/9
+ * return: the scaled value
+ */
+static int scale_temperature(int value, unsigned char to_fahrenheit){
+	unsigned char negative = 0;
+	unsigned int v;
+
+	if(value < 0){
+		negative = 1;
+		value = -value;
+	}
+	v = value;
+
+	if(to_fahrenheit){
+		v = divu10((v << 4) + (v << 1) + 5); // x18/10
+	}
+#ifdef UNIT_MENU
+	else {
+		v = divu9((v << 2) + v + 4); // x5/9
+	}
+#endif
+
+	value = v;
+	return negative ? -value : value;
+}
+#endif
+
+#ifdef UNIT_MENU
+/* Convert a configuration value between Celsius and Fahrenheit.
+ * Only temperatures and temperature differences are changed.
+ * arguments: value, menu item type, 1 to convert to Fahrenheit or 0 to convert to Celsius
+ * return: the converted value
+ */
+int convert_temperature(int value, unsigned char type, unsigned char to_fahrenheit){
+	if(type == type_temp){
+		if(to_fahrenheit){
+			return scale_temperature(value, 1) + 320;
+		}
+		value -= 320;
+	}
+	if(type <= type_temp_diff){
+		value = scale_temperature(value, to_fahrenheit);
+	}
+	return value;
+}
+
+/* Convert all temperatures in EEPROM, when temperature unit is changed.
+ * arguments: 1 to convert to Fahrenheit or 0 to convert to Celsius
+ * return: nothing
+ */
+void convert_config_unit(unsigned char to_fahrenheit){
+	unsigned char eeadr, type;
+#ifndef PACKED_EEPROM
+	unsigned char ci=0;
+#endif
+
+	for(eeadr=0; eeadr < EEADR_POWER_ON; eeadr++){
+		if(eeadr < EEADR_SET_MENU){
+			// Profile, setpoints on even and durations on odd items
+#ifdef PACKED_EEPROM
+			if((eeadr & 0x1f) >= 19){
+				continue;
+			}
+			type = (eeadr & 0x1) ? type_hours : type_temp;
+#else
+			type = (ci & 0x1) ? type_hours : type_temp;
+			if(++ci >= 19){
+				ci = 0;
+			}
+#endif
+		} else {
+			type = setmenu_type[eeadr - EEADR_SET_MENU];
+		}
+		eeprom_write_config(eeadr, convert_temperature(eeprom_read_config(eeadr), type, to_fahrenheit));
+		ClrWdt();
+	}
+
+#ifdef HISTORY
+	{
+		// Buckets written so far, from the latest back, the others have no temperatures to convert
+		unsigned char bucket = eeprom_read_config(EEADR_HISTORY_LATEST);
+		unsigned char written = eeprom_read_config(EEADR_HISTORY_LATEST) >> 8;
+
+		if(bucket >= HISTORY_HOURS || written > HISTORY_HOURS){
+			written = 0;
+		}
+		for(; written; written--){
+			// Relay on times are not temperatures
+			for(type=hist_min; type<hist_relays; type++){
+				eeadr = EEADR_HISTORY(bucket, type);
+				eeprom_write_config(eeadr, convert_temperature(eeprom_read_config(eeadr), type_temp, to_fahrenheit));
+			}
+			if(bucket == 0){
+				bucket = HISTORY_HOURS;
+			}
+			bucket--;
+			ClrWdt();
+		}
+	}
+#endif
+}
+#endif // UNIT_MENU
+
 /* Update LED globals with temperature or integer data.
  * arguments: value (actual temperature multiplied by 10 or an integer)
  *            decimal indicates if the value is multiplied by 10 (i.e. a temperature)
@@ -166,17 +627,17 @@ void value_to_led(int value, unsigned char decimal) {
 	// This assumes that only temperatures and all temperatures are decimal
 	if(decimal){
 		led_e.e_deg = 0;
-#ifdef FAHRENHEIT
-		led_e.e_c = 1;
-#else
-		led_e.e_c = 0;
-#endif // FAHRENHEIT
+		led_e.e_c = UNIT_IS_FAHRENHEIT();
 	}
 
 	// If temperature >= 100 we must lose decimal...
 	if (value >= 1000) {
 		value = divu10((unsigned int) value);
 		decimal = 0;
+		// Only three digits, keep led_lookup index in range for out of range data
+		if(value >= 1000){
+			value = 999;
+		}
 	}
 
 	// Convert value to BCD and set LED outputs
@@ -184,7 +645,7 @@ void value_to_led(int value, unsigned char decimal) {
 		for(i=0; value >= 100; i++){
 			value -= 100;
 		}
-		led_10.raw = led_lookup[i & 0xf];
+		led_10.raw = led_lookup[i];
 	} else {
 		led_10.raw = LED_OFF; // Turn off led if zero (lose leading zeros)
 	}
@@ -202,79 +663,585 @@ void value_to_led(int value, unsigned char decimal) {
 	led_01.raw = led_lookup[(unsigned char)value];
 }
 
-/* To be called once every hour on the hour.
- * Updates EEPROM configuration when running profile.
+#if defined(STATS) || defined(HEALTH)
+/* Update LED globals with a counter value.
+ * Values above 999 are shown in thousands, with one decimal.
+ * arguments: value
+ * return: nothing
+ */
+void count_to_led(unsigned int value) {
+	if(value >= 1000){
+		value_to_led(divu10(divu10(value)), 1);
+	} else {
+		value_to_led(value, 0);
+	}
+	led_e.e_deg = 1;
+	led_e.e_c = 1;
+}
+#endif
+
+#ifdef HEALTH
+/* Update LED globals with a health counter.
+ * Times are shown in ms with one decimal.
+ * arguments: health item
+ * return: nothing
  */
-static void update_profile(){
-	unsigned char profile_no = eeprom_read_config(EEADR_SET_MENU_ITEM(rn));
+void health_to_led(unsigned char item) {
+	unsigned int value = health[item];
+	if(item == Lt || item == Et){
+		// Timer1 ticks (8us) to 0.1ms, 0.08 ~ 1/16 + 1/64 + 1/512
+		value_to_led((value >> 4) + (value >> 6) + (value >> 9), 1);
+		led_e.e_deg = 1;
+		led_e.e_c = 1;
+	} else {
+		count_to_led(value);
+	}
+}
+#endif
 
-	// Running profile?
-	if (profile_no < THERMOSTAT_MODE) {
-		unsigned char curr_step = eeprom_read_config(EEADR_SET_MENU_ITEM(St));
-		unsigned int curr_dur = eeprom_read_config(EEADR_SET_MENU_ITEM(dh)) + 1;
-		unsigned char profile_step_eeaddr;
-		unsigned int profile_step_dur;
-		int profile_next_step_sp;
+#include "profile.h"
 
-		// Sanity check
-		if(curr_step > 8){
-			curr_step = 8;
+/* Due to a fault in SDCC, static local variables are not initialized
+ * properly, so the variables below were moved from temperature_control()
+ * and made global.
+ */
+unsigned int cooling_delay = 60;  // Initial cooling delay
+unsigned int heating_delay = 60;  // Initial heating delay
+
+#ifdef PI_CONTROL
+/* Time proportional PI control.
+ * The output of the PI controller is the share of the time the heating (positive output) or
+ * cooling (negative output) relay is requested to be on, PI_FULL_ON being all the time. The
+ * on time asked for is added up every second, and once it is enough for the relay to be on
+ * for the minimum time, the relay is requested on until it has been given. So instead of a
+ * fixed window, the cycle gets longer the smaller the output is. A relay is never requested
+ * on (or off) for less than PI_MIN_ON minutes, or hd/cd minutes if that is longer, and not
+ * before its delay has passed. The relays are still subject to the probe 2 limits, just as
+ * in thermostat mode.
+ */
+#define PI_FULL_ON		512		// Output for the relay to be on all the time
+#define PI_MIN_ON		6		// Minutes, shortest time a relay is requested on (or off)
+#define PI_ERROR_MAX	100		// Limit error, to keep the math in 16 bits
+
+static long pi_integral = 0;
+static long pi_credit = 0;			// On time asked for but not yet given, in output seconds
+static int pi_output = 0;
+static int pi_relay = 0;			// Relay requested, >0 heating, <0 cooling, otherwise 0
+static unsigned int pi_time = 0;	// Seconds since the relay was requested on or off, up to the minimum
+
+/* Multiply by shift and add, as the math library routines are too costly.
+ * arguments: gain, error (-PI_ERROR_MAX to PI_ERROR_MAX)
+ * return: gain * error
+ */
+static int pi_mul(unsigned char gain, int error){
+	int result = 0;
+	while(gain){
+		if(gain & 0x1){
+			result += error;
 		}
+		error <<= 1;
+		gain >>= 1;
+	}
+	return result;
+}
 
-		profile_step_eeaddr = EEADR_PROFILE_SETPOINT(profile_no, curr_step);
-		profile_step_dur = eeprom_read_config(profile_step_eeaddr + 1);
-		profile_next_step_sp = eeprom_read_config(profile_step_eeaddr + 2);
+/* Run the PI controller, to be called once every second.
+ * arguments: error (setpoint - temperature)
+ * return: >0 if heating is requested, <0 if cooling is requested, otherwise 0
+ */
+static int pi_control(int error){
+	unsigned int min_time;
+	long min_credit;
+
+	if(error > PI_ERROR_MAX){
+		error = PI_ERROR_MAX;
+	} else if(error < -PI_ERROR_MAX){
+		error = -PI_ERROR_MAX;
+	}
 
-		// Reached end of step?
-		if (curr_dur >= profile_step_dur) {
-			// Update setpoint with value from next step
-			eeprom_write_config(EEADR_SET_MENU_ITEM(SP), profile_next_step_sp);
-			// Is this the last step (next step is number 9 or next step duration is 0)?
-			if (curr_step == 8 || eeprom_read_config(profile_step_eeaddr + 3) == 0) {
-				// Switch to thermostat mode.
-				eeprom_write_config(EEADR_SET_MENU_ITEM(rn), THERMOSTAT_MODE);
-				return; // Fastest way out...
-			}
-			// Reset duration
-			curr_dur = 0;
-			// Update step
-			curr_step++;
-			eeprom_write_config(EEADR_SET_MENU_ITEM(St), curr_step);
-		} else if(eeprom_read_config(EEADR_SET_MENU_ITEM(rP))) { // Is ramping enabled?
-			int profile_step_sp = eeprom_read_config(profile_step_eeaddr);
-			unsigned int t = curr_dur << 6;
-			long sp = 32;
-			unsigned char i;
-
-			// Linear interpolation calculation of new setpoint (64 substeps)
-			for (i = 0; i < 64; i++) {
-			 if (t >= profile_step_dur) {
-			    t -= profile_step_dur;
-			    sp += profile_next_step_sp;
-			  } else {
-			    sp += profile_step_sp;
-			  }
+	// Anti windup, don't integrate further when output is already saturated
+	if(!((pi_output >= PI_FULL_ON && error > 0) || (pi_output <= -PI_FULL_ON && error < 0))){
+		pi_integral += pi_mul(eeprom_read_config(EEADR_SET_MENU_ITEM(PI)), error);
+		// Also limit the integral term itself to the output range
+		if(pi_integral > (((long)PI_FULL_ON) << 9)){
+			pi_integral = (((long)PI_FULL_ON) << 9);
+		} else if(pi_integral < -(((long)PI_FULL_ON) << 9)){
+			pi_integral = -(((long)PI_FULL_ON) << 9);
+		}
+	}
+
+	pi_output = pi_mul(eeprom_read_config(EEADR_SET_MENU_ITEM(PP)), error) + (int)(pi_integral >> 9);
+	if(pi_output > PI_FULL_ON){
+		pi_output = PI_FULL_ON;
+	} else if(pi_output < -PI_FULL_ON){
+		pi_output = -PI_FULL_ON;
+	}
+
+	// Minimum time on or off, for the relay that is on or is to be switched on next
+	min_time = eeprom_read_config((pi_relay < 0 || (!pi_relay && pi_output < 0)) ? EEADR_SET_MENU_ITEM(cd) : EEADR_SET_MENU_ITEM(hd));
+	if(min_time < PI_MIN_ON){
+		min_time = PI_MIN_ON;
+	}
+	min_time *= 60;
+	if(pi_time < min_time){
+		pi_time++;
+	}
+
+	// On time asked for, less the on time given
+	pi_credit += pi_output;
+	if(pi_relay > 0){
+		pi_credit -= PI_FULL_ON;
+	} else if(pi_relay < 0){
+		pi_credit += PI_FULL_ON;
+	}
+
+	min_credit = ((long)min_time) * PI_FULL_ON;
+	if(pi_time >= min_time){
+		if(pi_relay){
+			if((pi_relay > 0) ? (pi_credit <= 0) : (pi_credit >= 0)){
+				pi_relay = 0;
+				pi_time = 0;
 			}
-			sp >>= 6;
+		} else if(pi_credit >= min_credit && !heating_delay){
+			pi_relay = 1;
+			pi_time = 0;
+		} else if(pi_credit <= -min_credit && !cooling_delay){
+			pi_relay = -1;
+			pi_time = 0;
+		}
+	}
 
-			// Update setpoint
-			eeprom_write_config(EEADR_SET_MENU_ITEM(SP), sp);
+	// Don't save up more than the minimum on time while off
+	if(!pi_relay){
+		if(pi_credit > min_credit){
+			pi_credit = min_credit;
+		} else if(pi_credit < -min_credit){
+			pi_credit = -min_credit;
 		}
-		// Update duration
-		eeprom_write_config(EEADR_SET_MENU_ITEM(dh), curr_dur);
+	}
+
+	return pi_relay;
+}
+#endif // PI_CONTROL
+
+#ifdef STATS
+/* Relay and alarm statistics, counted in RAM and written to EEPROM once every hour */
+#define STATS_HOUR				3750	// Number of ~960ms cycles in an hour
+#define STATS_COOL_BLOCKED		0x1
+#define STATS_HEAT_BLOCKED		0x2
+#define STATS_ALARM				0x4
+
+unsigned int stats[STATS_ITEMS];
+static unsigned int stats_cool_time=0, stats_heat_time=0, stats_run_time=0;
+static unsigned char stats_flags=0;
+
+/* Increment a statistics counter, saturating at max value */
+static void stats_inc(unsigned char item){
+	if(stats[item] != 0xffff){
+		stats[item]++;
 	}
 }
 
-/* Due to a fault in SDCC, static local variables are not initialized
- * properly, so the variables below were moved from temperature_control()
- * and made global.
+/* Count an event only once, until flag is cleared again */
+static void stats_inc_once(unsigned char flag, unsigned char item){
+	if(!(stats_flags & flag)){
+		stats_flags |= flag;
+		stats_inc(item);
+	}
+}
+
+/* To be called once every second, accumulates on times and
+ * writes statistics to EEPROM once every hour.
  */
-unsigned int cooling_delay = 60;  // Initial cooling delay
-unsigned int heating_delay = 60;  // Initial heating delay
+static void update_stats(){
+	if(LATA4 && ++stats_cool_time >= STATS_HOUR){
+		stats_cool_time = 0;
+		stats_inc(Ct);
+	}
+	if(LATA5 && ++stats_heat_time >= STATS_HOUR){
+		stats_heat_time = 0;
+		stats_inc(Ht);
+	}
+	if(++stats_run_time >= STATS_HOUR){
+		unsigned char i;
+		stats_run_time = 0;
+		stats_inc(rt);
+		for(i=0; i<STATS_ITEMS; i++){
+			eeprom_write_config(EEADR_STATS(i), stats[i]);
+		}
+	}
+}
+#endif // STATS
+
+#ifdef HISTORY
+/* Hourly history, accumulated in RAM and written to the next bucket in EEPROM once every hour */
+#define HISTORY_HOUR			3750	// Number of ~960ms cycles in an hour
+#define HISTORY_OFFSET			1000	// Keeps temperatures positive when summing
+
+unsigned char history_latest=0;
+static int history_min=0, history_max=0;
+static unsigned long history_sum=0;
+static unsigned int history_time=0, history_cool_time=0, history_heat_time=0;
+
+/* Divide, for quotients below 4096.
+ * Shift and subtract, to avoid pulling in the library long division.
+ * arguments: dividend, divisor
+ * return: the quotient
+ */
+static unsigned int history_div(unsigned long n, unsigned int d){
+	unsigned long dd = ((unsigned long) d) << 11;
+	unsigned int q = 0;
+	unsigned char i;
+
+	for(i=0; i<12; i++){
+		q <<= 1;
+		if(n >= dd){
+			n -= dd;
+			q |= 1;
+		}
+		dd >>= 1;
+	}
+
+	return q;
+}
+
+/* Number of history buckets written, as kept in the high byte of the latest bucket word
+ * arguments: 1 to count one more bucket
+ * return: number of buckets, shifted to the high byte
+ */
+static unsigned int history_written(unsigned char more){
+	unsigned char written = eeprom_read_config(EEADR_HISTORY_LATEST) >> 8;
+
+	if(written > HISTORY_HOURS){
+		written = 0;
+	}
+	if(more && written < HISTORY_HOURS){
+		written++;
+	}
+	return ((unsigned int)written) << 8;
+}
+
+/* To be called once every second (when there is no sensor alarm), accumulates temperature
+ * and relay on times and writes a history bucket to EEPROM once every hour.
+ */
+static void update_history(){
+	if(history_time == 0){
+		history_min = history_max = temperature;
+		history_sum = 0;
+		history_cool_time = history_heat_time = 0;
+	}
+	if(temperature < history_min){
+		history_min = temperature;
+	}
+	if(temperature > history_max){
+		history_max = temperature;
+	}
+	history_sum += (unsigned int)(temperature + HISTORY_OFFSET);
+	history_cool_time += LATA4;
+	history_heat_time += LATA5;
+
+	if(++history_time >= HISTORY_HOUR){
+		history_time = 0;
+		if(++history_latest >= HISTORY_HOURS){
+			history_latest = 0;
+		}
+		eeprom_write_config(EEADR_HISTORY(history_latest, hist_min), history_min);
+		eeprom_write_config(EEADR_HISTORY(history_latest, hist_max), history_max);
+		eeprom_write_config(EEADR_HISTORY(history_latest, hist_avg), history_div(history_sum, HISTORY_HOUR) - HISTORY_OFFSET);
+		// Cycles to minutes, x2/125
+		eeprom_write_config(EEADR_HISTORY(history_latest, hist_relays),
+				(history_div(history_heat_time << 1, 125) << 8) | history_div(history_cool_time << 1, 125));
+		eeprom_write_config(EEADR_HISTORY_LATEST, history_latest | history_written(1));
+	}
+}
+#endif // HISTORY
+
+#ifdef TELEMETRY
+/* Telemetry, once every second a frame is sent on RA1 (ICSPCLK) of the ICSP header, as serial
+ * data (8N1, LSB first, idle high) at 1000 baud. The bits are sent by the ISR, one per 1ms
+ * Timer2 slot, so the timing does not depend on the main loop. RA0 (ICSPDAT) drives the
+ * buzzer and is not used. RA1 is also the AD input of probe 2, which is not read while
+ * a frame is sent.
+ *
+ * Frame: temperature, temperature2, setpoint (16 bit), flags (bit 0 cooling, bit 1 heating,
+ * bit 2 alarm, bit 3 Fahrenheit), run mode, profile step, profile duration (16 bit) and a
+ * checksum making the sum of all bytes zero.
+ */
+#define TELEMETRY_FRAME_SIZE	12
+#define TELEMETRY_IDLE_BITS		3		// Idle (high) bits ahead of the first byte
+
+static unsigned char telemetry_frame[TELEMETRY_FRAME_SIZE];
+static unsigned char telemetry_bits=0;	// Bits left of the byte being sent (start, 8 data and stop), 0 when done
+static unsigned char telemetry_next=0;	// Next byte of the frame to send
+static unsigned char telemetry_shift;
+
+/* Fill in a new frame and start sending it */
+static void telemetry_start(){
+	unsigned int sp = eeprom_read_config(EEADR_SET_MENU_ITEM(SP));
+	unsigned int dh = eeprom_read_config(EEADR_SET_MENU_ITEM(dh));
+	unsigned char i, sum = 0;
+
+	telemetry_frame[0] = temperature >> 8;
+	telemetry_frame[1] = temperature;
+	telemetry_frame[2] = temperature2 >> 8;
+	telemetry_frame[3] = temperature2;
+	telemetry_frame[4] = sp >> 8;
+	telemetry_frame[5] = sp;
+	telemetry_frame[6] = LATA4 | (LATA5 << 1) | (LATA0 << 2) | (UNIT_IS_FAHRENHEIT() << 3);
+	telemetry_frame[7] = eeprom_read_config(EEADR_SET_MENU_ITEM(rn));
+	telemetry_frame[8] = eeprom_read_config(EEADR_SET_MENU_ITEM(St));
+	telemetry_frame[9] = dh >> 8;
+	telemetry_frame[10] = dh;
+	for(i=0; i<TELEMETRY_FRAME_SIZE-1; i++){
+		sum += telemetry_frame[i];
+	}
+	telemetry_frame[TELEMETRY_FRAME_SIZE-1] = -sum;
+
+	LATA1 = 1;
+	TRISA1 = 0;
+	// Idle bits are sent as the stop bits of a byte that never started, the ISR starts when telemetry_bits is set
+	telemetry_shift = 0xff;
+	telemetry_next = 0;
+	telemetry_bits = TELEMETRY_IDLE_BITS;
+}
+
+/* To be called every pass of the main loop, gives RA1 back to the AD when the frame has been sent */
+static void telemetry_end(){
+	if(telemetry_next == TELEMETRY_FRAME_SIZE && telemetry_bits == 0){
+		telemetry_next = 0;
+		TRISA1 = 1;
+	}
+}
+#endif // TELEMETRY
+
+#ifdef OSC_CAL
+/* Calibrated length of an hour in Timer4 ticks, and ms left of the calibration signal */
+static unsigned int hour_ticks = TICKS_PER_HOUR;
+static unsigned int osc_cal_ms;
+#define HOUR_TICKS		hour_ticks
+#else
+#define HOUR_TICKS		TICKS_PER_HOUR
+#endif
+
+#ifdef AUTOTUNE
+#define AUTOTUNE_CYCLES			4		// Relay cycles averaged for each adjustment (power of two)
+#define AUTOTUNE_CYCLES_SHIFT	2
+#define AUTOTUNE_MAX_SECONDS	0x3fff	// Keeps the sum of AUTOTUNE_CYCLES periods in 16 bits
+
+/* Running statistics of the current relay cycle (from one relay switch on to the next) */
+static unsigned int at_seconds;		// Seconds since relay switched on
+static int at_overshoot;			// Furthest temperature past setpoint since relay switched off
+static unsigned char at_state;		// Bit 0 relay on, bit 1 cycle started, bit 2 cooling cycle
+static unsigned char at_cycles;
+static unsigned int at_period_sum;
+static int at_overshoot_sum;
+
+/* Adjust hysteresis and delay for the relay being cycled, from the average period and overshoot.
+ * Cycling faster than the target widens the hysteresis, cycling at less than half the target rate
+ * narrows it, but not below the overshoot (that adds to the band anyway). The delay is set to
+ * half the target period, as a hard limit on the cycle rate.
+ * arguments: target cycles per hour
+ * return: nothing
+ */
+static void autotune_adjust(unsigned char target){
+	unsigned int period = at_period_sum >> AUTOTUNE_CYCLES_SHIFT;
+	int overshoot = at_overshoot_sum >> AUTOTUNE_CYCLES_SHIFT;
+	int hysteresis = eeprom_read_config(EEADR_SET_MENU_ITEM(hy));
+	unsigned long cycle_time = 0;
+	unsigned char delay = 0;
+	unsigned char i;
+
+	// Period times target, in seconds per hour
+	for(i=0; i<target; i++){
+		cycle_time += period;
+	}
+
+	if(cycle_time < 3600){
+		hysteresis += (hysteresis >> 2) + 1;
+	} else if(cycle_time > 7200 && hysteresis > overshoot){
+		hysteresis -= (hysteresis >> 3) + 1;
+	}
+	if(hysteresis < 1){
+		hysteresis = 1;
+	} else if(hysteresis > TEMP_HYST_1_MAX){
+		hysteresis = TEMP_HYST_1_MAX;
+	}
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hy), hysteresis);
+
+	// Delay in minutes, 30 / target
+	for(i=target; i<=30; i+=target){
+		delay++;
+	}
+	eeprom_write_config((at_state & 0x4) ? EEADR_SET_MENU_ITEM(cd) : EEADR_SET_MENU_ITEM(hd), delay);
+}
+
+/* Measure relay cycles in thermostat mode, called once a second after the thermostat logic.
+ * arguments: setpoint
+ * return: nothing
+ */
+static void autotune(int setpoint){
+	unsigned char target = eeprom_read_config(EEADR_SET_MENU_ITEM(At));
+	int overshoot;
+
+#ifdef PI_CONTROL
+	if(eeprom_read_config(EEADR_SET_MENU_ITEM(Pn))){
+		target = 0;
+	}
+#endif
+	if(target == 0){
+		at_state = at_cycles = 0;
+		return;
+	}
+
+	if(at_seconds < AUTOTUNE_MAX_SECONDS){
+		at_seconds++;
+	}
+
+	if(LATA4 || LATA5){
+		if(!(at_state & 0x1)){
+			// Switched on, one cycle completed
+			if(at_state & 0x2){
+				at_period_sum += at_seconds;
+				at_overshoot_sum += at_overshoot;
+				if(++at_cycles == AUTOTUNE_CYCLES){
+					autotune_adjust(target);
+					at_cycles = 0;
+				}
+			}
+			if(at_cycles == 0){
+				at_period_sum = at_overshoot_sum = 0;
+			}
+			at_state = 0x3 | (LATA4 << 2);
+			at_seconds = 0;
+			at_overshoot = 0;
+		}
+	} else if(at_state & 0x2){
+		at_state &= ~0x1;
+		overshoot = (at_state & 0x4) ? (setpoint - temperature) : (temperature - setpoint);
+		if(overshoot > at_overshoot){
+			at_overshoot = overshoot;
+		}
+	}
+}
+#endif
+
+#ifdef ANTICIPATE
+#define ANTICIPATE_SAMPLE		32		// Seconds between temperature samples
+#define ANTICIPATE_SAMPLES		4		// Samples kept, the slope is over ANTICIPATE_SAMPLE * ANTICIPATE_SAMPLES seconds
+#define ANTICIPATE_SHIFT		4		// 8 second coast units per 128 second slope
+#define ANTICIPATE_SLOPE_MAX	127		// Keeps slope times coast time in 16 bits
+#define ANTICIPATE_DEADBAND		2		// Overshoot (or shortfall) that is left alone when learning
+
+static int ant_samples[ANTICIPATE_SAMPLES];
+static int ant_slope;				// Temperature change over the last 128 seconds
+static unsigned char ant_seconds, ant_index, ant_filled;
+static unsigned char ant_state;		// Bit 0 heating, bit 1 cooling (last second), bit 2/3 after heating/cooling
+static int ant_peak;				// Furthest temperature since the relay switched off
+static int ant_change;				// Projected temperature change after the active relay switches off
+static int ant_margin;				// How far from the setpoint the relay was switched off
+
+/* Track the temperature slope and learn the coast time, called once a second in thermostat mode.
+ * The coast time Ac is adjusted by the overshoot (past the setpoint) each time a relay is switched
+ * on again. The temperature change expected if the active relay is switched off now is left in
+ * ant_change, in the direction the relay drives it.
+ * arguments: setpoint
+ * return: 0 if the anticipator is off
+ */
+static unsigned char anticipate(int setpoint){
+	int coast = eeprom_read_config(EEADR_SET_MENU_ITEM(Ac));
+	int slope, over;
+	unsigned char i;
+
+	ant_change = 0;
+#ifdef PI_CONTROL
+	if(eeprom_read_config(EEADR_SET_MENU_ITEM(Pn))){
+		coast = 0;
+	}
+#endif
+	if(coast == 0){
+		ant_state = ant_filled = 0;
+		ant_margin = 0;
+		return 0;
+	}
+
+	if(++ant_seconds >= ANTICIPATE_SAMPLE){
+		ant_seconds = 0;
+		ant_slope = (ant_filled == ANTICIPATE_SAMPLES) ? temperature - ant_samples[ant_index] : 0;
+		ant_samples[ant_index] = temperature;
+		ant_index = (ant_index + 1) & (ANTICIPATE_SAMPLES - 1);
+		if(ant_filled < ANTICIPATE_SAMPLES){
+			ant_filled++;
+		}
+	}
+
+	if(LATA4 || LATA5){
+		if(ant_state & 0xc){
+			// Switched on again, learn from how far the last cycle went past the setpoint
+			over = (ant_state & 0x8) ? (setpoint - ant_peak) : (ant_peak - setpoint);
+			if(over > ANTICIPATE_DEADBAND || over < -ANTICIPATE_DEADBAND){
+				coast += over;
+				if(coast < 1){
+					coast = 1;
+				} else if(coast > 255){
+					coast = 255;
+				}
+				eeprom_write_config(EEADR_SET_MENU_ITEM(Ac), coast);
+			}
+			ant_margin = 0;
+		}
+
+		slope = LATA4 ? -ant_slope : ant_slope;
+		if(slope > 0){
+			if(slope > ANTICIPATE_SLOPE_MAX){
+				slope = ANTICIPATE_SLOPE_MAX;
+			}
+			for(i=0; i<coast; i++){
+				ant_change += slope;
+			}
+			ant_change >>= ANTICIPATE_SHIFT;
+		}
+		ant_state = LATA5 | (LATA4 << 1);
+	} else {
+		if(ant_state & 0x3){
+			// Switched off, the relay stays off as much longer as it was switched off early
+			ant_state <<= 2;
+			ant_peak = temperature;
+			ant_margin = (ant_state & 0x8) ? (temperature - setpoint) : (setpoint - temperature);
+			if(ant_margin < 0){
+				ant_margin = 0;
+			} else if(ant_margin > TEMP_HYST_1_MAX){
+				ant_margin = TEMP_HYST_1_MAX;
+			}
+		}
+		if(((ant_state & 0x4) && temperature > ant_peak) || ((ant_state & 0x8) && temperature < ant_peak)){
+			ant_peak = temperature;
+		}
+	}
+
+	return 1;
+}
+#endif
+
 static void temperature_control(){
 	int setpoint = eeprom_read_config(EEADR_SET_MENU_ITEM(SP));
+	int hysteresis = eeprom_read_config(EEADR_SET_MENU_ITEM(hy));
 	int hysteresis2 = eeprom_read_config(EEADR_SET_MENU_ITEM(hy2));
 	unsigned char probe2 = eeprom_read_config(EEADR_SET_MENU_ITEM(Pb));
+	unsigned char cool_off = (temperature <= setpoint);
+	unsigned char heat_off = (temperature >= setpoint);
+	unsigned char cool_on = (temperature > setpoint + hysteresis);
+	unsigned char heat_on = (temperature < setpoint - hysteresis);
+
+#ifdef PI_CONTROL
+	// In PI mode, the controller decides instead of the hysteresis
+	if(eeprom_read_config(EEADR_SET_MENU_ITEM(Pn))){
+		int pi_request = pi_control(setpoint - temperature);
+		cool_on = (pi_request < 0);
+		heat_on = (pi_request > 0);
+		cool_off = !cool_on;
+		heat_off = !heat_on;
+	}
+#endif
 
 	if(cooling_delay){
 		cooling_delay--;
@@ -287,32 +1254,113 @@ static void temperature_control(){
 	led_e.e_cool = !LATA4;
 	led_e.e_heat = !LATA5;
 
+#ifdef DUAL_ZONE
+	// Dual zone, each relay on its own probe, setpoint, hysteresis and delay
+	if(probe2 == PROBE2_DUAL_ZONE){
+		setpoint = eeprom_read_config(EEADR_SET_MENU_ITEM(SP2));
+
+		if(LATA5){
+			if(heat_off){
+				heating_delay = eeprom_read_config(EEADR_SET_MENU_ITEM(hd)) << 6;
+				heating_delay = heating_delay - (heating_delay >> 4);
+				LATA5 = 0;
+#ifdef STATS
+				stats_flags &= ~STATS_HEAT_BLOCKED;
+#endif
+			}
+		} else if(heat_on){
+			if(heating_delay){
+				led_e.e_heat = led_e.e_heat ^ (heating_delay & 0x1); // Flash to indicate heating delay
+#ifdef STATS
+				stats_inc_once(STATS_HEAT_BLOCKED, Hb);
+#endif
+			} else {
+				LATA5 = 1;
+#ifdef STATS
+				stats_inc(Hn);
+#endif
+			}
+		}
+
+		if(LATA4){
+			if(temperature2 <= setpoint){
+				cooling_delay = eeprom_read_config(EEADR_SET_MENU_ITEM(cd)) << 6;
+				cooling_delay = cooling_delay - (cooling_delay >> 4);
+				LATA4 = 0;
+#ifdef STATS
+				stats_flags &= ~STATS_COOL_BLOCKED;
+#endif
+			}
+		} else if(temperature2 > setpoint + hysteresis2){
+			if(cooling_delay){
+				led_e.e_cool = led_e.e_cool ^ (cooling_delay & 0x1); // Flash to indicate cooling delay
+#ifdef STATS
+				stats_inc_once(STATS_COOL_BLOCKED, Cb);
+#endif
+			} else {
+				LATA4 = 1;
+#ifdef STATS
+				stats_inc(Cn);
+#endif
+			}
+		}
+		return;
+	}
+#endif
+
+#ifdef ANTICIPATE
+	if(anticipate(setpoint)){
+		heat_off |= (temperature + ant_change >= setpoint);
+		cool_off |= (temperature - ant_change <= setpoint);
+		heat_on = (temperature < setpoint - hysteresis - ((ant_state & 0x4) ? ant_margin : 0));
+		cool_on = (temperature > setpoint + hysteresis + ((ant_state & 0x8) ? ant_margin : 0));
+	}
+#endif
+
 	// This is the thermostat logic
-	if((LATA4 && (temperature <= setpoint || (probe2 && (temperature2 < (setpoint - hysteresis2))))) || (LATA5 && (temperature >= setpoint || (probe2 && (temperature2 > (setpoint + hysteresis2)))))){
+	if((LATA4 && (cool_off || (probe2 && (temperature2 < (setpoint - hysteresis2))))) || (LATA5 && (heat_off || (probe2 && (temperature2 > (setpoint + hysteresis2)))))){
 		cooling_delay = eeprom_read_config(EEADR_SET_MENU_ITEM(cd)) << 6;
 		cooling_delay = cooling_delay - (cooling_delay >> 4);
 		heating_delay = eeprom_read_config(EEADR_SET_MENU_ITEM(hd)) << 6;
 		heating_delay = heating_delay - (heating_delay >> 4);
 		LATA4 = 0;
 		LATA5 = 0;
+#ifdef STATS
+		stats_flags &= ~(STATS_COOL_BLOCKED | STATS_HEAT_BLOCKED);
+#endif
 	}
 	else if(LATA4 == 0 && LATA5 == 0) {
-		int hysteresis = eeprom_read_config(EEADR_SET_MENU_ITEM(hy));
 		hysteresis2 >>= 2; // Halve hysteresis 2
-		if ((temperature > setpoint + hysteresis) && (!probe2 || (temperature2 >= setpoint - hysteresis2))) {
+		if (cool_on && (!probe2 || (temperature2 >= setpoint - hysteresis2))) {
 			if (cooling_delay) {
 				led_e.e_cool = led_e.e_cool ^ (cooling_delay & 0x1); // Flash to indicate cooling delay
+#ifdef STATS
+				stats_inc_once(STATS_COOL_BLOCKED, Cb);
+#endif
 			} else {
 				LATA4 = 1;
+#ifdef STATS
+				stats_inc(Cn);
+#endif
 			}
-		} else if ((temperature < setpoint - hysteresis) && (!probe2 || (temperature2 <= setpoint + hysteresis2))) {
+		} else if (heat_on && (!probe2 || (temperature2 <= setpoint + hysteresis2))) {
 			if (heating_delay) {
 				led_e.e_heat = led_e.e_heat ^ (heating_delay & 0x1); // Flash to indicate heating delay
+#ifdef STATS
+				stats_inc_once(STATS_HEAT_BLOCKED, Hb);
+#endif
 			} else {
 				LATA5 = 1;
+#ifdef STATS
+				stats_inc(Hn);
+#endif
 			}
 		}
 	}
+
+#ifdef AUTOTUNE
+	autotune(setpoint);
+#endif
 }
 
 /* Initialize hardware etc, on startup.
@@ -354,13 +1402,17 @@ static void init() {
 	// Postscaler 1:1, Enable counter, prescaler 1:4
 	T2CON = 0b00000101;
 	// @4MHz, Timer 2 clock is FOSC/4 -> 1MHz prescale 1:4-> 250kHz, 250 gives interrupt every 1 ms
-	PR2 = 250;
+	PR2 = LED_SLOT_TICKS;
 	// Enable Timer2 interrupt
 	TMR2IE = 1;
 
+#ifdef EEPROM_CRC
+	eeprom_check_crc();
+#endif
+
 	// Postscaler 1:15, - , prescaler 1:16
 	T4CON = 0b01110010;
-	TMR4ON = eeprom_read_config(EEADR_POWER_ON);
+	TMR4ON = IS_POWER_ON(eeprom_read_config(EEADR_POWER_ON));
 	// @4MHz, Timer 2 clock is FOSC/4 -> 1MHz prescale 1:16-> 62.5kHz, 250 and postscale 1:15 -> 16.66666 Hz or 60ms
 	PR4 = 250;
 
@@ -369,22 +1421,103 @@ static void init() {
 	// @4MHz, Timer 2 clock is FOSC/4 -> 1MHz prescale 1:64-> 15.625kHz, 250 and postscale 1:6 -> 8.93Hz or 112ms
 	PR6 = 250;
 
+#ifdef STATS
+	{
+		unsigned char i;
+		for(i=0; i<STATS_ITEMS; i++){
+			stats[i] = eeprom_read_config(EEADR_STATS(i));
+		}
+	}
+#endif
+
+#ifdef HISTORY
+	history_latest = eeprom_read_config(EEADR_HISTORY_LATEST);
+	if(history_latest >= HISTORY_HOURS){
+		history_latest = 0;
+	}
+#endif
+
+#ifdef HEALTH
+	// Timer1 free running, FOSC/4, prescale 1:8 -> 125kHz, used to time the main loop
+	T1CON = 0b00110001;
+	// Timer1 overflow interrupt, to count the wraps
+	TMR1IE = 1;
+	{
+		unsigned char i;
+		for(i=HEALTH_ITEMS-HEALTH_EE_ITEMS; i<HEALTH_ITEMS; i++){
+			health[i] = eeprom_read_config(EEADR_HEALTH(i));
+		}
+	}
+	// NOT_TO is cleared by a watchdog time-out reset
+	if(!NOT_TO){
+		health_inc(tO);
+		eeprom_store_config(EEADR_HEALTH(tO), health[tO]);
+	}
+#endif
+
+#ifdef OSC_CAL
+	{
+		unsigned int ticks = (((unsigned int)eeprom_read_byte(EEPROM_OSC_CAL_BYTE + 1)) << 8) | eeprom_read_byte(EEPROM_OSC_CAL_BYTE);
+		if(ticks >= OSC_CAL_MIN && ticks <= OSC_CAL_MAX){
+			hour_ticks = ticks;
+		}
+	}
+	// Send the calibration signal on RA1 (ICSPCLK) only when picprog asks for it, by holding
+	// ICSPCLK high at power on (an open probe input reads low), and probe 2 is not in use.
+	// RA1 is driven high along with picprog until it lets go, and is an input again after.
+	ANSA1 = 0;
+	if(RA1 && eeprom_read_config(EEADR_SET_MENU_ITEM(Pb)) == 0){
+		LATA1 = 1;
+		TRISA1 = 0;
+		osc_cal_ms = OSC_CAL_HOLD_MS + OSC_CAL_MS;
+	}
+	ANSA1 = 1;
+#endif
+
 	// Set PEIE (enable peripheral interrupts, that is for timer2) and GIE (enable global interrupts)
 	INTCON = 0b11000000;
 
 }
 
+#ifdef DIMMING
+/* Timer2 ticks the LEDs are on in each multiplex slot, set by button_menu_fsm(),
+ * and the LED currently multiplexed (as LATB is cleared while dimmed).
+ */
+unsigned char led_on_ticks = LED_SLOT_TICKS;
+static unsigned char led_latb = 0;
+#endif
+
 /* Interrupt service routine.
- * Receives timer2 interrupts every millisecond.
+ * Receives timer2 interrupts every millisecond (twice when dimmed).
  * Handles multiplexing of the LEDs.
  */
 static void interrupt_service_routine(void) __interrupt 0 {
 
+#ifdef HEALTH
+	if (TMR1IF) {
+		health_wraps++;
+		TMR1IF = 0;
+	}
+#endif
+
 	// Check for Timer 2 interrupt
 	// Kind of excessive when it's the only enabled interrupt
 	// but is nice as reference if more interrupts should be needed
 	if (TMR2IF) {
+#ifdef DIMMING
+		unsigned char latb = (led_latb << 1);
+
+		// Dimmed, LEDs are off for the rest of the slot
+		if(LATB && led_on_ticks != LED_SLOT_TICKS){
+			LATB = 0;
+			PR2 = LED_SLOT_TICKS - 1 - led_on_ticks;
+			TMR2IF = 0;
+			return;
+		}
+		PR2 = led_on_ticks;
+#else
 		unsigned char latb = (LATB << 1);
+#endif
 
 		if(latb == 0){
 			latb = 0x10;
@@ -411,6 +1544,37 @@ static void interrupt_service_routine(void) __interrupt 0 {
 
 		// Enable new LED
 		LATB = latb;
+#ifdef DIMMING
+		led_latb = latb;
+#endif
+
+#ifdef TELEMETRY
+		// Next telemetry bit, start bit (telemetry_bits == 10), data bits and then the stop bit
+		if(telemetry_bits){
+			if(telemetry_bits == 10){
+				LATA1 = 0;
+			} else {
+				LATA1 = telemetry_shift & 0x1;
+				telemetry_shift = (telemetry_shift >> 1) | 0x80;
+			}
+			if(--telemetry_bits == 0 && telemetry_next < TELEMETRY_FRAME_SIZE){
+				telemetry_shift = telemetry_frame[telemetry_next++];
+				telemetry_bits = 10;
+			}
+		}
+#endif
+
+#ifdef OSC_CAL
+		// Calibration signal after power on, toggled every ms by Timer2 after the hold
+		if(osc_cal_ms){
+			if(osc_cal_ms <= OSC_CAL_MS){
+				LATA1 = !LATA1;
+			}
+			if(--osc_cal_ms == 0){
+				TRISA1 = 1;
+			}
+		}
+#endif
 
 		// Clear interrupt flag
 		TMR2IF = 0;
@@ -420,13 +1584,161 @@ static void interrupt_service_routine(void) __interrupt 0 {
 #define START_TCONV_1()		(ADCON0 = _CHS1 | _ADON)
 #define START_TCONV_2()		(ADCON0 = _CHS0 | _ADON)
 
+#ifdef FILTER
+#define FILTER_TAPS_MAX		5
+
+/* Latest AD results for each probe, newest first */
+unsigned int ad_samples[FILTER_TAPS_MAX];
+unsigned int ad_samples2[FILTER_TAPS_MAX];
+
+/* Median of the first n samples, found as the sample with n/2 samples ranked below it
+ * (equal samples ranked by position), to avoid sorting.
+ */
+static unsigned int ad_median(unsigned int *samples, unsigned char n){
+	unsigned char i, j, below;
+
+	for(i=0; i<n; i++){
+		below = 0;
+		for(j=0; j<n; j++){
+			if(samples[j] < samples[i] || (samples[j] == samples[i] && j < i)){
+				below++;
+			}
+		}
+		if(below == (n >> 1)){
+			return samples[i];
+		}
+	}
+
+	return samples[0];
+}
+
+static unsigned int read_ad(unsigned int adfilter, unsigned int *samples){
+	unsigned char i, shift;
+	unsigned int sample;
+
+	ADGO = 1;
+	while(ADGO);
+	ADON = 0;
+
+	for(i=FILTER_TAPS_MAX-1; i; i--){
+		samples[i] = samples[i-1];
+	}
+	samples[0] = ((ADRESH << 8) | ADRESL);
+
+	// Spike rejection, median of 1, 3 or 5 samples
+	sample = ad_median(samples, (eeprom_read_config(EEADR_SET_MENU_ITEM(Fn)) << 1) + 1);
+
+	// Low pass filter, the filter value is kept at 64 times the AD result for any time constant
+	shift = eeprom_read_config(EEADR_SET_MENU_ITEM(Ft));
+	return ((adfilter - (adfilter >> shift)) + (sample << (6 - shift)));
+}
+#else
 static unsigned int read_ad(unsigned int adfilter){
 	ADGO = 1;
 	while(ADGO);
 	ADON = 0;
 	return ((adfilter - (adfilter >> 6)) + ((ADRESH << 8) | ADRESL));
 }
+#endif
+
+#ifdef PROBE_FAULT
+/* Probe fault check on the raw AD result (still in ADRESH:ADRESL after read_ad), probe 0 or 1.
+ * The filtered value takes many seconds to reach the alarm limits when a probe is
+ * unplugged or shorted, so after PROBE_FAULT_SAMPLES results in a row outside the same
+ * limits, the relays are switched off and AL is shown right away. The fault is kept until
+ * a result is back in range, the 1s section raises the alarm for it in the meantime.
+ */
+#define PROBE_FAULT_SAMPLES		2
+#define PROBE_FAULT_HIGH		(248 << 2)	// (ad_filter>>8) >= 248
+#define PROBE_FAULT_LOW			(9 << 2)	// (ad_filter>>8) <= 8
+
+static unsigned char probe_fault_count[2];
+static unsigned char probe_fault=0;
+
+static void probe_fault_check(unsigned char probe){
+	unsigned int ad = (ADRESH << 8) | ADRESL;
+	unsigned char mask = probe + 1;
+
+	// Probe 2 only counts when it is in use, as for the alarm on the filtered value
+	if((ad >= PROBE_FAULT_LOW && ad < PROBE_FAULT_HIGH) || (probe && !eeprom_read_config(EEADR_SET_MENU_ITEM(Pb)))){
+		probe_fault_count[probe] = 0;
+		probe_fault &= ~mask;
+	} else if(probe_fault_count[probe] < PROBE_FAULT_SAMPLES - 1){
+		probe_fault_count[probe]++;
+	} else {
+		probe_fault |= mask;
+		LATA4 = 0;
+		LATA5 = 0;
+		LATA0 = 1;
+		led_10.raw = LED_A;
+		led_1.raw = LED_L;
+		led_e.raw = led_01.raw = LED_OFF;
+		cooling_delay = heating_delay = 60;
+	}
+}
+#endif
+
+#ifdef PROBE_CURVES
+/* Last decoded lookup table point for each probe, the table is walked from there, one point at a time */
+static unsigned char ntc_curve[2];
+static unsigned char ntc_point[2];	// 0 when not decoded
+static int ntc_value[2];
+
+/* Delta from the previous point, deltas above 127 are stored in steps of 4 with bit 7 set */
+static int ntc_delta(unsigned char data){
+	if(data & 0x80){
+		return (data & 0x7f) << 2;
+	}
+	return data;
+}
+
+static int ad_to_temp(unsigned int adfilter, unsigned char probe){
+	unsigned char i;
+	long temp = 32;
+	unsigned char a = ((adfilter >> 5) & 0x3f); // Lower 6 bits
+	unsigned char b = ((adfilter >> 11) & 0x1f); // Upper 5 bits
+	unsigned char curve = eeprom_read_config(probe ? EEADR_SET_MENU_ITEM(th2) : EEADR_SET_MENU_ITEM(th));
+	unsigned char offset = (curve - 1) << 5;
+	int lo, hi;
+
+	// Point 0 and 31 are outside the probe range (alarm), use the points next to them
+	if(b < 1){
+		b = 1;
+	} else if(b > 30){
+		b = 30;
+	}
 
+	if(curve == 0){
+		// The probe shipped with the STC-1000, exactly as without PROBE_CURVES
+		lo = ad_lookup[b];
+		hi = ad_lookup[b + 1];
+	} else {
+		if(ntc_point[probe] == 0 || ntc_curve[probe] != curve){
+			ntc_curve[probe] = curve;
+			ntc_point[probe] = 1;
+			ntc_value[probe] = (int) ((((unsigned int) ntc_curves[offset + 1]) << 8) | ntc_curves[offset]);
+		}
+		while(ntc_point[probe] < b){
+			ntc_point[probe]++;
+			ntc_value[probe] += ntc_delta(ntc_curves[offset + ntc_point[probe]]);
+		}
+		while(ntc_point[probe] > b){
+			ntc_value[probe] -= ntc_delta(ntc_curves[offset + ntc_point[probe]]);
+			ntc_point[probe]--;
+		}
+		lo = ntc_value[probe];
+		hi = lo + ntc_delta(ntc_curves[offset + b + 1]);
+	}
+
+	// Interpolate between lookup table points
+	for (i = 0; i < 64; i++) {
+		if(a <= i) {
+			temp += lo;
+		} else {
+			temp += hi;
+		}
+	}
+#else
 static int ad_to_temp(unsigned int adfilter){
 	unsigned char i;
 	long temp = 32;
@@ -441,6 +1753,19 @@ static int ad_to_temp(unsigned int adfilter){
 			temp += ad_lookup[b + 1];
 		}
 	}
+#endif
+
+#if defined(UNIT_MENU) || (defined(PROBE_CURVES) && defined(FAHRENHEIT))
+#ifdef UNIT_MENU
+	if(UNIT_IS_FAHRENHEIT()){
+#else
+	// ad_lookup (curve 0) is in Fahrenheit already
+	if(curve != 0){
+#endif
+		// Convert from Celsius x 640 via Celsius x 20, to keep some precision
+		return ((scale_temperature((temp - 16) >> 5, 1) + 1) >> 1) + 320;
+	}
+#endif
 
 	// Divide by 64 to get back to normal temperature
 	return (temp >> 6);
@@ -459,13 +1784,27 @@ void main(void) __naked {
 
 	//Loop forever
 	while (1) {
+#ifdef HEALTH
+		unsigned int loop_start = health_now();
+		unsigned char loop_start_wraps = health_now_wraps;
+#endif
+
+#ifdef TELEMETRY
+		telemetry_end();
+#endif
 
 		if(TMR6IF) {
+#ifdef HEALTH
+			health_tick(t6, HEALTH_T6_LATE);
+#endif
 
 			// Handle button press and menu
 			button_menu_fsm();
 
 			if(!TMR4ON){
+#ifdef HEALTH
+				health_sync |= 0x1; // Timer4 stopped, resync t4 when started
+#endif
 				led_e.raw = LED_OFF;
 				led_10.raw = LED_O;
 				led_1.raw = led_01.raw = LED_F;
@@ -476,14 +1815,37 @@ void main(void) __naked {
 		}
 
 		if(TMR4IF) {
+#ifdef HEALTH
+			health_tick(t4, HEALTH_T4_LATE);
+#endif
 
 			millisx60++;
 
 			if(millisx60 & 0x1){
+#ifdef FILTER
+				ad_filter = read_ad(ad_filter, ad_samples);
+#else
 				ad_filter = read_ad(ad_filter);
+#endif
+#ifdef PROBE_FAULT
+				probe_fault_check(0);
+#endif
 				START_TCONV_2();
 			} else {
-				ad_filter2 = read_ad(ad_filter2);
+#if defined(TELEMETRY) || defined(OSC_CAL)
+				// RA1 is an output while a telemetry frame or the calibration signal is sent
+				if(TRISA1)
+#endif
+				{
+#ifdef FILTER
+					ad_filter2 = read_ad(ad_filter2, ad_samples2);
+#else
+					ad_filter2 = read_ad(ad_filter2);
+#endif
+#ifdef PROBE_FAULT
+					probe_fault_check(1);
+#endif
+				}
 				START_TCONV_1();
 			}
 
@@ -491,11 +1853,25 @@ void main(void) __naked {
 			// Close enough to 1s for our purposes.
 			if((millisx60 & 0xf) == 0) {
 
+#ifdef PROBE_CURVES
+				temperature = ad_to_temp(ad_filter, 0) + eeprom_read_config(EEADR_SET_MENU_ITEM(tc));
+				temperature2 = ad_to_temp(ad_filter2, 1) + eeprom_read_config(EEADR_SET_MENU_ITEM(tc2));
+#else
 				temperature = ad_to_temp(ad_filter) + eeprom_read_config(EEADR_SET_MENU_ITEM(tc));
 				temperature2 = ad_to_temp(ad_filter2) + eeprom_read_config(EEADR_SET_MENU_ITEM(tc2));
+#endif
 
 				// Alarm on sensor error (AD result out of range)
 				LATA0 = ((ad_filter>>8) >= 248 || (ad_filter>>8) <= 8) || (eeprom_read_config(EEADR_SET_MENU_ITEM(Pb)) && ((ad_filter2>>8) >= 248 || (ad_filter2>>8) <= 8));
+#ifdef PROBE_FAULT
+				if(probe_fault){
+					LATA0 = 1;
+				}
+#endif
+
+#ifdef STATS
+				update_stats();
+#endif
 
 				if(LATA0){ // On alarm, disable outputs
 					led_10.raw = LED_A;
@@ -504,14 +1880,23 @@ void main(void) __naked {
 					LATA4 = 0;
 					LATA5 = 0;
 					cooling_delay = heating_delay = 60;
+#ifdef STATS
+					stats_inc_once(STATS_ALARM, AL);
+#endif
 				} else {
+#ifdef STATS
+					stats_flags &= ~STATS_ALARM;
+#endif
+#ifdef HISTORY
+					update_history();
+#endif
 					// Update running profile every hour (if there is one)
 					// and handle reset of millis x60 counter
 					if(((unsigned char)eeprom_read_config(EEADR_SET_MENU_ITEM(rn))) < THERMOSTAT_MODE){
 						// Indicate profile mode
 						led_e.e_set = 0;
 						// Update profile every hour
-						if(millisx60 >= 60000){
+						if(millisx60 >= HOUR_TICKS){
 							update_profile();
 							millisx60 = 0;
 						}
@@ -540,7 +1925,7 @@ void main(void) __naked {
 					temperature_control();
 
 					// Show temperature if menu is idle
-					if(TMR1GE){
+					if(TX9D){
 						if(LATA0 && RX9){
 							led_10.raw = LED_S;
 							led_1.raw = LED_A;
@@ -557,12 +1942,22 @@ void main(void) __naked {
 					}
 				}
 
+#ifdef TELEMETRY
+#ifdef OSC_CAL
+				if(TRISA1)
+#endif
+				telemetry_start();
+#endif
 			} // End 1 sec section
 
 			// Reset timer flag
 			TMR4IF = 0;
 		}
 
+#ifdef HEALTH
+		health_max(Lt, loop_start, loop_start_wraps);
+#endif
+
 		// Reset watchdog
 		ClrWdt();
 	}
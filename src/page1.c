@@ -39,30 +39,102 @@
 #define BTN_HELD_OR_RELEASED(btn)	((_buttons & (btn) & 0xf0))
 
 /* Help to convert menu item number and config item number to an EEPROM config address */
-#define EEADR_MENU_ITEM(mi, ci)	((mi)*19 + (ci))
+#define EEADR_MENU_ITEM(mi, ci)	(EEADR_PROFILE_SETPOINT(mi, 0) + (ci))
 
 extern unsigned int heating_delay;
 extern unsigned int cooling_delay;
 
+/* The type of each set menu item is only kept for the features that need it (page 1 is full
+ * without them), the default build tells items apart by their place in the menu as 1.07 does.
+ */
+#if defined(ACCEL) || defined(UNIT_MENU) || defined(DUAL_ZONE)
+#define SET_MENU_TYPES
+#endif
+
 /* Set menu struct */
 struct s_setmenu {
     unsigned char led_c_10;
     unsigned char led_c_1;
     unsigned char led_c_01;
+#ifdef SET_MENU_TYPES
+    unsigned char type;
+#endif
     int min;
     int max;
 };
 
 /* Set menu struct data generator */
-#define TO_STRUCT(name, led10ch, led1ch, led01ch, minv, maxv, dvc, dvf) \
+#ifdef SET_MENU_TYPES
+#define TO_STRUCT(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    { led10ch, led1ch, led01ch, type, minv, maxv },
+#else
+#define TO_STRUCT(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
     { led10ch, led1ch, led01ch, minv, maxv },
+#endif
 
 static const struct s_setmenu setmenu[] = {
 	SET_MENU_DATA(TO_STRUCT)
 };
 
+#if defined(STATS) || defined(HEALTH) || defined(HISTORY)
+/* Statistics, health counter and history label struct */
+struct s_label {
+    unsigned char led_c_10;
+    unsigned char led_c_1;
+    unsigned char led_c_01;
+};
+
+/* Label struct data generator */
+#define LABEL_TO_STRUCT(name, led10ch, led1ch, led01ch) \
+    { led10ch, led1ch, led01ch },
+#endif
+
+#ifdef STATS
+static const struct s_label statsmenu[] = {
+	STATS_DATA(LABEL_TO_STRUCT)
+};
+#endif
+
+#ifdef HEALTH
+static const struct s_label healthmenu[] = {
+	HEALTH_DATA(LABEL_TO_STRUCT)
+};
+#endif
+
+#ifdef HISTORY
+static const struct s_label historymenu[] = {
+	HISTORY_DATA(LABEL_TO_STRUCT)
+};
+#endif
+
+#ifdef ACCEL
+/* Button acceleration.
+ * While up or down is held, the menu FSM is run faster (by lowering PR6) and every
+ * ACCEL_STAGE_TICKS ticks the step moves on to the next stage of the curve for the
+ * type of menu item being set. Each new stage starts over at the slow tick rate, to give
+ * a chance to let go before overshooting.
+ */
+#define ACCEL_STAGE_TICKS	32
+#define ACCEL_STAGES		3
+
+static const unsigned char accel_steps[][ACCEL_STAGES] = {
+	{ 1, 10, 100 },		// type_temp, 0.1 -> 1.0 -> 10.0 degrees
+	{ 1, 10, 10 },		// type_temp_diff, 0.1 -> 1.0 degrees
+	{ 1, 10, 100 },		// type_hours
+	{ 1, 1, 1 },		// type_other
+};
+
+static unsigned char range_clamp=0;	// Stop at the limits instead of wrapping around
+#endif
+
 /* Helpers to constrain user input  */
 static int RANGE(int x, int min, int max){
+#ifdef ACCEL
+	// Steps of a held button stop at the limits instead of wrapping to the other end
+	if(range_clamp){
+		return (x>max) ? max : ((x<min) ? min : x);
+	}
+#endif
 	if(x>max)
 		return min;
 	if(x<min)
@@ -72,20 +144,42 @@ static int RANGE(int x, int min, int max){
 
 /* Check and constrain a configuration value */
 static int check_config_value(int config_value, unsigned char eeadr){
+	int min = TEMP_MIN, max = TEMP_MAX;
+#ifdef UNIT_MENU
+	unsigned char type = type_temp;
+#endif
+
 	if(eeadr < EEADR_SET_MENU){
+#ifndef PACKED_EEPROM
 		while(eeadr >= 19){
 			eeadr-=19;
 		}
+#endif
 		if(eeadr & 0x1){
-			config_value = RANGE(config_value, 0, 999);
-		} else {
-			config_value = RANGE(config_value, TEMP_MIN, TEMP_MAX);
+			min = 0;
+			max = 999;
+#ifdef UNIT_MENU
+			type = type_hours;
+#endif
 		}
 	} else {
 		eeadr -= EEADR_SET_MENU;
-		config_value = RANGE(config_value, setmenu[eeadr].min, setmenu[eeadr].max);
+		min = setmenu[eeadr].min;
+		max = setmenu[eeadr].max;
+#ifdef UNIT_MENU
+		type = setmenu[eeadr].type;
+#endif
 	}
-	return config_value;
+
+#ifdef UNIT_MENU
+	// Limits are in Celsius
+	if(IS_FAHRENHEIT(eeprom_read_config(EEADR_POWER_ON))){
+		min = convert_temperature(min, type, 1);
+		max = convert_temperature(max, type, 1);
+	}
+#endif
+
+	return RANGE(config_value, min, max);
 }
 
 static void prx_to_led(unsigned char run_mode, unsigned char is_menu){
@@ -93,10 +187,22 @@ static void prx_to_led(unsigned char run_mode, unsigned char is_menu){
 	led_e.e_deg = 1;
 	led_e.e_c = 1;
 	led_e.e_point = 1;
-	if(run_mode<6){
+	if(run_mode<THERMOSTAT_MODE){
 		led_10.raw = LED_P;
 		led_1.raw = LED_r;
 		led_01.raw = led_lookup[run_mode];
+#ifdef STATS
+	} else if(run_mode == STATS_MENU_ITEM_NO){
+		led_10.raw = LED_S;
+		led_1.raw = LED_t;
+		led_01.raw = LED_A;
+#endif
+#ifdef HISTORY
+	} else if(run_mode == HISTORY_MENU_ITEM_NO){
+		led_10.raw = LED_H;
+		led_1.raw = LED_S;
+		led_01.raw = LED_t;
+#endif
 	} else {
 		if(is_menu){
 			led_10.raw = LED_S;
@@ -120,6 +226,10 @@ enum menu_states {
 	state_power_down_wait,
 
 	state_show_version,
+#ifdef HEALTH
+	state_show_health,
+	state_show_health_value,
+#endif
 
 	state_show_sp,
 
@@ -134,6 +244,18 @@ enum menu_states {
 	state_show_config_value,
 	state_set_config_value,
 
+#ifdef STATS
+	state_show_stats_item,
+	state_set_stats_item,
+	state_show_stats_value,
+#endif
+
+#ifdef HISTORY
+	state_show_history_item,
+	state_set_history_item,
+	state_show_history_value,
+#endif
+
 	state_up_pressed,
 	state_down_pressed,
 };
@@ -144,8 +266,57 @@ enum menu_states {
  */
 static unsigned char state=state_idle;
 static unsigned char menu_item=0, config_item=0, countdown=0;
+#ifdef ACCEL
+static unsigned char accel_type=type_other, accel_ticks=0, accel_dir=0;
+#endif
 static int config_value;
 static unsigned char _buttons = 0;
+#ifdef HISTORY
+static unsigned char history_back = 0; // Hours back from the latest history bucket
+#endif
+#ifdef DIMMING
+static unsigned int dim_ticks = 0; // Button ticks the menu has been idle
+#endif
+
+#ifdef ACCEL
+/* Step the value being set up or down, by the step for how long the button has
+ * been held and the type of the menu item.
+ * arguments: button held (BTN_UP or BTN_DOWN)
+ * return: nothing
+ */
+static void accel_step(unsigned char dir){
+	unsigned char step;
+
+	// Turning around starts over at the first stage
+	if(dir != accel_dir){
+		accel_dir = dir;
+		accel_ticks = 0;
+		PR6 = 250;
+	}
+
+	step = accel_steps[accel_type][accel_ticks / ACCEL_STAGE_TICKS];
+
+	// Values >= 100.0 are shown without decimal, so step at least by whole degrees
+	if(step == 1 && config_value >= 1000){
+		step = 10;
+	}
+	// Only the first step of a press wraps around, a held button stops at the limits
+	range_clamp = (step > 1 || accel_ticks > 0);
+
+	if(dir == BTN_UP){
+		config_value += step;
+	} else {
+		config_value -= step;
+	}
+
+	if(accel_ticks < ((ACCEL_STAGES-1) * ACCEL_STAGE_TICKS)){
+		accel_ticks++;
+		if((accel_ticks & (ACCEL_STAGE_TICKS-1)) == 0){
+			PR6 = 250; // Next stage, start over at slow rate
+		}
+	}
+}
+#endif
 
 /* This is the button input and menu handling function.
  * arguments: none
@@ -187,9 +358,15 @@ void button_menu_fsm(){
 		if(BTN_PRESSED(BTN_PWR)){
 			countdown = 27; // 3 sec
 			state = state_power_down_wait;
-		} else if(_buttons && eeprom_read_config(EEADR_POWER_ON)){
+		} else if(_buttons && IS_POWER_ON(eeprom_read_config(EEADR_POWER_ON))){
 			if (BTN_PRESSED(BTN_UP | BTN_DOWN)) {
 				state = state_show_version;
+#ifdef HEALTH
+			} else if (BTN_PRESSED(BTN_S | BTN_UP)) {
+				config_item = 0;
+				countdown = 9;
+				state = state_show_health;
+#endif
 			} else if (BTN_PRESSED(BTN_UP)) {
 				state = state_show_sp;
 			} else if (BTN_PRESSED(BTN_DOWN)) {
@@ -211,10 +388,51 @@ void button_menu_fsm(){
 		}
 		break;
 
+#ifdef HEALTH
+	/* Cycle through health counters while 'S' and 'up' are held.
+	 * Wait for both buttons to be released, so releasing 'S' last does not open the menu.
+	 */
+	case state_show_health:
+		led_e.e_negative = 1;
+		led_e.e_deg = 1;
+		led_e.e_c = 1;
+		led_10.raw = healthmenu[config_item].led_c_10;
+		led_1.raw = healthmenu[config_item].led_c_1;
+		led_01.raw = healthmenu[config_item].led_c_01;
+		if(countdown==0){
+			countdown=13;
+			state = state_show_health_value;
+		}
+		if(BTN_IDLE(BTN_S | BTN_UP)){
+			state=state_idle;
+		}
+		break;
+	case state_show_health_value:
+		health_to_led(config_item);
+		if(countdown==0){
+			countdown=9;
+			config_item++;
+			if(config_item >= HEALTH_ITEMS){
+				config_item = 0;
+			}
+			state = state_show_health;
+		}
+		if(BTN_IDLE(BTN_S | BTN_UP)){
+			state=state_idle;
+		}
+		break;
+#endif
+
 	case state_power_down_wait:
 		if(countdown==0){
 			unsigned char pwr_on = eeprom_read_config(EEADR_POWER_ON);
+#ifdef UNIT_MENU
+			unsigned char unit = IS_FAHRENHEIT(pwr_on) ? FAHRENHEIT_BIT : 0;
+			pwr_on &= POWER_ON_BIT;
+			eeprom_write_config(EEADR_POWER_ON, unit | !pwr_on);
+#else
 			eeprom_write_config(EEADR_POWER_ON, !pwr_on);
+#endif
 			if(pwr_on){
 				LATA0 = 0;
 				LATA4 = 0;
@@ -286,22 +504,141 @@ void button_menu_fsm(){
 			state=state_idle;
 		} else if(BTN_RELEASED(BTN_UP)){
 			menu_item++;
-			if(menu_item > SET_MENU_ITEM_NO){
+			if(menu_item > LAST_MENU_ITEM_NO){
 				menu_item = 0;
 			}
 			state = state_show_menu_item;
 		} else if(BTN_RELEASED(BTN_DOWN)){
 			menu_item--;
-			if(menu_item > SET_MENU_ITEM_NO){
-				menu_item = SET_MENU_ITEM_NO;
+			if(menu_item > LAST_MENU_ITEM_NO){
+				menu_item = LAST_MENU_ITEM_NO;
 			}
 			state = state_show_menu_item;
 		} else if(BTN_RELEASED(BTN_S)){
 			config_item = 0;
+#ifdef STATS
+			if(menu_item == STATS_MENU_ITEM_NO){
+				state = state_show_stats_item;
+				break;
+			}
+#endif
+#ifdef HISTORY
+			if(menu_item == HISTORY_MENU_ITEM_NO){
+				history_back = 0;
+				state = state_show_history_item;
+				break;
+			}
+#endif
 			state = state_show_config_item;
 		}
 		break;
+#ifdef STATS
+	case state_show_stats_item:
+		led_e.e_negative = 1;
+		led_e.e_deg = 1;
+		led_e.e_c = 1;
+		led_10.raw = statsmenu[config_item].led_c_10;
+		led_1.raw = statsmenu[config_item].led_c_1;
+		led_01.raw = statsmenu[config_item].led_c_01;
+		countdown = 110;
+		state = state_set_stats_item;
+		break;
+	case state_set_stats_item:
+		if(countdown==0){
+			state=state_idle;
+		} else if(BTN_RELEASED(BTN_PWR)){
+			state = state_show_menu_item;
+		} else if(BTN_RELEASED(BTN_UP)){
+			config_item++;
+			if(config_item >= STATS_ITEMS){
+				config_item = 0;
+			}
+			state = state_show_stats_item;
+		} else if(BTN_RELEASED(BTN_DOWN)){
+			config_item--;
+			if(config_item >= STATS_ITEMS){
+				config_item = STATS_ITEMS-1;
+			}
+			state = state_show_stats_item;
+		} else if(BTN_RELEASED(BTN_S)){
+			count_to_led(stats[config_item]);
+			countdown = 110;
+			state = state_show_stats_value;
+		}
+		break;
+	case state_show_stats_value:
+		/* Statistics are read only, any of PWR or S returns to the item */
+		if(countdown==0){
+			state=state_idle;
+		} else if(BTN_RELEASED(BTN_PWR) || BTN_RELEASED(BTN_S)){
+			state = state_show_stats_item;
+		}
+		break;
+#endif
+#ifdef HISTORY
+	/* Up and down steps through the values of each hour, continuing with the hour before */
+	case state_show_history_item:
+		led_e.e_negative = 1;
+		led_e.e_deg = 1;
+		led_e.e_c = 1;
+		led_10.raw = historymenu[config_item].led_c_10;
+		led_1.raw = historymenu[config_item].led_c_1;
+		led_01.raw = led_lookup[history_back + 1];
+		countdown = 110;
+		state = state_set_history_item;
+		break;
+	case state_set_history_item:
+		if(countdown==0){
+			state=state_idle;
+		} else if(BTN_RELEASED(BTN_PWR)){
+			state = state_show_menu_item;
+		} else if(BTN_RELEASED(BTN_UP)){
+			config_item++;
+			if(config_item >= HISTORY_ITEMS){
+				config_item = 0;
+				history_back++;
+				if(history_back >= HISTORY_HOURS){
+					history_back = 0;
+				}
+			}
+			state = state_show_history_item;
+		} else if(BTN_RELEASED(BTN_DOWN)){
+			config_item--;
+			if(config_item >= HISTORY_ITEMS){
+				config_item = HISTORY_ITEMS-1;
+				history_back--;
+				if(history_back >= HISTORY_HOURS){
+					history_back = HISTORY_HOURS-1;
+				}
+			}
+			state = state_show_history_item;
+		} else if(BTN_RELEASED(BTN_S)){
+			unsigned char bucket = history_latest - history_back;
+			if(bucket >= HISTORY_HOURS){
+				bucket += HISTORY_HOURS;
+			}
+			if(config_item < hist_relays){
+				temperature_to_led(eeprom_read_config(EEADR_HISTORY(bucket, config_item)));
+			} else {
+				unsigned int relays = eeprom_read_config(EEADR_HISTORY(bucket, hist_relays));
+				int_to_led((config_item == hist_relays) ? (relays & 0xff) : (relays >> 8));
+			}
+			countdown = 110;
+			state = state_show_history_value;
+		}
+		break;
+	case state_show_history_value:
+		/* History is read only, any of PWR or S returns to the item */
+		if(countdown==0){
+			state=state_idle;
+		} else if(BTN_RELEASED(BTN_PWR) || BTN_RELEASED(BTN_S)){
+			state = state_show_history_item;
+		}
+		break;
+#endif
 	case state_show_config_item:
+		// Leaving value with a button held, make sure FSM is not left running fast
+		PR6 = 250;
 		led_e.e_negative = 1;
 		led_e.e_deg = 1;
 		led_e.e_c = 1;
@@ -365,7 +702,21 @@ chk_skip_menu_item:
 		} else if(BTN_RELEASED(BTN_S)){
 			unsigned char adr = EEADR_MENU_ITEM(menu_item, config_item);
 			config_value = eeprom_read_config(adr);
+#ifdef UNIT_MENU
+			if(adr == EEADR_POWER_ON){
+				// Temperature unit shares EEPROM word with power on state
+				config_value = IS_FAHRENHEIT(config_value);
+			}
+#endif
 			config_value = check_config_value(config_value, adr);
+#ifdef ACCEL
+			if(menu_item < SET_MENU_ITEM_NO){
+				accel_type = (config_item & 0x1) ? type_hours : type_temp;
+			} else {
+				accel_type = setmenu[config_item].type;
+			}
+			accel_dir = 0;
+#endif
 			countdown = 110;
 			state = state_show_config_value;
 		}
@@ -378,6 +729,20 @@ chk_skip_menu_item:
 				temperature_to_led(config_value);
 			}
 		} else /* if(menu_item == SET_MENU_ITEM_NO) */ {
+#ifdef SET_MENU_TYPES
+			if(setmenu[config_item].type <= type_temp_diff){
+				temperature_to_led(config_value);
+			} else if (config_item == rn){
+				run_mode_to_led(config_value);
+			} else {
+				int_to_led(config_value);
+#ifdef UNIT_MENU
+				if(config_item == CF){
+					led_01.raw = config_value ? LED_F : LED_C;
+				}
+#endif
+			}
+#else
 			if(config_item <= SP){
 				temperature_to_led(config_value);
 			} else if (config_item < rn){
@@ -385,6 +750,7 @@ chk_skip_menu_item:
 			} else {
 				run_mode_to_led(config_value);
 			}
+#endif
 		}
 		countdown = 110;
 		state = state_set_config_value;
@@ -398,19 +764,30 @@ chk_skip_menu_item:
 			} else if(BTN_RELEASED(BTN_PWR)){
 				state = state_show_config_item;
 			} else if(BTN_HELD_OR_RELEASED(BTN_UP)) {
+#ifdef ACCEL
+				accel_step(BTN_UP);
+#else
 				config_value++;
 				if(config_value > 1000){
 					config_value+=9;
 				}
+#endif
 				/* Jump to exit code shared with BTN_DOWN case */
 				goto chk_cfg_acc_label;
 			} else if(BTN_HELD_OR_RELEASED(BTN_DOWN)) {
+#ifdef ACCEL
+				accel_step(BTN_DOWN);
+#else
 				config_value--;
 				if(config_value > 1000){
 					config_value-=9;
 				}
+#endif
 chk_cfg_acc_label:
 				config_value = check_config_value(config_value, adr);
+#ifdef ACCEL
+				range_clamp = 0;
+#endif
 				if(PR6 > 30){
 					PR6-=8;
 				}
@@ -431,11 +808,24 @@ chk_cfg_acc_label:
 							}
 						}
 					}
+#ifdef UNIT_MENU
+					else if(config_item == CF){
+						// Convert temperatures in EEPROM when unit is changed
+						if(config_value != IS_FAHRENHEIT(eeprom_read_config(EEADR_POWER_ON))){
+							convert_config_unit(config_value);
+						}
+						// Menu is only available when powered on
+						config_value = (config_value ? FAHRENHEIT_BIT : 0) | POWER_ON_BIT;
+					}
+#endif
 				}
 				eeprom_write_config(adr, config_value);
 				state=state_show_config_item;
 			} else {
 				PR6 = 250;
+#ifdef ACCEL
+				accel_ticks = 0;
+#endif
 			}
 		}
 		break;
@@ -445,7 +835,23 @@ chk_cfg_acc_label:
 
 	/* This is last resort...
 	 * Start using unused registers for general purpose
-	 * Use TMR1GE to flag if display should show temperature or not */
-	TMR1GE = (state==0);
+	 * Use TX9D to flag if display should show temperature or not
+	 * (TMR1GE was used before, but would gate Timer1 when it is running) */
+	TX9D = (state==0);
+
+#ifdef DIMMING
+	// Full brightness while the menu is used or on alarm, dim when idle for DIM_TICKS
+	if(state != state_idle || _buttons || LATA0){
+		dim_ticks = 0;
+		led_on_ticks = LED_SLOT_TICKS;
+	} else if(dim_ticks < DIM_TICKS){
+		if(++dim_ticks == DIM_TICKS){
+			unsigned char steps = eeprom_read_config(EEADR_SET_MENU_ITEM(db));
+			if(steps < DIM_STEPS){
+				led_on_ticks = (steps << 5) - steps; // DIM_STEP_TICKS per step
+			}
+		}
+	}
+#endif
 
 }
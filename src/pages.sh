@@ -0,0 +1,209 @@
+#!/bin/sh
+
+# STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+#
+# Copyright 2014 Mats Staffansson
+#
+# This file is part of STC1000+.
+#
+# STC1000+ is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# STC1000+ is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+
+# Report calls between page0.c and page1.c and suggest functions to move between them.
+#
+# Usage: pages.sh page0_c.asm page1_c.asm [counts]
+#
+# Function sizes and call sites are taken from the SDCC generated assembler files. The
+# other code sections of each file (const tables such as setmenu and ad_lookup, which are
+# RETLW words, the reset and interrupt vectors) stay where they are, but count towards
+# the size of the page. Library routines (multiply, divide) are not in these files and
+# are left out, so keep some room. Each call site counts as one call, unless a counts
+# file is given, with lines of "caller callee count" (function names without the leading
+# underscore), for example the number of calls made during a gpsim run, or in the host
+# build of the firmware (make counts.txt in ../test). A cross page call needs PAGESEL before the
+# call and after it returns, so each call moved within a page saves two instruction cycles.
+# Functions are moved one at a time, the move that saves the most first, as long as both
+# pages stay within PAGE_SIZE instructions. Moves are only suggested, page0.c and page1.c
+# are left as they are.
+
+PAGE_SIZE=2048
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 page0_c.asm page1_c.asm [counts]"
+	exit 1
+fi
+
+awk -v PAGE_SIZE=$PAGE_SIZE -v PAGE0="$1" -v PAGE1="$2" '
+FILENAME != PAGE0 && FILENAME != PAGE1 {
+	if ($0 !~ /^#/ && NF == 3) {
+		counted[$1 SUBSEP $2] = $3;
+		counts = 1;
+	}
+	next;
+}
+# Function code sections are named S_<file>__<function>, the other code sections are counted
+# instruction by instruction
+/^[A-Za-z0-9_]+[ \t]+code([ \t]|$)/ {
+	infunc = ($1 ~ /^S_/);
+	incode = !infunc;
+	fn = "";
+	next;
+}
+/^[A-Za-z0-9_]+[ \t]+(udata|idata)/ {
+	infunc = 0;
+	incode = 0;
+	fn = "";
+	next;
+}
+incode && /^[ \t]+[A-Za-z_]/ {
+	op = tolower($1);
+	if (op ~ /^(global|extern|res|list|radix|errorlevel|org|end|__config|__idlocs|include)$/) {
+		next;
+	}
+	if (op == "dw" || op == "data" || op == "da") {
+		fixed[FILENAME == PAGE1] += split(substr($0, index($0, $1) + length($1)), a, ",");
+	} else {
+		fixed[FILENAME == PAGE1]++;
+	}
+	next;
+}
+/^[ \t]+global[ \t]+_/ {
+	global[substr($2, 2)] = 1;
+	next;
+}
+infunc && /^_[A-Za-z][A-Za-z0-9_]*:/ {
+	fn = substr($1, 2, length($1) - 2);
+	if (!(fn in page)) {
+		names[nfunc++] = fn;
+	}
+	page[fn] = (FILENAME == PAGE1);
+	size[fn] = 0;
+	next;
+}
+fn != "" && /^[ \t]+CALL[ \t]+_/ {
+	callee = substr($2, 2);
+	if (!((fn SUBSEP callee) in sites)) {
+		caller_of[nedge] = fn;
+		callee_of[nedge] = callee;
+		nedge++;
+	}
+	sites[fn SUBSEP callee]++;
+	next;
+}
+fn != "" && /code size estimation/ {
+	sizeline = 1;
+	next;
+}
+sizeline {
+	split($0, a, "=");
+	size[fn] = a[2] + 0;
+	sizeline = 0;
+	fn = "";
+}
+
+# Weighted number of cross page calls
+function cost(    e, c) {
+	c = 0;
+	for (e = 0; e < nedge; e++) {
+		if (valid[e] && page[caller_of[e]] != page[callee_of[e]]) {
+			c += weight[e];
+		}
+	}
+	return c;
+}
+
+END {
+	used[0] = fixed[0];
+	used[1] = fixed[1];
+	for (i = 0; i < nfunc; i++) {
+		used[page[names[i]]] += size[names[i]];
+	}
+	for (e = 0; e < nedge; e++) {
+		key = caller_of[e] SUBSEP callee_of[e];
+		# Calls to library functions (not in either page) are left out
+		valid[e] = (callee_of[e] in page);
+		weight[e] = counts ? counted[key] + 0 : sites[key];
+	}
+	# The reset and interrupt vectors are in page 0
+	pinned["main"] = 1;
+	pinned["interrupt_service_routine"] = 1;
+
+	printf("Page 0: %d of %d instructions, page 1: %d of %d instructions\n", used[0], PAGE_SIZE, used[1], PAGE_SIZE);
+	printf("(functions, and %d and %d instructions of tables and vectors, without library routines)\n", fixed[0], fixed[1]);
+	printf("Cross page calls (%s): %d\n\n", counts ? "counted" : "call sites", cost());
+
+	printf("Suggested moves:\n");
+	moves = 0;
+	while (moves < nfunc) {
+		best = "";
+		best_gain = 0;
+		for (i = 0; i < nfunc; i++) {
+			f = names[i];
+			to = 1 - page[f];
+			if ((f in pinned) || (f in moved) || used[to] + size[f] > PAGE_SIZE) {
+				continue;
+			}
+			gain = 0;
+			for (e = 0; e < nedge; e++) {
+				if (!valid[e] || caller_of[e] == callee_of[e]) {
+					continue;
+				}
+				if (caller_of[e] == f) {
+					other = callee_of[e];
+				} else if (callee_of[e] == f) {
+					other = caller_of[e];
+				} else {
+					continue;
+				}
+				gain += (page[other] == to) ? weight[e] : -weight[e];
+			}
+			if (gain > best_gain) {
+				best = f;
+				best_gain = gain;
+			}
+		}
+		if (best == "") {
+			break;
+		}
+		to = 1 - page[best];
+		used[page[best]] -= size[best];
+		used[to] += size[best];
+		page[best] = to;
+		moved[best] = 1;
+		moves++;
+
+		# Functions called from the other page can not be static
+		note = "";
+		if (!(best in global)) {
+			for (e = 0; e < nedge; e++) {
+				if (valid[e] && callee_of[e] == best && page[caller_of[e]] != to) {
+					note = ", make non-static";
+				}
+			}
+		}
+		printf("  %s: page %d -> page %d (%d instructions, saves %d%s)\n", best, 1 - to, to, size[best], best_gain, note);
+	}
+	if (moves == 0) {
+		printf("  none\n");
+	}
+
+	printf("\nAfter moves, page 0: %d, page 1: %d instructions\n", used[0], used[1]);
+	printf("Cross page calls (%s): %d\n\n", counts ? "counted" : "call sites", cost());
+
+	printf("Remaining cross page calls:\n");
+	for (e = 0; e < nedge; e++) {
+		if (valid[e] && weight[e] && page[caller_of[e]] != page[callee_of[e]]) {
+			printf("  %s (page %d) -> %s (page %d): %d\n", caller_of[e], page[caller_of[e]], callee_of[e], page[callee_of[e]], weight[e]);
+		}
+	}
+}' "$@"
@@ -0,0 +1,94 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Profile stepping, included by page0.c.
+ * Kept apart so host tools (see profile/profc.c) can compile the exact same code
+ * against their own eeprom_read_config() and eeprom_write_config().
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+/* To be called once every hour on the hour.
+ * Updates EEPROM configuration when running profile.
+ */
+static void update_profile(){
+	unsigned char profile_no = eeprom_read_config(EEADR_SET_MENU_ITEM(rn));
+
+	// Running profile?
+	if (profile_no < THERMOSTAT_MODE) {
+		unsigned char curr_step = eeprom_read_config(EEADR_SET_MENU_ITEM(St));
+		unsigned int curr_dur = eeprom_read_config(EEADR_SET_MENU_ITEM(dh)) + 1;
+		unsigned char profile_step_eeaddr;
+		unsigned int profile_step_dur;
+		int profile_next_step_sp;
+
+		// Sanity check
+		if(curr_step > 8){
+			curr_step = 8;
+		}
+
+		profile_step_eeaddr = EEADR_PROFILE_SETPOINT(profile_no, curr_step);
+		profile_step_dur = eeprom_read_config(profile_step_eeaddr + 1);
+		profile_next_step_sp = eeprom_read_config(profile_step_eeaddr + 2);
+
+		// Reached end of step?
+		if (curr_dur >= profile_step_dur) {
+			// Update setpoint with value from next step
+			eeprom_write_config(EEADR_SET_MENU_ITEM(SP), profile_next_step_sp);
+			// Is this the last step (next step is number 9 or next step duration is 0)?
+			if (curr_step == 8 || eeprom_read_config(profile_step_eeaddr + 3) == 0) {
+				// Switch to thermostat mode.
+				eeprom_write_config(EEADR_SET_MENU_ITEM(rn), THERMOSTAT_MODE);
+				return; // Fastest way out...
+			}
+			// Reset duration
+			curr_dur = 0;
+			// Update step
+			curr_step++;
+			eeprom_write_config(EEADR_SET_MENU_ITEM(St), curr_step);
+		} else if(eeprom_read_config(EEADR_SET_MENU_ITEM(rP))) { // Is ramping enabled?
+			int profile_step_sp = eeprom_read_config(profile_step_eeaddr);
+			unsigned int t = curr_dur << 6;
+			long sp = 32;
+			unsigned char i;
+
+			// Linear interpolation calculation of new setpoint (64 substeps)
+			for (i = 0; i < 64; i++) {
+			 if (t >= profile_step_dur) {
+			    t -= profile_step_dur;
+			    sp += profile_next_step_sp;
+			  } else {
+			    sp += profile_step_sp;
+			  }
+			}
+			sp >>= 6;
+
+			// Update setpoint
+			eeprom_write_config(EEADR_SET_MENU_ITEM(SP), sp);
+		}
+		// Update duration
+		eeprom_write_config(EEADR_SET_MENU_ITEM(dh), curr_dur);
+	}
+}
+
+#endif // __PROFILE_H__
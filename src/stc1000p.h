@@ -56,12 +56,13 @@
 #define __STC1000P_H__
 
 /* Define STC-1000+ version number (XYY, X=major, YY=minor) */
-/* Also, keep track of last version that has changes in EEPROM layout */
-#define STC1000P_VERSION		107
-#define STC1000P_EEPROM_VERSION	11
+/* Also, keep track of last version that has changes in EEPROM layout (STC1000P_EEPROM_VERSION, below
+ * the EEPROM layout, as optional features change it)
+ */
+#define STC1000P_VERSION		108
 
-/* Define limits for temperatures */
-#ifdef FAHRENHEIT
+/* Define limits for temperatures (with UNIT_MENU always in Celsius, converted when unit is set to Fahrenheit) */
+#if defined(FAHRENHEIT) && !defined(UNIT_MENU)
 #define TEMP_MAX		(2500)
 #define TEMP_MIN		(-400)
 #define TEMP_CORR_MAX	(100)
@@ -81,46 +82,489 @@
 #define SP_ALARM_MAX	(400)
 #endif
 
+/* Optional features, enabled by adding defines when building, e.g. make all FEATURES=-DPI_CONTROL
+ *
+ * ACCEL		Holding up or down also grows the step with the hold time (0.1 -> 1.0 -> 10.0 degrees,
+ * 				1 -> 10 -> 100 hours), on a curve for each type of menu item
+ * UNIT_MENU	Temperature unit (Celsius or Fahrenheit) selected with the CF item in the set menu, in one
+ * 				firmware image, instead of building a Celsius and a Fahrenheit image (FAHRENHEIT)
+ * PI_CONTROL	Time proportional PI control as an alternative to the thermostat (hysteresis) control
+ * STATS		Relay and alarm statistics, shown in a read only menu
+ * HEALTH		Firmware health counters (loop time, late timer ticks, EEPROM writes, watchdog resets),
+ * 				shown while holding 'S' and 'up'
+ * HISTORY		Hourly temperature history (lowest, highest, average and relay on times),
+ * 				kept in EEPROM for the last HISTORY_HOURS hours and shown in a read only menu
+ * TELEMETRY	Once a second, send a frame with temperatures, setpoint, relay, alarm and profile state
+ * 				as 1000 baud serial on RA1 (ICSPCLK) of the ICSP header, read by the 'm' command of picprog.
+ * 				RA0 (ICSPDAT) drives the buzzer and is not used, probe 2 is not read while a frame is sent
+ * FILTER		Median filter (3 or 5 samples) ahead of the probe low pass filter, with the filter time
+ * 				constant in the set menu
+ * EEPROM_CRC	CRC for each profile and for the set menu in EEPROM, checked at power on. Only a block that
+ * 				does not match is recovered, the set menu is restored to defaults (thermostat mode) and a
+ * 				running profile that does not match is stopped
+ * DUAL_ZONE	Pb = 2 selects dual zone mode, heating controlled on probe 1 (SP, hy, hd) and cooling
+ * 				on probe 2 (SP2, hy2, cd)
+ * AUTOTUNE		Adjust hy and cooling/heating delay from the measured cycle period and overshoot, to a target
+ * 				number of relay cycles per hour set in the set menu
+ * OSC_CAL		Oscillator calibration, a 500Hz test signal on ICSPCLK for 5 seconds after power on when picprog
+ * 				holds ICSPCLK high (and Pb = 0), measured by the 'o' command of picprog, which writes the
+ * 				number of 60ms ticks in an hour to the last EEPROM word
+ * PROBE_CURVES	Thermistor curve selectable for each probe in the set menu, from compressed lookup tables
+ * 				(10k B3435 as shipped, 10k B3950 and 5k B3950)
+ * ANTICIPATE	Switch the active relay off early when the temperature is projected (from its slope) to coast
+ * 				past the setpoint, with the coast time learned from the overshoot and kept in the set menu
+ * DIMMING		Dim the display after the menu has been idle for a while, by blanking the LEDs for part of
+ * 				each 1ms multiplex slot, with the dimmed brightness in the set menu
+ * PROBE_FAULT	Check each raw AD result against the sensor alarm limits, and switch the relays off and show AL
+ * 				after two in a row, instead of waiting for the filtered value to get there
+ * PACKED_EEPROM	Profiles packed with 12 bit setpoints and durations, which leaves room for a seventh profile.
+ * 				Changes the EEPROM layout, picprog converts EEPROM data from 1.07 when uploading with 'b' or 'g'
+ */
+
+/* Set menu items for PI control:
+ * 	Pn, run mode (0 = thermostat, 1 = PI control)
+ * 	PP, proportional gain (1/512 of the time the relay is on, per 0.1 degree of error)
+ * 	PI, integral gain (1/512 of the time the relay is on, per 0.1 degree of error and 512 seconds)
+ */
+#ifdef PI_CONTROL
+#define PI_MENU_DATA(_) \
+    _(Pn, 	LED_P, 	LED_n, 	LED_OFF, 	type_other,		0,				1,					0,		0)		\
+    _(PP, 	LED_P, 	LED_P, 	LED_OFF, 	type_other,		0,				255,				20,		11)		\
+    _(PI, 	LED_P, 	LED_I, 	LED_OFF, 	type_other,		0,				255,				2,		1)		\
+
+#else
+#define PI_MENU_DATA(_)
+#endif
+
+/* Set menu items for the probe filter:
+ * 	Fn, median filter (0 = off, 1 = 3 samples, 2 = 5 samples)
+ * 	Ft, low pass filter time constant (2^Ft samples of 120ms, 6 is the same as without FILTER)
+ */
+#ifdef FILTER
+#define FILTER_MENU_DATA(_) \
+    _(Fn, 	LED_F, 	LED_n, 	LED_OFF, 	type_other,		0,				2,					1,		1)		\
+    _(Ft, 	LED_F, 	LED_t, 	LED_OFF, 	type_other,		0,				6,					4,		4)		\
+
+#else
+#define FILTER_MENU_DATA(_)
+#endif
+
+/* Set menu items for auto tune:
+ * 	At, target relay cycles per hour (0 = auto tune off)
+ */
+#ifdef AUTOTUNE
+#define AUTOTUNE_MENU_DATA(_) \
+    _(At, 	LED_A, 	LED_t, 	LED_OFF, 	type_other,		0,				12,					0,		0)		\
+
+#else
+#define AUTOTUNE_MENU_DATA(_)
+#endif
+
+/* Set menu items for probe curves:
+ * 	th, thermistor curve for probe 1 (0 = 10k B3435, 1 = 10k B3950, 2 = 5k B3950)
+ * 	th2, thermistor curve for probe 2
+ */
+#ifdef PROBE_CURVES
+#define PROBE_CURVES_MENU_DATA(_) \
+    _(th, 	LED_t, 	LED_h, 	LED_OFF, 	type_other,		0,				NTC_CURVES-1,		0,		0)		\
+    _(th2, 	LED_t, 	LED_h, 	LED_2, 		type_other,		0,				NTC_CURVES-1,		0,		0)		\
+
+#define NTC_CURVES								3
+#else
+#define PROBE_CURVES_MENU_DATA(_)
+#endif
+
+/* Set menu items for the anticipator:
+ * 	Ac, coast time in units of 8 seconds (0 = anticipator off), learned while running
+ */
+#ifdef ANTICIPATE
+#define ANTICIPATE_MENU_DATA(_) \
+    _(Ac, 	LED_A, 	LED_c, 	LED_OFF, 	type_other,		0,				255,				0,		0)		\
+
+#else
+#define ANTICIPATE_MENU_DATA(_)
+#endif
+
+/* Set menu items for display dimming:
+ * 	db, brightness when dimmed, in eighths (8 = no dimming)
+ *
+ * Each 1ms multiplex slot of LED_SLOT_TICKS Timer2 ticks is split in an on and an off part,
+ * DIM_STEP_TICKS per step of db. The display is dimmed after DIM_TICKS button ticks (112ms)
+ * of idle menu without buttons pressed, about 30 seconds.
+ */
+#ifdef DIMMING
+#define DIMMING_MENU_DATA(_) \
+    _(db, 	LED_d, 	LED_b, 	LED_OFF, 	type_other,		1,				DIM_STEPS,			DIM_STEPS,	DIM_STEPS)	\
+
+#define DIM_STEPS								8
+#define DIM_STEP_TICKS							31
+#define DIM_TICKS								268
+#else
+#define DIMMING_MENU_DATA(_)
+#endif
+#define LED_SLOT_TICKS							250
+
+/* Set menu items for dual zone mode:
+ * 	SP2, setpoint for the cooling zone on probe 2 (Pb = 2)
+ */
+#ifdef DUAL_ZONE
+#define DUAL_ZONE_MENU_DATA(_) \
+    _(SP2, 	LED_S, 	LED_P, 	LED_2, 		type_temp,		TEMP_MIN,		TEMP_MAX,			100,	500)	\
+
+#define PROBE2_MAX								2
+#define PROBE2_DUAL_ZONE						2
+#else
+#define DUAL_ZONE_MENU_DATA(_)
+#define PROBE2_MAX								1
+#endif
+
+/* Set menu items for the temperature unit:
+ * 	CF, 0 = Celsius, 1 = Fahrenheit. It must be last, as it shares its EEPROM word with the power
+ * 	on state, so its defaults are the raw EEPROM word (see EEADR_POWER_ON below).
+ */
+#ifdef UNIT_MENU
+#define UNIT_MENU_DATA(_) \
+    _(CF, 	LED_C, 	LED_F, 	LED_OFF, 	type_other,		0,				1,					1,		3)		\
+
+#else
+#define UNIT_MENU_DATA(_)
+#endif
+
+/* Statistics counters, kept in RAM and written to EEPROM once every hour
+ * 	name, LED data 10, LED data 1, LED data 01
+ *
+ * 	Ht, heating on time (hours)
+ * 	Ct, cooling on time (hours)
+ * 	rt, run time (hours)
+ * 	Hn, number of times heating relay switched on
+ * 	Cn, number of times cooling relay switched on
+ * 	Hb, number of heating starts delayed by heating delay
+ * 	Cb, number of cooling starts delayed by cooling delay
+ * 	AL, number of sensor alarms
+ */
+#ifdef STATS
+#define STATS_DATA(_) \
+    _(Ht, 	LED_H, 	LED_t, 	LED_OFF) 	\
+    _(Ct, 	LED_C, 	LED_t, 	LED_OFF) 	\
+    _(rt, 	LED_r, 	LED_t, 	LED_OFF) 	\
+    _(Hn, 	LED_H, 	LED_n, 	LED_OFF) 	\
+    _(Cn, 	LED_C, 	LED_n, 	LED_OFF) 	\
+    _(Hb, 	LED_H, 	LED_b, 	LED_OFF) 	\
+    _(Cb, 	LED_C, 	LED_b, 	LED_OFF) 	\
+    _(AL, 	LED_A, 	LED_L, 	LED_OFF) 	\
+
+#else
+#define STATS_DATA(_)
+#endif
+
+/* Firmware health counters, kept in RAM
+ * 	name, LED data 10, LED data 1, LED data 01
+ *
+ * 	Lt, longest main loop iteration (Timer1 ticks, 0xffff for a Timer1 period or more)
+ * 	t4, number of late or missed Timer4 (temperature control) ticks
+ * 	t6, number of late or missed Timer6 (button) ticks
+ * 	Et, longest time blocked in eeprom_write_config() (Timer1 ticks, as Lt)
+ * 	EP, lifetime number of EEPROM writes to profiles
+ * 	ES, lifetime number of EEPROM writes to settings
+ * 	tO, lifetime number of watchdog resets
+ *
+ * The last HEALTH_EE_ITEMS counters are also kept in EEPROM.
+ */
+#ifdef HEALTH
+#define HEALTH_DATA(_) \
+    _(Lt, 	LED_L, 	LED_t, 	LED_OFF) 	\
+    _(t4, 	LED_t, 	LED_4, 	LED_OFF) 	\
+    _(t6, 	LED_t, 	LED_6, 	LED_OFF) 	\
+    _(Et, 	LED_E, 	LED_t, 	LED_OFF) 	\
+    _(EP, 	LED_E, 	LED_P, 	LED_OFF) 	\
+    _(ES, 	LED_E, 	LED_S, 	LED_OFF) 	\
+    _(tO, 	LED_t, 	LED_O, 	LED_OFF) 	\
+
+#define HEALTH_EE_ITEMS							3
+#else
+#define HEALTH_DATA(_)
+#define HEALTH_EE_ITEMS							0
+#endif
+
+/* Hourly history, a ring of HISTORY_HOURS buckets in EEPROM, one bucket is written every hour.
+ * The ring takes the EEPROM left after the profiles, which are only cut down to leave room for
+ * HISTORY_MIN_HOURS. A bucket holds lowest, highest and average temperature and the relay on
+ * times in minutes (cooling in low byte, heating in high byte). A word after the buckets holds
+ * the index of the latest bucket in the low byte and the number of buckets written (up to
+ * HISTORY_HOURS) in the high byte, so buckets that have not been written are left alone.
+ *
+ * Values shown in the history menu for each hour
+ * 	name, LED data 10, LED data 1, LED data 01 (replaced by the number of hours back)
+ *
+ * 	tL, lowest temperature
+ * 	tH, highest temperature
+ * 	tA, average temperature
+ * 	Ct, cooling on time (minutes)
+ * 	Ht, heating on time (minutes)
+ */
+#ifdef HISTORY
+#define HISTORY_DATA(_) \
+    _(tL, 	LED_t, 	LED_L, 	LED_OFF) 	\
+    _(tH, 	LED_t, 	LED_H, 	LED_OFF) 	\
+    _(tA, 	LED_t, 	LED_A, 	LED_OFF) 	\
+    _(Ct, 	LED_C, 	LED_t, 	LED_OFF) 	\
+    _(Ht, 	LED_H, 	LED_t, 	LED_OFF) 	\
+
+#define HISTORY_MIN_HOURS						4		// Kept free of profiles
+#define HISTORY_MAX_HOURS						9		// Hours back are shown as a single digit
+#define HISTORY_MIN_WORDS						((HISTORY_MIN_HOURS << 2) + 1)
+#else
+#define HISTORY_DATA(_)
+#define HISTORY_MIN_WORDS						0
+#endif
+
+/* Words in a history bucket */
+enum history_enum {
+	hist_min = 0,
+	hist_max,
+	hist_avg,
+	hist_relays,
+};
+
+/* Types of menu items, decides how values are displayed and how the buttons accelerate */
+enum menu_item_types {
+	type_temp = 0,		// Temperature
+	type_temp_diff,		// Temperature difference (hysteresis, correction, alarm)
+	type_hours,			// Duration in hours
+	type_other,			// Small integers (delays, flags, profile step, run mode)
+};
+
 /* The data needed for the 'Set' menu
  * Using x macros to generate the data structures needed, all menu configuration can be kept in this
  * single place.
  *
  * The values are:
- * 	name, LED data 10, LED data 1, LED data 01, min value, max value, default value celsius, default value fahrenheit
+ * 	name, LED data 10, LED data 1, LED data 01, type, min value, max value, default value celsius, default value fahrenheit
  */
 #define SET_MENU_DATA(_) \
-    _(hy, 	LED_h, 	LED_y, 	LED_OFF, 	0, 				TEMP_HYST_1_MAX,	5,		10) 	\
-    _(hy2, 	LED_h, 	LED_y, 	LED_2, 		0, 				TEMP_HYST_2_MAX, 	50,		100)	\
-    _(tc, 	LED_t, 	LED_c, 	LED_OFF, 	TEMP_CORR_MIN, 	TEMP_CORR_MAX,		0,		0)		\
-    _(tc2, 	LED_t, 	LED_c, 	LED_2, 		TEMP_CORR_MIN,	TEMP_CORR_MAX,		0,		0)		\
-    _(SA, 	LED_S, 	LED_A, 	LED_OFF, 	SP_ALARM_MIN,	SP_ALARM_MAX,		0,		0)		\
-    _(SP, 	LED_S, 	LED_P, 	LED_OFF, 	TEMP_MIN,		TEMP_MAX,			200,	680)	\
-    _(St, 	LED_S, 	LED_t, 	LED_OFF, 	0,				8,					0,		0)		\
-    _(dh, 	LED_d, 	LED_h, 	LED_OFF, 	0,				999,				0,		0)		\
-    _(cd, 	LED_c, 	LED_d, 	LED_OFF, 	0,				60,					5,		5)		\
-    _(hd, 	LED_h, 	LED_d, 	LED_OFF, 	0,				60,					2,		2)		\
-    _(rP, 	LED_r, 	LED_P, 	LED_OFF, 	0,				1,					0,		0)		\
-    _(Pb, 	LED_P, 	LED_b, 	LED_2, 		0,				1,					0,		0)		\
-    _(rn, 	LED_r, 	LED_n, 	LED_OFF, 	0,				6,					6,		6) 		\
-
-#define ENUM_VALUES(name, led10ch, led1ch, led01ch, minv, maxv, dvc, dvf) \
+    _(hy, 	LED_h, 	LED_y, 	LED_OFF, 	type_temp_diff,	0, 				TEMP_HYST_1_MAX,	5,		10) 	\
+    _(hy2, 	LED_h, 	LED_y, 	LED_2, 		type_temp_diff,	0, 				TEMP_HYST_2_MAX, 	50,		100)	\
+    _(tc, 	LED_t, 	LED_c, 	LED_OFF, 	type_temp_diff,	TEMP_CORR_MIN, 	TEMP_CORR_MAX,		0,		0)		\
+    _(tc2, 	LED_t, 	LED_c, 	LED_2, 		type_temp_diff,	TEMP_CORR_MIN,	TEMP_CORR_MAX,		0,		0)		\
+    _(SA, 	LED_S, 	LED_A, 	LED_OFF, 	type_temp_diff,	SP_ALARM_MIN,	SP_ALARM_MAX,		0,		0)		\
+    _(SP, 	LED_S, 	LED_P, 	LED_OFF, 	type_temp,		TEMP_MIN,		TEMP_MAX,			200,	680)	\
+    DUAL_ZONE_MENU_DATA(_)																		\
+    _(St, 	LED_S, 	LED_t, 	LED_OFF, 	type_other,		0,				8,					0,		0)		\
+    _(dh, 	LED_d, 	LED_h, 	LED_OFF, 	type_hours,		0,				999,				0,		0)		\
+    _(cd, 	LED_c, 	LED_d, 	LED_OFF, 	type_other,		0,				60,					5,		5)		\
+    _(hd, 	LED_h, 	LED_d, 	LED_OFF, 	type_other,		0,				60,					2,		2)		\
+    _(rP, 	LED_r, 	LED_P, 	LED_OFF, 	type_other,		0,				1,					0,		0)		\
+    _(Pb, 	LED_P, 	LED_b, 	LED_2, 		type_other,		0,				PROBE2_MAX,			0,		0)		\
+    PI_MENU_DATA(_)																				\
+    AUTOTUNE_MENU_DATA(_)																		\
+    ANTICIPATE_MENU_DATA(_)																		\
+    FILTER_MENU_DATA(_)																			\
+    PROBE_CURVES_MENU_DATA(_)																	\
+    DIMMING_MENU_DATA(_)																		\
+    _(rn, 	LED_r, 	LED_n, 	LED_OFF, 	type_other,		0,		NO_OF_PROFILES,	NO_OF_PROFILES,	NO_OF_PROFILES) \
+    UNIT_MENU_DATA(_)																			\
+
+#define ENUM_VALUES(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
     name,
 
+#define COUNT_ITEMS(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf) \
+    +1
+
 /* Generate enum values for each entry int the set menu */
 enum set_menu_enum {
     SET_MENU_DATA(ENUM_VALUES)
 };
 
+#define STATS_ENUM_VALUES(name, led10ch, led1ch, led01ch) \
+    name,
+
+#define COUNT_STATS(name, led10ch, led1ch, led01ch) \
+    +1
+
+/* Generate enum values for each statistics counter */
+#ifdef STATS
+enum stats_enum {
+    STATS_DATA(STATS_ENUM_VALUES)
+};
+#endif
+
+/* Generate enum values for each health counter */
+#ifdef HEALTH
+enum health_enum {
+    HEALTH_DATA(STATS_ENUM_VALUES)
+};
+#endif
+
+/* Number of items in the set menu and statistics (usable by the preprocessor) */
+#define SET_MENU_ITEMS							(0 SET_MENU_DATA(COUNT_ITEMS))
+#define STATS_ITEMS								(0 STATS_DATA(COUNT_STATS))
+#define HEALTH_ITEMS							(0 HEALTH_DATA(COUNT_STATS))
+#define HISTORY_ITEMS							(0 HISTORY_DATA(COUNT_STATS))
+
+/* Words taken by the set menu in EEPROM, the power on state is kept in the word after it,
+ * unless it shares the CF word (UNIT_MENU).
+ */
+#ifdef UNIT_MENU
+#define SET_MENU_WORDS							SET_MENU_ITEMS
+#else
+#define SET_MENU_WORDS							(SET_MENU_ITEMS + 1)
+#endif
+
+/* EEPROM layout (256 bytes).
+ * Profiles come first, PROFILE_BYTES bytes each, as 19 words (SP0, dh0, ..., dh8, SP9).
+ * With PACKED_EEPROM, each of the first 9 steps takes 3 bytes instead, setpoint (12 bits, offset by SP_OFFSET)
+ * low byte, setpoint high nibble | duration (12 bits) high nibble << 4, duration low byte. The last setpoint
+ * takes 2 bytes.
+ * The set menu (with the power on state), statistics, health counters, history and CRC words follow as
+ * 16 bit words. Whatever space is left decides the number of profiles.
+ */
+#ifdef PACKED_EEPROM
+#define PROFILE_BYTES							29
+#define SP_OFFSET								400
+#else
+#define PROFILE_BYTES							38
+#endif
+/* With EEPROM_CRC, each profile and the set menu has a CRC word */
+#ifdef EEPROM_CRC
+#define CRC_BLOCK_BYTES							2
+#else
+#define CRC_BLOCK_BYTES							0
+#endif
+
+/* Oscillator calibration is kept in the last EEPROM word (at a fixed address, for picprog),
+ * the number of 60ms Timer4 ticks in one hour. Values outside the limits (such as erased EEPROM)
+ * are not used.
+ */
+#define TICKS_PER_HOUR							60000
+#ifdef OSC_CAL
+#define OSC_CAL_BYTES							2
+#define EEPROM_OSC_CAL_BYTE						254
+#define OSC_CAL_MIN								57000
+#define OSC_CAL_MAX								63000
+#define OSC_CAL_MS								5000
+#define OSC_CAL_HOLD_MS							500		// Long enough for a bootloader to check the firmware first
+#else
+#define OSC_CAL_BYTES							0
+#endif
+#define EEPROM_FIXED_WORDS						(SET_MENU_WORDS + STATS_ITEMS + HEALTH_EE_ITEMS)
+#define EEPROM_PROFILES_FIT						((256 - ((EEPROM_FIXED_WORDS + HISTORY_MIN_WORDS) << 1) - CRC_BLOCK_BYTES - OSC_CAL_BYTES) / (PROFILE_BYTES + CRC_BLOCK_BYTES))
+
+/* Plain number, as it is used in SET_MENU_DATA itself. At most 7 (packed) profiles fit in 8 bit config addresses. */
+#if EEPROM_PROFILES_FIT >= 7
+#define NO_OF_PROFILES							7
+#elif EEPROM_PROFILES_FIT == 6
 #define NO_OF_PROFILES							6
+#elif EEPROM_PROFILES_FIT == 5
+#define NO_OF_PROFILES							5
+#elif EEPROM_PROFILES_FIT == 4
+#define NO_OF_PROFILES							4
+#else
+#error "Set menu, statistics and health counters does not fit in EEPROM (see PACKED_EEPROM)"
+#endif
+#define EEPROM_SET_MENU_BYTE					(NO_OF_PROFILES * PROFILE_BYTES)
+
+/* History buckets of 8 bytes in what is left, after the latest bucket word */
+#ifdef HISTORY
+#define HISTORY_FREE_BYTES						(256 - NO_OF_PROFILES * (PROFILE_BYTES + CRC_BLOCK_BYTES) - ((EEPROM_FIXED_WORDS + 1) << 1) - CRC_BLOCK_BYTES - OSC_CAL_BYTES)
+#if (HISTORY_FREE_BYTES >> 3) > HISTORY_MAX_HOURS
+#define HISTORY_HOURS							HISTORY_MAX_HOURS
+#else
+#define HISTORY_HOURS							(HISTORY_FREE_BYTES >> 3)
+#endif
+#define HISTORY_WORDS							((HISTORY_HOURS << 2) + 1)
+#else
+#define HISTORY_WORDS							0
+#endif
+#define EEPROM_DATA_WORDS						(EEPROM_FIXED_WORDS + HISTORY_WORDS)
+
+/* The layout of 1.07 is 6 profiles of 19 words followed by 14 set menu words, which fill EEPROM.
+ * Optional features only add set menu items and words after the set menu, so any build that keeps
+ * 6 profiles and 14 set menu words has the layout of 1.07.
+ */
+#if !defined(PACKED_EEPROM) && NO_OF_PROFILES == 6 && SET_MENU_WORDS == 14
+#define STC1000P_EEPROM_VERSION					11
+#else
+#define STC1000P_EEPROM_VERSION					108
+#endif
+#ifdef EEPROM_CRC
+#define CRC_WORDS								(NO_OF_PROFILES + 1)
+#else
+#define CRC_WORDS								0
+#endif
+/* Words after the profiles */
+#define EEPROM_WORD_ITEMS						(EEPROM_DATA_WORDS + CRC_WORDS)
 #define SET_MENU_ITEM_NO						NO_OF_PROFILES
+#define STATS_MENU_ITEM_NO						(NO_OF_PROFILES+1)
+#ifdef STATS
+#define HISTORY_MENU_ITEM_NO					(STATS_MENU_ITEM_NO+1)
+#else
+#define HISTORY_MENU_ITEM_NO					STATS_MENU_ITEM_NO
+#endif
 #define THERMOSTAT_MODE							NO_OF_PROFILES
 
-/* Defines for EEPROM config addresses */
+/* Last item in the top level menu */
+#if defined(HISTORY)
+#define LAST_MENU_ITEM_NO						HISTORY_MENU_ITEM_NO
+#elif defined(STATS)
+#define LAST_MENU_ITEM_NO						STATS_MENU_ITEM_NO
+#else
+#define LAST_MENU_ITEM_NO						SET_MENU_ITEM_NO
+#endif
+
+/* Defines for EEPROM config addresses, the word addresses of the layout above.
+ * With PACKED_EEPROM, each profile instead has a block of 32 config addresses (SP0, dh0, ..., dh8, SP9
+ * and 13 unused) followed by the set menu, statistics, health counters and history.
+ * eeprom_read_config() and eeprom_write_config() map them to the packed layout.
+ */
+#ifdef PACKED_EEPROM
+#define EEADR_PROFILE_SETPOINT(profile, step)	(((profile)<<5) + ((step)<<1))
+#else
 #define EEADR_PROFILE_SETPOINT(profile, step)	(((profile)*19) + ((step)<<1))
+#endif
 #define EEADR_PROFILE_DURATION(profile, step)	EEADR_PROFILE_SETPOINT(profile, step) + 1
 #define EEADR_SET_MENU							EEADR_PROFILE_SETPOINT(NO_OF_PROFILES, 0)
 #define EEADR_SET_MENU_ITEM(name)				(EEADR_SET_MENU + (name))
-#define EEADR_POWER_ON							127
+#define EEADR_STATS(name)						(EEADR_SET_MENU + SET_MENU_WORDS + (name))
+#define EEADR_HEALTH(name)						(EEADR_STATS(STATS_ITEMS) + (name) - (HEALTH_ITEMS - HEALTH_EE_ITEMS))
+#define EEADR_HISTORY(bucket, item)				(EEADR_HEALTH(HEALTH_ITEMS) + ((bucket)<<2) + (item))
+#define EEADR_HISTORY_LATEST					EEADR_HISTORY(HISTORY_HOURS, 0)
+#define EEADR_CRC(block)						(EEADR_HISTORY(0, 0) + HISTORY_WORDS + (block))
+
+/* CRC-16 (polynomial 0x1021, initial value 0) for each block, the bytes of a profile (blocks 0 to
+ * NO_OF_PROFILES-1) or of the set menu (CRC_BLOCK_SET_MENU). The CRC is linear, so a changed byte
+ * updates the CRC of its block from the old and new byte, without reading the rest of the block.
+ * EEPROM_CRC_UNSET (as in erased EEPROM) means no CRC has been calculated yet, it is then calculated at power on.
+ */
+#define CRC_BLOCK_SET_MENU						NO_OF_PROFILES
+#define EEPROM_CRC_SET_MENU_END					(EEPROM_SET_MENU_BYTE + (SET_MENU_WORDS << 1))
+#define EEPROM_CRC_POLY							0x1021
+#define EEPROM_CRC_UNSET						0xffff
+
+/* Power on state, in the last word of the set menu. Bit 0 is the power on state.
+ * With UNIT_MENU, the temperature unit shares the word (the CF item) and bit 1 set means Fahrenheit.
+ * Words from earlier versions (0, 1 or 0xffff if never written) all mean Celsius. IS_POWER_ON() tests the
+ * power on state of the word, without UNIT_MENU the word is the state as it was in 1.07.
+ * EEPROM_POWER_ON_BYTE is the byte address of the word, usable by the preprocessor (for picprog).
+ */
+#define EEADR_POWER_ON							(EEADR_SET_MENU + SET_MENU_WORDS - 1)
+#define EEPROM_POWER_ON_BYTE					(EEPROM_SET_MENU_BYTE + ((SET_MENU_WORDS - 1) << 1))
+#define POWER_ON_BIT							0x1
+#ifdef UNIT_MENU
+#define IS_POWER_ON(w)							((w) & POWER_ON_BIT)
+#define FAHRENHEIT_BIT							0x2
+#define IS_FAHRENHEIT(w)						((((unsigned char)(w)) & ~POWER_ON_BIT) == FAHRENHEIT_BIT)
+#define UNIT_IS_FAHRENHEIT()					IS_FAHRENHEIT(eeprom_read_config(EEADR_POWER_ON))
+#elif defined(FAHRENHEIT)
+#define IS_POWER_ON(w)							(w)
+#define UNIT_IS_FAHRENHEIT()					1
+#else
+#define IS_POWER_ON(w)							(w)
+#define UNIT_IS_FAHRENHEIT()					0
+#endif
+
+#if defined(PACKED_EEPROM) && ((NO_OF_PROFILES << 5) + EEPROM_WORD_ITEMS) > 256
+#error "Too many profiles for 8 bit config addresses"
+#endif
 
 #define SET_MENU_SIZE							(sizeof(setmenu)/sizeof(setmenu[0]))
 
@@ -201,6 +645,26 @@ extern unsigned const char led_lookup[];
 extern unsigned int eeprom_read_config(unsigned char eeprom_address);
 extern void eeprom_write_config(unsigned char eeprom_address,unsigned int data);
 extern void value_to_led(int value, unsigned char decimal);
+#ifdef UNIT_MENU
+extern int convert_temperature(int value, unsigned char type, unsigned char to_fahrenheit);
+extern void convert_config_unit(unsigned char to_fahrenheit);
+#endif
+#ifdef STATS
+extern unsigned int stats[];
+#endif
+#ifdef HISTORY
+extern unsigned char history_latest;
+#endif
+#ifdef HEALTH
+extern unsigned int health[];
+extern void health_to_led(unsigned char item);
+#endif
+#ifdef DIMMING
+extern unsigned char led_on_ticks;
+#endif
+#if defined(STATS) || defined(HEALTH)
+extern void count_to_led(unsigned int value);
+#endif
 #define int_to_led(v)			value_to_led(v, 0);
 #define temperature_to_led(v)	value_to_led(v, 1);
 
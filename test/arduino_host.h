@@ -0,0 +1,161 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* The Arduino API used by picprog.ino, for the host tests. Serial input is taken from
+ * host_serial_in and output is collected in host_serial_out. Pins are kept in host_pin[],
+ * and changes of the pins are passed to host_pin_changed(), which the test defines to
+ * play the part of whatever is connected. Time moves on by 1us every time it is read.
+ */
+
+#ifndef __ARDUINO_HOST_H__
+#define __ARDUINO_HOST_H__
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define HIGH	1
+#define LOW		0
+#define INPUT	0
+#define OUTPUT	1
+#define DEC		10
+#define HEX		16
+
+#define PROGMEM
+typedef const char *PGM_P;
+#define pgm_read_byte(p)	(*(const unsigned char *)(p))
+#define pgm_read_word(p)	(*(const unsigned short *)(p))
+
+class __FlashStringHelper;
+#define F(s)	(reinterpret_cast<const __FlashStringHelper *>(s))
+
+#define HOST_PINS	20
+
+struct host_pin_state {
+	unsigned char mode, level;
+};
+static host_pin_state host_pin[HOST_PINS];
+static unsigned long host_time_us;
+
+/* Defined by the test, called after a pin has changed, and to read a pin that is an input */
+static void host_pin_changed(unsigned char pin);
+static unsigned char host_pin_read(unsigned char pin);
+
+static void pinMode(unsigned char pin, unsigned char mode) {
+	host_pin[pin].mode = mode;
+	host_pin_changed(pin);
+}
+
+static void digitalWrite(unsigned char pin, unsigned char level) {
+	if (host_pin[pin].level != level) {
+		host_pin[pin].level = level;
+		host_pin_changed(pin);
+	}
+}
+
+static int digitalRead(unsigned char pin) {
+	return host_pin[pin].mode == OUTPUT ? host_pin[pin].level : host_pin_read(pin);
+}
+
+static void delay(unsigned long ms) {
+	host_time_us += ms * 1000;
+}
+
+static void delayMicroseconds(unsigned int us) {
+	host_time_us += us;
+}
+
+static unsigned long micros() {
+	return ++host_time_us;
+}
+
+static unsigned long millis() {
+	return ++host_time_us / 1000;
+}
+
+static std::string host_serial_in, host_serial_out;
+
+class HostSerial {
+public:
+	void begin(unsigned long baud) {
+	}
+	int available() {
+		return host_serial_in.size();
+	}
+	int read() {
+		int c;
+		if (host_serial_in.empty()) {
+			return -1;
+		}
+		c = (unsigned char) host_serial_in[0];
+		host_serial_in.erase(0, 1);
+		return c;
+	}
+	void write(unsigned char c) {
+		host_serial_out += (char) c;
+	}
+	void print(const char *s) {
+		host_serial_out += s;
+	}
+	void print(const __FlashStringHelper *s) {
+		host_serial_out += reinterpret_cast<const char *>(s);
+	}
+	void print(char c) {
+		host_serial_out += c;
+	}
+	void print(unsigned long n, int base = DEC) {
+		char buf[24];
+		snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+		host_serial_out += buf;
+	}
+	void print(long n, int base = DEC) {
+		if (n < 0 && base == DEC) {
+			host_serial_out += '-';
+			n = -n;
+		}
+		print((unsigned long) n, base);
+	}
+	void print(int n, int base = DEC) {
+		print((long) n, base);
+	}
+	void print(unsigned int n, int base = DEC) {
+		print((unsigned long) n, base);
+	}
+	void print(unsigned char n, int base = DEC) {
+		print((unsigned long) n, base);
+	}
+	void println() {
+		host_serial_out += "\r\n";
+	}
+	template<typename T> void println(T value) {
+		print(value);
+		println();
+	}
+	template<typename T> void println(T value, int base) {
+		print(value, base);
+		println();
+	}
+};
+static HostSerial Serial;
+
+#endif // __ARDUINO_HOST_H__
@@ -0,0 +1,86 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Both pages of the firmware in one host program, for the tests. int is 16 bits
+ * as on the PIC, main() is renamed firmware_main() and the registers are the ones in
+ * pic14/pic16f1828.h. page0_host.c and eepromdata_host.c are the sources with the SDCC
+ * only bits taken out (see Makefile).
+ */
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define int short
+#define main firmware_main
+#include "page0_host.c"
+#include "../src/page1.c"
+#include "eepromdata_host.c"
+#undef main
+#undef int
+
+static int failures;
+
+#define CHECK(cond)	do { if(!(cond)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+/* Microseconds the firmware has run, as counted by host_tick() */
+static unsigned long host_us;
+
+/* Load the EEPROM defaults of the build, as programmed along with the firmware */
+static void host_eeprom_defaults(void){
+	memset(host_eeprom, 0xff, sizeof(host_eeprom));
+	memcpy(host_eeprom, eedata, sizeof(eedata));
+}
+
+/* One run of the menu FSM with the buttons in btn held (BTN_PWR, BTN_S, BTN_UP, BTN_DOWN),
+ * as main() does when Timer6 expires (64 * 7 * (PR6 + 1) us at 4MHz).
+ */
+static void host_tick(unsigned char btn){
+	RC7 = (btn & BTN_PWR) != 0;
+	RC4 = (btn & BTN_S) != 0;
+	RC6 = (btn & BTN_UP) != 0;
+	RC3 = (btn & BTN_DOWN) != 0;
+	button_menu_fsm();
+	host_us += 448UL * (PR6 + 1);
+}
+
+/* A fermenter for the control tests. The relays drive a heater or cooler, that takes a while
+ * to get going (lag seconds) and moves the beer by up to rate per second, and the beer drifts
+ * toward the ambient temperature with time constant loss seconds. Temperatures are in 0.1 degrees.
+ */
+struct host_plant {
+	double beer, drive, ambient;
+	double heat_rate, cool_rate, lag, loss;
+};
+
+/* Advance the fermenter one second, with the relays as they are now */
+static void host_plant_step(struct host_plant *p){
+	double u = (LATA5 ? p->heat_rate : 0) - (LATA4 ? p->cool_rate : 0);
+	p->drive += (u - p->drive) / p->lag;
+	p->beer += p->drive + (p->ambient - p->beer) / p->loss;
+	temperature = (short)(p->beer < 0 ? p->beer - 0.5 : p->beer + 0.5);
+}
+
+#endif // __HOST_H__
@@ -0,0 +1,116 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Stand in for the SDCC device header, when the firmware is built on the host for the tests.
+ * Registers and bits are plain variables. Reads and writes of EEPROM and AD conversions
+ * happen when RD, WR and ADGO are accessed, on host_eeprom[] and host_ad[], and CLRWDT
+ * calls host_loop.
+ */
+
+#ifndef __HOST_PIC16F1828_H__
+#define __HOST_PIC16F1828_H__
+
+/* SDCC keywords and inline assembly */
+#define __at
+#define __code
+#define __naked
+#define __asm
+#define __endasm
+#define CLRWDT		host_clrwdt();
+#define RESET		host_reset();
+#define _CONFIG1
+#define _CONFIG2
+
+/* Registers */
+unsigned char OSCCON, INTCON, OPTION_REG;
+unsigned char PORTA, PORTB, PORTC, LATA, LATB, LATC, TRISA, TRISB, TRISC, ANSELA, ANSELB, ANSELC;
+unsigned char T1CON, T2CON, T4CON, T6CON, TMR1L, TMR1H, PR2, PR4, PR6;
+unsigned char ADCON0, ADCON1, ADRESL, ADRESH;
+unsigned char EEADRL, EEADRH, EEDATL, EEDATH, EECON1, EECON2;
+
+/* Bits */
+unsigned char GIE, PEIE, TMR1GE, TMR4ON, TMR1IE, TMR1IF, TMR2IE, TMR2IF, TMR4IF, TMR6IF, EEIF;
+unsigned char ADON, ADFM, ADCS0;
+unsigned char CFGS, EEPGD, WREN;
+unsigned char RA0, RA1, RA2, RC3, RC4, RC6, RC7;
+unsigned char LATA0, LATA1, LATA4, LATA5;
+unsigned char TRISA0, TRISA1, ANSA1;
+unsigned char TX9, RX9, TX9D;
+unsigned char NOT_TO = 1;
+
+#define _ADON		0x01
+#define _GO			0x02
+#define _CHS0		0x04
+#define _CHS1		0x08
+#define _ANSA1		0x02
+#define _ANSA2		0x04
+
+/* Emulated peripherals */
+unsigned char host_eeprom[256];
+unsigned int host_eeprom_writes;
+unsigned int host_ad[4];
+unsigned int host_resets;
+static unsigned char host_bit;
+
+static void host_reset(void){
+	host_resets++;
+}
+
+/* Called on every CLRWDT, at the end of each pass of the main loop. A test that runs
+ * firmware_main() sets it, to feed the loop and to get out of it (with longjmp).
+ */
+static void (*host_loop)(void);
+
+static void host_clrwdt(void){
+	if(host_loop){
+		host_loop();
+	}
+}
+
+static unsigned char *host_rd(void){
+	EEDATL = host_eeprom[EEADRL];
+	host_bit = 0;
+	return &host_bit;
+}
+
+static unsigned char *host_wr(void){
+	if(WREN && host_eeprom[EEADRL] != EEDATL){
+		host_eeprom[EEADRL] = EEDATL;
+		host_eeprom_writes++;
+	}
+	host_bit = 0;
+	return &host_bit;
+}
+
+static unsigned char *host_adgo(void){
+	unsigned int ad = host_ad[(ADCON0 >> 2) & 3];
+	ADRESH = ad >> 8;
+	ADRESL = ad;
+	host_bit = 0;
+	return &host_bit;
+}
+
+#define RD			(*host_rd())
+#define WR			(*host_wr())
+#define ADGO		(*host_adgo())
+
+#endif // __HOST_PIC16F1828_H__
@@ -0,0 +1,180 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Button acceleration (ACCEL): time to reach a value, clamping at the limits and
+ * starting over when the direction changes.
+ */
+
+#include "host.h"
+
+/* Open a set menu item for editing, from the item list */
+static void open_item(unsigned char item, int value){
+	eeprom_write_config(EEADR_SET_MENU_ITEM(item), value);
+	menu_item = SET_MENU_ITEM_NO;
+	config_item = item;
+	countdown = 110;
+	state = state_set_config_item;
+	_buttons = 0;
+	host_tick(BTN_S);
+	host_tick(0);
+	host_tick(0);
+	CHECK(state == state_set_config_value);
+	CHECK(config_value == value);
+}
+
+/* One step of the value being set, the FSM takes two ticks to show it and set it again */
+static void hold(unsigned char btn){
+	host_tick(btn);
+	host_tick(btn);
+}
+
+int main(void){
+	unsigned int i;
+	int last;
+
+	host_eeprom_defaults();
+
+	// 0.0 to 100.0 degrees in a few seconds, one step at a time would take about half a minute
+	open_item(SP, 0);
+	host_us = 0;
+	for(i=0; i<2000 && config_value < 1000; i++){
+		host_tick(BTN_UP);
+	}
+	printf("SP 0.0 -> %d.%d in %lu ms\n", config_value / 10, config_value % 10, host_us / 1000);
+	CHECK(config_value >= 1000);
+	CHECK(host_us < 10000000UL);
+
+	// Held at the top, large steps stop at TEMP_MAX instead of wrapping to TEMP_MIN
+	open_item(SP, TEMP_MAX - 300);
+	last = config_value;
+	for(i=0; i<600; i++){
+		host_tick(BTN_UP);
+		CHECK(config_value >= last);
+		last = config_value;
+	}
+	CHECK(config_value == TEMP_MAX);
+
+	// And at the bottom
+	open_item(SP, TEMP_MIN + 300);
+	last = config_value;
+	for(i=0; i<600; i++){
+		host_tick(BTN_DOWN);
+		CHECK(config_value <= last);
+		last = config_value;
+	}
+	CHECK(config_value == TEMP_MIN);
+
+	// Turning around at full speed starts over with the smallest step
+	open_item(SP, TEMP_MIN);
+	for(i=0; i<140; i++){
+		host_tick(BTN_UP);
+	}
+	CHECK(accel_ticks == (ACCEL_STAGES-1) * ACCEL_STAGE_TICKS);
+	CHECK(config_value < 1000);
+	last = config_value;
+	host_tick(BTN_DOWN);
+	host_tick(BTN_DOWN);
+	CHECK(config_value == last - 1);
+	CHECK(accel_ticks == 1);
+	CHECK(PR6 == 250 - 8);
+
+	// Durations 0 to 999 hours in a few seconds as well, and held at the top they stay there
+	open_item(dh, 0);
+	host_us = 0;
+	for(i=0; i<1000 && config_value < 999; i++){
+		hold(BTN_UP);
+		CHECK(config_value >= 0 && config_value <= 999);
+	}
+	printf("dh 0 -> %d in %lu ms\n", config_value, host_us / 1000);
+	CHECK(config_value == 999);
+	CHECK(host_us < 10000000UL);
+	for(i=0; i<50; i++){
+		hold(BTN_UP);
+	}
+	CHECK(config_value == 999);
+
+	// The whole range of a setpoint, a step up every time and never past the top
+	open_item(SP, TEMP_MIN);
+	host_us = 0;
+	last = config_value;
+	for(i=0; i<1000 && config_value < TEMP_MAX; i++){
+		hold(BTN_UP);
+		CHECK(config_value > last && config_value <= TEMP_MAX);
+		last = config_value;
+	}
+	printf("SP %d -> %d in %lu ms\n", TEMP_MIN, config_value, host_us / 1000);
+	CHECK(config_value == TEMP_MAX);
+	CHECK(host_us < 15000000UL);
+
+	// Turning around at the top takes small steps back, and going up again stops at the top
+	for(i=0; i<3; i++){
+		hold(BTN_DOWN);
+	}
+	CHECK(config_value == TEMP_MAX - 30);
+	for(i=0; i<50; i++){
+		hold(BTN_UP);
+		CHECK(config_value >= TEMP_MAX - 30 && config_value <= TEMP_MAX);
+	}
+	CHECK(config_value == TEMP_MAX);
+
+	// Turning around just above the bottom, the held button stops at the bottom instead of wrapping
+	open_item(SP, TEMP_MIN + 300);
+	for(i=0; i<70; i++){
+		hold(BTN_DOWN);
+	}
+	CHECK(config_value == TEMP_MIN);
+	hold(BTN_UP);
+	hold(BTN_UP);
+	CHECK(config_value == TEMP_MIN + 2);
+	for(i=0; i<50; i++){
+		hold(BTN_DOWN);
+		CHECK(config_value >= TEMP_MIN && config_value <= TEMP_MIN + 2);
+	}
+	CHECK(config_value == TEMP_MIN);
+
+	// A temperature difference turning around at its top, by 0.1 and then no further than the top
+	open_item(hy2, TEMP_HYST_2_MAX - 50);
+	for(i=0; i<50; i++){
+		hold(BTN_UP);
+	}
+	CHECK(config_value == TEMP_HYST_2_MAX);
+	hold(BTN_DOWN);
+	CHECK(config_value == TEMP_HYST_2_MAX - 1);
+	for(i=0; i<50; i++){
+		hold(BTN_UP);
+		CHECK(config_value >= TEMP_HYST_2_MAX - 1 && config_value <= TEMP_HYST_2_MAX);
+	}
+	CHECK(config_value == TEMP_HYST_2_MAX);
+
+	// Single steps still wrap around, as without ACCEL
+	open_item(rn, THERMOSTAT_MODE);
+	host_tick(BTN_UP);
+	host_tick(BTN_UP);
+	CHECK(config_value == 0);
+
+	if(failures){
+		printf("test_accel: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_accel: ok\n");
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Anticipator (ANTICIPATE) on the fermenter of host.h, heated in a cool room: with the coast time
+ * learned from Ac = 1, the heater has to overshoot the setpoint less than with the anticipator off,
+ * without cycling more often.
+ */
+
+#include "host.h"
+
+#define SETPOINT	200
+#define SETTLE		(24L * 3600)
+#define DURATION	(48L * 3600)
+
+struct result {
+	unsigned char coast;	// Ac at the end
+	unsigned int cycles;	// Heating cycles, once settled
+	int overshoot;			// Largest temperature above the setpoint, once settled
+};
+
+static struct result run(int hysteresis, double heat_rate, unsigned char coast){
+	// The heater takes a couple of minutes to get going, and as long to cool down
+	struct host_plant plant = { SETPOINT, 0, 150, heat_rate, 0, 120, 5000 };
+	struct result r = { 0, 0, 0 };
+	unsigned char on = 0;
+	long t;
+
+	host_eeprom_defaults();
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP), SETPOINT);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hy), hysteresis);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hd), 0);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Ac), coast);
+	LATA4 = LATA5 = 0;
+	cooling_delay = heating_delay = 0;
+	ant_state = ant_filled = ant_seconds = ant_index = 0;
+	ant_margin = 0;
+	temperature = plant.beer;
+
+	for(t=0; t<DURATION; t++){
+		temperature_control();
+		host_plant_step(&plant);
+
+		if(t >= SETTLE){
+			if(temperature - SETPOINT > r.overshoot){
+				r.overshoot = temperature - SETPOINT;
+			}
+			if(LATA5 && !on){
+				r.cycles++;
+			}
+		}
+		on = LATA5;
+	}
+
+	r.coast = eeprom_read_config(EEADR_SET_MENU_ITEM(Ac));
+	printf("hy %d.%d, heat %.2f, Ac %3d -> %3d: %3u cycles, overshoot %d.%d\n", hysteresis / 10, hysteresis % 10,
+			heat_rate, coast, r.coast, r.cycles, r.overshoot / 10, r.overshoot % 10);
+	return r;
+}
+
+int main(void){
+	static const struct {
+		int hysteresis;
+		double heat_rate;
+	} cases[] = { { 5, 0.1 }, { 10, 0.2 }, { 10, 0.3 } };
+	unsigned char i;
+
+	for(i=0; i<sizeof(cases)/sizeof(cases[0]); i++){
+		struct result off = run(cases[i].hysteresis, cases[i].heat_rate, 0);
+		struct result on = run(cases[i].hysteresis, cases[i].heat_rate, 1);
+
+		// Something to take off, and it is mostly gone
+		CHECK(off.overshoot > ANTICIPATE_DEADBAND);
+		CHECK(on.overshoot * 2 <= off.overshoot);
+		CHECK(on.coast > 1);
+		// The switch on threshold moves with the early cut, so the relay cycles no more often
+		CHECK(on.cycles <= off.cycles);
+		CHECK(on.cycles > 0);
+	}
+
+	if(failures){
+		printf("test_anticipate: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_anticipate: ok\n");
+	return 0;
+}
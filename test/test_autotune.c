@@ -0,0 +1,116 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Auto tune (AUTOTUNE) on the fermenter of host.h: from a hysteresis that cycles the relay far
+ * too often, and from one that cycles it far too seldom, hy has to settle where the cooling relay
+ * cycles at no more than At times per hour, and at least half that.
+ */
+
+#include "host.h"
+
+#define SETPOINT	200
+#define TARGET		4			// At, cycles per hour
+#define SETTLE		(24L * 3600)
+#define DURATION	(36L * 3600)
+
+struct result {
+	int hysteresis;			// hy at the end
+	unsigned char delay;	// cd at the end
+	double rate;			// Cooling cycles per hour, once settled
+	int peak;				// Largest error, once settled
+};
+
+static struct result run(int hysteresis, unsigned char target){
+	// Warm room, so the cooler does the work
+	struct host_plant plant = { SETPOINT, 0, 260, 0.03, 0.1, 120, 1000 };
+	struct result r = { 0, 0, 0, 0 };
+	unsigned int switches = 0;
+	unsigned char on = 0;
+	long t;
+
+	host_eeprom_defaults();
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP), SETPOINT);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hy), hysteresis);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(cd), 0);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(At), target);
+	LATA4 = LATA5 = 0;
+	cooling_delay = heating_delay = 0;
+	at_state = at_cycles = 0;
+	temperature = plant.beer;
+
+	for(t=0; t<DURATION; t++){
+		int error;
+
+		temperature_control();
+		host_plant_step(&plant);
+
+		if(t >= SETTLE){
+			error = temperature - SETPOINT;
+			if(error > r.peak || -error > r.peak){
+				r.peak = (error < 0) ? -error : error;
+			}
+			if(LATA4 && !on){
+				switches++;
+			}
+		}
+		on = LATA4;
+	}
+
+	r.hysteresis = eeprom_read_config(EEADR_SET_MENU_ITEM(hy));
+	r.delay = eeprom_read_config(EEADR_SET_MENU_ITEM(cd));
+	r.rate = switches * 3600.0 / (DURATION - SETTLE);
+	printf("hy %3d.%d -> %d.%d, cd %d, %.1f cycles per hour, peak error %d.%d\n", hysteresis / 10, hysteresis % 10,
+			r.hysteresis / 10, r.hysteresis % 10, r.delay, r.rate, r.peak / 10, r.peak % 10);
+	return r;
+}
+
+int main(void){
+	struct result fast0, slow0, fast, slow;
+
+	// Without auto tune (At = 0) and no delay, cycling too often and too seldom
+	fast0 = run(1, 0);
+	slow0 = run(TEMP_HYST_1_MAX, 0);
+	CHECK(fast0.rate > TARGET * 2);
+	CHECK(slow0.rate < TARGET / 2.0);
+
+	fast = run(1, TARGET);
+	slow = run(TEMP_HYST_1_MAX, TARGET);
+
+	// Settles within the target band from either side, by widening or narrowing hy
+	CHECK(fast.rate <= TARGET && fast.rate >= TARGET / 2.0);
+	CHECK(slow.rate <= TARGET && slow.rate >= TARGET / 2.0);
+	CHECK(fast.hysteresis > 1);
+	CHECK(slow.hysteresis < TEMP_HYST_1_MAX);
+	CHECK(slow.peak < slow0.peak);
+
+	// The delay is set to half the target period
+	CHECK(fast.delay == 30 / TARGET);
+	CHECK(slow.delay == 30 / TARGET);
+
+	if(failures){
+		printf("test_autotune: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_autotune: ok\n");
+	return 0;
+}
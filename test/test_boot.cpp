@@ -0,0 +1,340 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* The 'n' command of picprog.ino against a model of src/bootloader.asm on the ICSP pins.
+ * The model follows what the bootloader does at power on (ACK, or the CRC of the firmware),
+ * takes rows as they are clocked in and replies to each. Bits on the wire can be flipped,
+ * and the model can go dead part way through an update, as if power failed.
+ */
+
+#include "arduino_host.h"
+#include "picprog_host.cpp"
+
+enum model_state {
+	model_off,
+	model_reply,		// Two bits of reply on ICSPDAT
+	model_row,		// Taking in a row
+	model_dead,		// Power failed, until the next power on
+	model_app,		// Firmware started
+};
+
+struct boot_model {
+	unsigned int program[PROGRAM_MEMORY_WORDS];
+	unsigned char present;			// Bootloader uploaded
+	unsigned char state, reply, reply_bits;
+	unsigned char byte, bits;
+	unsigned int bytes, address, crc;
+	unsigned char row[BOOT_ROW_WORDS * 2];
+	unsigned long erased_at;		// Time the row was erased, after its address
+	unsigned int rows, acks, naks, erases, starts;
+	unsigned long short_wait;		// Rows with less than 2.5ms for an erase or write
+	// Faults
+	unsigned int flip_byte;			// Byte of the update to flip a bit of, counted from the first
+	unsigned int dead_after_rows;	// Rows taken in before power fails
+	unsigned long byte_count;
+};
+
+static boot_model boot;
+
+static unsigned int crc_byte(unsigned int crc, unsigned char data) {
+	crc ^= ((unsigned int) data) << 8;
+	for (unsigned char i = 0; i < 8; i++) {
+		crc = ((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1) & 0xffff;
+	}
+	return crc;
+}
+
+/* CRC of page 1 and then page 0 below the bootloader, as check_app works it out */
+static unsigned int boot_app_crc() {
+	unsigned int crc = 0, a = 0x0800;
+
+	while (a != BOOT_START) {
+		crc = crc_byte(crc, boot.program[a] & 0xff);
+		crc = crc_byte(crc, boot.program[a] >> 8);
+		a = (a + 1) & 0x0fff;
+	}
+	return crc;
+}
+
+static void boot_reset(unsigned char present) {
+	memset(&boot, 0, sizeof(boot));
+	for (unsigned int i = 0; i < PROGRAM_MEMORY_WORDS; i++) {
+		boot.program[i] = BLANK_WORD;
+	}
+	boot.present = present;
+	if (present) {
+		boot.program[0] = BOOT_GOTO;
+		for (unsigned int i = BOOT_START; i < BOOT_END; i++) {
+			boot.program[i] = 0x3000 | i;
+		}
+	}
+	boot.flip_byte = 0xffff;
+	boot.dead_after_rows = 0xffff;
+}
+
+static void boot_power_on() {
+	if (!boot.present) {
+		boot.state = model_off;
+		return;
+	}
+	if (host_pin[ICSPCLK].mode == OUTPUT && host_pin[ICSPCLK].level
+			&& host_pin[ICSPDAT].mode == OUTPUT && host_pin[ICSPDAT].level) {
+		boot.state = model_reply;
+		boot.reply = BOOT_ACK;
+	} else if (boot_app_crc() == 0) {
+		boot.state = model_app;
+		boot.starts++;
+	} else {
+		boot.state = model_reply;
+		boot.reply = BOOT_NAK;
+	}
+	boot.reply_bits = 0;
+}
+
+static void boot_byte_in(unsigned char data) {
+	if (boot.byte_count++ == boot.flip_byte) {
+		data ^= 0x10;
+	}
+	boot.crc = crc_byte(boot.crc, data);
+	if (boot.bytes < 2) {
+		boot.address = boot.bytes ? boot.address | (data << 8) : data;
+		if (++boot.bytes == 2) {
+			boot.erased_at = host_time_us;
+			if (boot.address < BOOT_START || boot.address >= BOOT_END) {
+				for (unsigned int i = 0; i < BOOT_ROW_WORDS; i++) {
+					boot.program[(boot.address + i) & 0x0fff] = BLANK_WORD;
+				}
+				boot.erases++;
+			}
+		}
+		return;
+	}
+	if (boot.bytes == 2 && host_time_us - boot.erased_at < 2500) {
+		boot.short_wait++;
+	}
+	if (boot.bytes < 2 + BOOT_ROW_WORDS * 2) {
+		boot.row[boot.bytes - 2] = data;
+		if (++boot.bytes == 2 + BOOT_ROW_WORDS * 2) {
+			// Written with the last word
+			boot.erased_at = host_time_us;
+			if (boot.address < BOOT_START || boot.address >= BOOT_END) {
+				for (unsigned int i = 0; i < BOOT_ROW_WORDS; i++) {
+					boot.program[(boot.address + i) & 0x0fff] = boot.row[i * 2] | ((boot.row[i * 2 + 1] & 0x3f) << 8);
+				}
+			}
+		}
+		return;
+	}
+	if (boot.bytes == 2 + BOOT_ROW_WORDS * 2 && host_time_us - boot.erased_at < 2500) {
+		boot.short_wait++;
+	}
+	if (++boot.bytes == 4 + BOOT_ROW_WORDS * 2) {
+		boot.rows++;
+		boot.reply = (boot.crc == 0 && (boot.address < BOOT_START || boot.address >= BOOT_END)) ? BOOT_ACK : BOOT_NAK;
+		boot.reply == BOOT_ACK ? boot.acks++ : boot.naks++;
+		boot.state = boot.rows == boot.dead_after_rows ? model_dead : model_reply;
+		boot.reply_bits = 0;
+	}
+}
+
+static void host_pin_changed(unsigned char pin) {
+	static unsigned char clk, powered;
+	unsigned char on = host_pin[VDD1].mode == OUTPUT && host_pin[VDD1].level
+			&& (host_pin[nMCLR].mode == INPUT || host_pin[nMCLR].level);
+
+	if (on != powered) {
+		powered = on;
+		if (on) {
+			boot_power_on();
+		} else {
+			boot.state = model_off;
+		}
+	}
+	if (pin != ICSPCLK || host_pin[ICSPCLK].level == clk) {
+		return;
+	}
+	clk = host_pin[ICSPCLK].level;
+	if (clk) {
+		return;
+	}
+	// Falling edge
+	if (boot.state == model_reply) {
+		if (++boot.reply_bits == 2) {
+			boot.state = model_row;
+			boot.bits = 0;
+			boot.bytes = 0;
+			boot.crc = 0;
+		}
+	} else if (boot.state == model_row) {
+		boot.byte |= (host_pin[ICSPDAT].level & 1) << boot.bits;
+		if (++boot.bits == 8) {
+			boot_byte_in(boot.byte);
+			boot.byte = 0;
+			boot.bits = 0;
+		}
+	}
+}
+
+static unsigned char host_pin_read(unsigned char pin) {
+	if (pin == ICSPDAT && boot.state == model_reply) {
+		return (boot.reply >> (1 - boot.reply_bits)) & 1;
+	}
+	return LOW;
+}
+
+/* Program memory as the hex data of the sketch should leave it, outside the bootloader */
+static unsigned int image[PROGRAM_MEMORY_WORDS];
+
+static void image_from_hex(PGM_P hexdata) {
+	unsigned long base = 0;
+
+	for (unsigned int i = 0; i < PROGRAM_MEMORY_WORDS; i++) {
+		image[i] = BLANK_WORD;
+	}
+	while (1) {
+		unsigned char count = hexdata[0], type = hexdata[3];
+		unsigned long address = base + ((unsigned char) hexdata[1] << 8) + (unsigned char) hexdata[2];
+
+		if (type == 1) {
+			return;
+		} else if (type == 4) {
+			base = ((unsigned long) ((unsigned char) hexdata[4] << 8) | (unsigned char) hexdata[5]) << 16;
+		} else if (type == 0) {
+			for (unsigned char i = 0; i < count; i += 2) {
+				unsigned long word = (address + i) >> 1;
+				if (word < PROGRAM_MEMORY_WORDS) {
+					image[word] = (unsigned char) hexdata[4 + i] | ((unsigned char) hexdata[5 + i] << 8);
+				}
+			}
+		}
+		hexdata += count + 5;
+	}
+}
+
+/* Firmware in place, apart from the jump in word 0 and the CRC words, bootloader untouched */
+static int updated_as_image() {
+	for (unsigned int i = 1; i < PROGRAM_MEMORY_WORDS; i++) {
+		unsigned int expect = image[i];
+		if (i >= BOOT_APP_CRC && i < BOOT_START) {
+			continue;
+		}
+		if (i >= BOOT_START && i < BOOT_END) {
+			expect = 0x3000 | i;
+		}
+		if (boot.program[i] != expect) {
+			printf("word 0x%X is 0x%X, not 0x%X\n", i, boot.program[i], expect);
+			return 0;
+		}
+	}
+	return boot.program[0] == BOOT_GOTO;
+}
+
+static void command(char c, const std::string &input = "") {
+	host_serial_in = c + input;
+	host_serial_out.clear();
+	loop();
+}
+
+static int output_has(const char *s) {
+	return host_serial_out.find(s) != std::string::npos;
+}
+
+static int failures;
+
+#define CHECK(cond)	do { if(!(cond)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+int main(void) {
+	unsigned long start;
+
+	image_from_hex(hex_celsius);
+	setup();
+
+	// From blank, every row but those of the bootloader acknowledged, and the firmware starts
+	boot_reset(1);
+	start = host_time_us;
+	command('n');
+	CHECK(output_has("Firmware updated."));
+	CHECK(updated_as_image());
+	CHECK(boot_app_crc() == 0);
+	CHECK(boot.starts == 1);
+	CHECK(boot.rows == BOOT_ROWS - (BOOT_END - BOOT_START) / BOOT_ROW_WORDS);
+	CHECK(boot.naks == 0 && boot.erases == boot.rows);
+	CHECK(boot.short_wait == 0);
+	printf("update: %u rows in %lums\n", boot.rows, (host_time_us - start) / 1000);
+
+	// A bit flipped on the wire is NAKed, and the row is sent again
+	boot_reset(1);
+	boot.flip_byte = 10 * (4 + BOOT_ROW_WORDS * 2) + 20;
+	command('n');
+	CHECK(boot.naks == 1);
+	CHECK(output_has("x."));
+	CHECK(output_has("Firmware updated."));
+	CHECK(updated_as_image());
+	CHECK(boot.starts == 1);
+
+	// A flipped bit in the CRC itself as well
+	boot_reset(1);
+	boot.flip_byte = 3 + BOOT_ROW_WORDS * 2;
+	command('n');
+	CHECK(boot.naks == 1);
+	CHECK(output_has("Firmware updated."));
+	CHECK(updated_as_image());
+
+	// Power fails half way, the half written firmware does not start
+	boot_reset(1);
+	boot.dead_after_rows = BOOT_ROWS / 2;
+	command('n');
+	CHECK(output_has("Update failed"));
+	CHECK(!output_has("Firmware updated."));
+	CHECK(boot_app_crc() != 0);
+	pinMode(VDD1, OUTPUT);
+	digitalWrite(VDD1, HIGH);
+	CHECK(boot.state == model_reply && boot.reply == BOOT_NAK);
+	p_exit();
+	// and the next update puts it right
+	command('n');
+	CHECK(output_has("Firmware updated."));
+	CHECK(updated_as_image());
+	CHECK(boot.starts == 1);
+
+	// Old firmware, with a few words changed that the update puts back
+	boot.program[0x0100] ^= 0x0001;
+	boot.program[0x0900] = 0x0000;
+	command('n');
+	CHECK(output_has("Firmware updated."));
+	CHECK(updated_as_image());
+
+	// Without a bootloader nothing is sent
+	boot_reset(0);
+	command('n');
+	CHECK(output_has("No bootloader, upload it with 'u' first."));
+	CHECK(boot.rows == 0);
+	CHECK(host_pin[ICSPDAT].mode == INPUT && host_pin[VDD1].mode == INPUT);
+
+	if (failures) {
+		printf("test_boot: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_boot: ok\n");
+	return 0;
+}
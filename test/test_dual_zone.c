@@ -0,0 +1,166 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Dual zone (DUAL_ZONE, Pb = 2) on two vessels of the fermenter model in host.h, one heated on
+ * probe 1 and one cooled on probe 2: each relay switches on its own probe and setpoint only,
+ * and keeps its own delay, whatever the other relay does.
+ */
+
+#include "host.h"
+
+#define SETPOINT	200
+#define SETPOINT2	100
+#define HYSTERESIS2	10
+#define HEAT_DELAY	15		// Minutes, long enough to hold either relay off
+#define COOL_DELAY	12
+#define SETTLE		(2L * 3600)
+#define DURATION	(12L * 3600)
+
+struct zone {
+	unsigned int cycles;		// Relay switched on
+	unsigned int wrong;			// Switched on or off when its own probe says otherwise
+	unsigned int shortest_off;	// Shortest time off between on times
+	int peak;					// Largest error on its own probe, once settled
+};
+
+/* Follow one relay for a second, as the firmware just left it
+ * arguments: zone, relay now, relay before, temperature the relay was switched on, setpoint,
+ * 		hysteresis, direction (1 heating, -1 cooling), seconds off, time
+ */
+static void zone_update(struct zone *z, unsigned char on, unsigned char was, int temp, int sp, int hyst,
+						int dir, unsigned int *off, long t){
+	int error = dir * (sp - temp);
+
+	if(on && !was){
+		z->cycles++;
+		if(error <= hyst){
+			z->wrong++;
+		}
+		if(z->cycles > 1 && *off < z->shortest_off){
+			z->shortest_off = *off;
+		}
+	} else if(!on && was){
+		if(error > 0){
+			z->wrong++;
+		}
+		*off = 0;
+	}
+	if(!on){
+		(*off)++;
+	}
+	if(t >= SETTLE){
+		error = temp - sp;
+		if(error > z->peak || -error > z->peak){
+			z->peak = (error < 0) ? -error : error;
+		}
+	}
+}
+
+int main(void){
+	// Vessel in a cold room to be heated, and one in a warm room to be cooled
+	struct host_plant vessel = { 150, 0, 150, 0.1, 0, 120, 2000 };
+	struct host_plant vessel2 = { 250, 0, 250, 0, 0.2, 120, 2000 };
+	struct zone heat = { 0, 0, 0xffff, 0 }, cool = { 0, 0, 0xffff, 0 };
+	unsigned int heat_off = 0, cool_off = 0, both = 0;
+	int hysteresis;
+	unsigned char heat_was = 0, cool_was = 0;
+	unsigned int n;
+	long t;
+
+	host_eeprom_defaults();
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Pb), PROBE2_DUAL_ZONE);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP), SETPOINT);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP2), SETPOINT2);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hy2), HYSTERESIS2);
+	hysteresis = eeprom_read_config(EEADR_SET_MENU_ITEM(hy));
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hd), HEAT_DELAY);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(cd), COOL_DELAY);
+	LATA4 = LATA5 = 0;
+	cooling_delay = heating_delay = 0;
+	temperature = vessel.beer;
+	temperature2 = vessel2.beer;
+
+	for(t=0; t<DURATION; t++){
+		temperature_control();
+		zone_update(&heat, LATA5, heat_was, temperature, SETPOINT, hysteresis, 1, &heat_off, t);
+		zone_update(&cool, LATA4, cool_was, temperature2, SETPOINT2, HYSTERESIS2, -1, &cool_off, t);
+		heat_was = LATA5;
+		cool_was = LATA4;
+		if(LATA4 && LATA5){
+			both++;
+		}
+
+		host_plant_step(&vessel2);
+		temperature2 = temperature;
+		host_plant_step(&vessel);
+	}
+
+	printf("heating: %u cycles, shortest off %us, peak error %d.%d\n", heat.cycles, heat.shortest_off, heat.peak / 10, heat.peak % 10);
+	printf("cooling: %u cycles, shortest off %us, peak error %d.%d\n", cool.cycles, cool.shortest_off, cool.peak / 10, cool.peak % 10);
+	printf("both on %lus\n", (unsigned long)both);
+
+	// Both relays cycle, each on its own probe and setpoint, at the same time now and then
+	CHECK(heat.cycles >= 10 && cool.cycles >= 10);
+	CHECK(heat.wrong == 0);
+	CHECK(cool.wrong == 0);
+	CHECK(both > 0);
+	// Held within a few degrees of its own setpoint, 10 degrees from the other one
+	CHECK(heat.peak <= 50);
+	CHECK(cool.peak <= 50);
+
+	// Each relay stays off for its own delay, which is what holds it off for the longest
+	CHECK(heat.shortest_off == HEAT_DELAY * 60);
+	CHECK(cool.shortest_off == COOL_DELAY * 60);
+
+	// Cooling switching off leaves the heating delay alone, and the other way around
+	LATA4 = 1;
+	LATA5 = 0;
+	cooling_delay = heating_delay = 0;
+	temperature = SETPOINT - hysteresis - 1;
+	temperature2 = SETPOINT2;
+	temperature_control();
+	CHECK(LATA4 == 0 && LATA5 == 1);
+	CHECK(cooling_delay == COOL_DELAY * 60 && heating_delay == 0);
+
+	cooling_delay = 0;
+	temperature = SETPOINT;
+	temperature2 = SETPOINT2 + HYSTERESIS2 + 1;
+	temperature_control();
+	CHECK(LATA4 == 1 && LATA5 == 0);
+	CHECK(heating_delay == HEAT_DELAY * 60 && cooling_delay == 0);
+
+	// Heating comes back on after exactly hd minutes, while cooling stays on
+	temperature = SETPOINT - hysteresis - 1;
+	for(n=0; !LATA5 && n<HEAT_DELAY*60+10; n++){
+		temperature_control();
+	}
+	CHECK(n == HEAT_DELAY * 60);
+	CHECK(LATA4 == 1);
+
+	if(failures){
+		printf("test_dual_zone: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_dual_zone: ok\n");
+	return 0;
+}
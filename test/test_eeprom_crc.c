@@ -0,0 +1,150 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* EEPROM CRC (EEPROM_CRC): the CRC of each block (profile or set menu) follows every write,
+ * and at power on only a block that does not match is recovered. A torn write, where power
+ * fails after the data and before the CRC is written, is made by changing a byte behind the
+ * back of the firmware.
+ */
+
+#include "host.h"
+
+/* Set menu defaults in Celsius and Fahrenheit, as in stc1000p.h */
+#define DEFAULT_C(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf)	dvc,
+#define DEFAULT_F(name, led10ch, led1ch, led01ch, type, minv, maxv, dvc, dvf)	dvf,
+static const short default_c[] = { SET_MENU_DATA(DEFAULT_C) };
+static const short default_f[] = { SET_MENU_DATA(DEFAULT_F) };
+
+static unsigned int block_crc(unsigned char block){
+	unsigned int crc = 0, i, b;
+	unsigned int start = block * PROFILE_BYTES;
+	unsigned int end = block == CRC_BLOCK_SET_MENU ? EEPROM_CRC_SET_MENU_END : start + PROFILE_BYTES;
+
+	for(i=start; i<end; i++){
+		crc ^= host_eeprom[i] << 8;
+		for(b=0; b<8; b++){
+			crc = ((crc & 0x8000) ? ((crc << 1) ^ EEPROM_CRC_POLY) : (crc << 1)) & 0xffff;
+		}
+	}
+	return crc;
+}
+
+/* Every stored CRC matches its block */
+static int crc_ok(void){
+	unsigned char block;
+
+	for(block=0; block<=CRC_BLOCK_SET_MENU; block++){
+		if((unsigned short)eeprom_read_config(EEADR_CRC(block)) != block_crc(block)){
+			printf("block %d: stored %04x, calculated %04x\n", block,
+					(unsigned short)eeprom_read_config(EEADR_CRC(block)), block_crc(block));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* A torn write of the byte at a config address */
+static void tear(unsigned char eeprom_address){
+	host_eeprom[eeprom_byte_address(eeprom_address)] ^= 0x01;
+}
+
+int main(void){
+	static unsigned char saved[256];
+	unsigned long rnd = 1;
+	unsigned int n;
+	unsigned char i;
+
+	// Unset CRCs are calculated at first power on, and nothing else changes
+	host_eeprom_defaults();
+	memcpy(saved, host_eeprom, sizeof(saved));
+	CHECK((unsigned short)eeprom_read_config(EEADR_CRC(0)) == EEPROM_CRC_UNSET);
+	eeprom_check_crc();
+	CHECK(crc_ok());
+	CHECK(memcmp(saved, host_eeprom, EEPROM_CRC_SET_MENU_END) == 0);
+
+	// The CRC follows writes to profiles and set menu
+	for(n=0; n<2000; n++){
+		unsigned char block, adr;
+		rnd = (rnd * 1103515245UL + 12345UL) & 0x7fffffffUL;
+		block = (rnd >> 8) % (CRC_BLOCK_SET_MENU + 1);
+		// Any profile item, or any set menu item but the power on state
+		adr = block < CRC_BLOCK_SET_MENU ? EEADR_PROFILE_SETPOINT(block, 0) + (rnd >> 12) % 19 :
+				EEADR_SET_MENU_ITEM((rnd >> 12) % (SET_MENU_WORDS - 1));
+		eeprom_write_config(adr, (rnd >> 16) % 100);
+		if(!crc_ok()){
+			printf("after writing %d at %d\n", (int)((rnd >> 16) % 100), adr);
+			failures++;
+			break;
+		}
+	}
+	eeprom_write_config(EEADR_SET_MENU_ITEM(hy), 7);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(rn), 1);
+
+	// A torn write in a profile that is not running is left alone
+	tear(EEADR_PROFILE_SETPOINT(2, 3));
+	memcpy(saved, host_eeprom, sizeof(saved));
+	eeprom_check_crc();
+	CHECK(crc_ok());
+	CHECK(eeprom_read_config(EEADR_SET_MENU_ITEM(rn)) == 1);
+	CHECK(memcmp(saved, host_eeprom, EEPROM_CRC_SET_MENU_END) == 0);
+
+	// A torn write in the running profile runs thermostat mode, the rest of the set menu stays
+	tear(EEADR_PROFILE_DURATION(1, 4));
+	memcpy(saved, host_eeprom, sizeof(saved));
+	eeprom_check_crc();
+	CHECK(crc_ok());
+	CHECK(eeprom_read_config(EEADR_SET_MENU_ITEM(rn)) == THERMOSTAT_MODE);
+	CHECK(eeprom_read_config(EEADR_SET_MENU_ITEM(hy)) == 7);
+	CHECK(memcmp(saved, host_eeprom, EEPROM_SET_MENU_BYTE) == 0);
+
+	// A torn write in the set menu restores its defaults, but keeps the power on state and the profiles
+	eeprom_write_config(EEADR_POWER_ON, 0);
+	memcpy(saved, host_eeprom, sizeof(saved));
+	tear(EEADR_SET_MENU_ITEM(hy));
+	eeprom_check_crc();
+	CHECK(crc_ok());
+	for(i=0; i<SET_MENU_WORDS-1; i++){
+		CHECK(eeprom_read_config(EEADR_SET_MENU_ITEM(i)) == default_c[i]);
+	}
+	CHECK(eeprom_read_config(EEADR_POWER_ON) == 0);
+	CHECK(memcmp(saved, host_eeprom, EEPROM_SET_MENU_BYTE) == 0);
+
+#ifdef UNIT_MENU
+	// The defaults are in the unit in use
+	eeprom_write_config(EEADR_POWER_ON, FAHRENHEIT_BIT | POWER_ON_BIT);
+	tear(EEADR_SET_MENU_ITEM(SP));
+	eeprom_check_crc();
+	CHECK(crc_ok());
+	for(i=0; i<SET_MENU_WORDS-1; i++){
+		CHECK(eeprom_read_config(EEADR_SET_MENU_ITEM(i)) == default_f[i]);
+	}
+	CHECK(eeprom_read_config(EEADR_POWER_ON) == (FAHRENHEIT_BIT | POWER_ON_BIT));
+#endif
+
+	if(failures){
+		printf("test_eeprom_crc: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_eeprom_crc: ok\n");
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Probe filter (FILTER): step response and spike rejection of read_ad() for some Fn and Ft,
+ * on an AD trace with a step, a little noise and a full scale spike now and then (as when
+ * a relay switches). Fn = 0 and Ft = 6 has to give the filter of the standard build.
+ */
+
+#include "host.h"
+
+#define TRACE_SAMPLES		600
+#define TRACE_STEP_AT		200
+#define TRACE_LOW			500
+#define TRACE_HIGH			600
+#define TRACE_SPIKE_EVERY	37
+
+static unsigned int trace[TRACE_SAMPLES];
+
+/* The step with noise, and with spikes if spikes is set */
+static void make_trace(unsigned char spikes){
+	unsigned long rnd = 1;
+	unsigned int i;
+
+	for(i=0; i<TRACE_SAMPLES; i++){
+		rnd = (rnd * 1103515245UL + 12345UL) & 0x7fffffffUL;
+		trace[i] = (i < TRACE_STEP_AT ? TRACE_LOW : TRACE_HIGH) + ((rnd >> 16) % 3) - 1;
+		if(spikes && i % TRACE_SPIKE_EVERY == TRACE_SPIKE_EVERY - 1){
+			trace[i] = (i & 0x1) ? 1023 : 0;
+		}
+	}
+}
+
+/* Run the trace through read_ad(), starting settled at TRACE_LOW, the filter values go in out */
+static void filter_trace(unsigned int *out){
+	unsigned int ad_filter = TRACE_LOW << 6, i;
+
+	for(i=0; i<FILTER_TAPS_MAX; i++){
+		ad_samples[i] = TRACE_LOW;
+	}
+	for(i=0; i<TRACE_SAMPLES; i++){
+		host_ad[0] = host_ad[1] = host_ad[2] = host_ad[3] = trace[i];
+		out[i] = ad_filter = read_ad(ad_filter, ad_samples);
+	}
+}
+
+struct result {
+	unsigned int rise;		// Samples after the step to get 90% of the way, without spikes
+	unsigned int error;		// Largest error with spikes, outside the step, in AD counts
+};
+
+static struct result run(unsigned char fn, unsigned char ft){
+	static unsigned int out[TRACE_SAMPLES];
+	struct result r = { 0, 0 };
+	unsigned int i;
+
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Fn), fn);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Ft), ft);
+
+	make_trace(0);
+	filter_trace(out);
+	for(i=TRACE_STEP_AT; i<TRACE_SAMPLES && r.rise == 0; i++){
+		if((out[i] >> 6) >= TRACE_LOW + (TRACE_HIGH - TRACE_LOW) * 9 / 10){
+			r.rise = i - TRACE_STEP_AT + 1;
+		}
+	}
+
+	make_trace(1);
+	filter_trace(out);
+	for(i=0; i<TRACE_SAMPLES; i++){
+		unsigned int value = out[i] >> 6, target = i < TRACE_STEP_AT ? TRACE_LOW : TRACE_HIGH, error;
+
+		// Errors while settling after the step are not from spikes
+		if(i < TRACE_STEP_AT || i >= TRACE_STEP_AT + 2 * r.rise){
+			error = value > target ? value - target : target - value;
+			if(error > r.error){
+				r.error = error;
+			}
+		}
+	}
+
+	printf("Fn %d Ft %d: 90%% of step in %3u samples (%5u ms), largest error with spikes %3u counts\n",
+			fn, ft, r.rise, r.rise * 120, r.error);
+	return r;
+}
+
+int main(void){
+	static unsigned int filtered[TRACE_SAMPLES];
+	struct result slow, fast, fast3, fast5, fastest5;
+	unsigned int ad_filter = TRACE_LOW << 6, i;
+
+	host_eeprom_defaults();
+
+	// Fn 0, Ft 6 is the 1/64 filter of the standard build, sample for sample
+	slow = run(0, 6);
+	filter_trace(filtered);
+	for(i=0; i<TRACE_SAMPLES; i++){
+		ad_filter = (ad_filter - (ad_filter >> 6)) + trace[i];
+		CHECK(filtered[i] == ad_filter);
+	}
+
+	fast = run(0, 4);
+	fast3 = run(1, 4);
+	fast5 = run(2, 4);
+	fastest5 = run(2, 2);
+
+	// A shorter time constant follows the step several times faster
+	CHECK(fast.rise * 3 <= slow.rise);
+	CHECK(fastest5.rise * 3 <= fast5.rise);
+
+	// Without the median, spikes get into the filter, the faster it is the more
+	CHECK(fast.error > slow.error);
+	CHECK(fast.error > 10);
+
+	// With the median, single spikes are gone and only the noise is left
+	CHECK(fast3.error <= 2);
+	CHECK(fast5.error <= 2);
+	CHECK(fastest5.error <= 2);
+
+	// The median delays the step by at most half its samples
+	CHECK(fast3.rise <= fast.rise + 1);
+	CHECK(fast5.rise <= fast.rise + 2);
+
+	if(failures){
+		printf("test_filter: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_filter: ok\n");
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Random button sequences through the menu FSM. After every tick, the menu state and
+ * all values in EEPROM have to be in range, and the FSM has to go back to idle when
+ * the buttons are left alone. Built with the address sanitizer (see Makefile), so an
+ * index out of led_lookup or setmenu stops the test as well.
+ *
+ * usage: test_fsm_fuzz [sequences [seed]]
+ */
+
+#include "host.h"
+
+static unsigned long rnd_state;
+
+static unsigned long rnd(void){
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state & 0xffffffffUL;
+}
+
+/* Buttons a user might hold, single buttons more often than combinations */
+static const unsigned char buttons[] = {
+	0, 0, 0, BTN_S, BTN_S, BTN_UP, BTN_UP, BTN_UP, BTN_DOWN, BTN_DOWN, BTN_DOWN, BTN_PWR,
+	BTN_UP | BTN_DOWN, BTN_S | BTN_UP, BTN_S | BTN_DOWN, BTN_PWR | BTN_S,
+};
+
+static unsigned long failed_at;
+
+static int in_range(int value, int min, int max, unsigned char type){
+#ifdef UNIT_MENU
+	// Limits are in Celsius
+	if(UNIT_IS_FAHRENHEIT()){
+		min = convert_temperature(min, type, 1);
+		max = convert_temperature(max, type, 1);
+	}
+#endif
+	return value >= min && value <= max;
+}
+
+/* Everything the menu can write to EEPROM is within the limits of its item (int is 16 bits in the firmware) */
+static int eeprom_ok(void){
+	unsigned char p, i;
+
+	for(p=0; p<NO_OF_PROFILES; p++){
+		for(i=0; i<19; i++){
+			short value = eeprom_read_config(EEADR_PROFILE_SETPOINT(p, 0) + i);
+			if((i & 0x1) ? !in_range(value, 0, 999, type_hours) : !in_range(value, TEMP_MIN, TEMP_MAX, type_temp)){
+				printf("Pr%d item %d = %d\n", p, i, value);
+				return 0;
+			}
+		}
+	}
+	for(i=0; i<SET_MENU_SIZE; i++){
+		short value = eeprom_read_config(EEADR_SET_MENU_ITEM(i));
+#ifdef UNIT_MENU
+		if(EEADR_SET_MENU_ITEM(i) == EEADR_POWER_ON){
+			value = IS_FAHRENHEIT(value);
+		}
+#endif
+		if(!in_range(value, setmenu[i].min, setmenu[i].max, setmenu[i].type)){
+			printf("set menu item %d = %d\n", i, value);
+			return 0;
+		}
+	}
+	return (eeprom_read_config(EEADR_POWER_ON) & ~0x3) == 0;
+}
+
+/* The menu state is one the FSM knows, and indexes the menus it is in */
+static int state_ok(void){
+	if(state >= state_up_pressed || menu_item > LAST_MENU_ITEM_NO || countdown > 110 || PR6 < 26 || PR6 > 250){
+		return 0;
+	}
+	if(state >= state_show_config_item && state <= state_set_config_value){
+		if(menu_item < SET_MENU_ITEM_NO){
+			return config_item < 19;
+		}
+		if(config_item >= SET_MENU_SIZE){
+			return 0;
+		}
+		// St and dh are skipped when not running a profile
+		if(state == state_set_config_item && (config_item == St || config_item == dh)){
+			return (unsigned char)eeprom_read_config(EEADR_SET_MENU_ITEM(rn)) < THERMOSTAT_MODE;
+		}
+	}
+	return 1;
+}
+
+static void fail(const char *what, unsigned long seq){
+	printf("sequence %lu: %s, state %d, menu %d, item %d, value %d\n",
+			seq, what, state, menu_item, config_item, config_value);
+	failures++;
+	failed_at = seq;
+}
+
+int main(int argc, char *argv[]){
+	unsigned long sequences = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+	unsigned long seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+	unsigned long seq, ticks = 0;
+
+	rnd_state = seed ? seed : 1;
+	host_eeprom_defaults();
+	PR6 = 250;
+
+	for(seq=0; seq<sequences && !failures; seq++){
+		unsigned int presses = 1 + rnd() % 100, n, t;
+		// Each sequence favours one of the buttons, to walk far through a menu now and then
+		unsigned char favourite = buttons[rnd() % sizeof(buttons)];
+
+		// Start powered on, in any of the menus (the FSM keeps menu_item between visits) and
+		// any run mode, to get deep into each menu more often than by pressing buttons alone
+		menu_item = rnd() % (LAST_MENU_ITEM_NO + 1);
+		eeprom_write_config(EEADR_POWER_ON, eeprom_read_config(EEADR_POWER_ON) | POWER_ON_BIT);
+		eeprom_write_config(EEADR_SET_MENU_ITEM(rn), rnd() % (THERMOSTAT_MODE + 1));
+
+		for(n=0; n<presses && !failures; n++){
+			unsigned char btn = (rnd() & 1) ? favourite : buttons[rnd() % sizeof(buttons)];
+			// Mostly short presses, now and then long enough for power off or fast stepping
+			unsigned int hold = (rnd() % 16) ? 1 + rnd() % 4 : 1 + rnd() % 200;
+			// Usually let go before the next press, so pressing the same button again counts
+			unsigned int gap = rnd() % 3;
+
+			for(t=0; t<hold+gap; t++, ticks++){
+				host_tick(t < hold ? btn : 0);
+				if(!state_ok()){
+					fail("menu state out of range", seq);
+					break;
+				}
+			}
+			if(!failures && !eeprom_ok()){
+				fail("EEPROM value out of range", seq);
+			}
+		}
+
+		// Left alone, the menu times out
+		for(t=0; t<120 && !failures; t++, ticks++){
+			host_tick(0);
+		}
+		if(!failures && (state != state_idle || PR6 != 250)){
+			fail("no timeout", seq);
+		}
+	}
+
+	printf("%lu sequences, %lu ticks, seed %lu\n", seq, ticks, seed);
+	if(failures){
+		printf("test_fsm_fuzz: failed, repeat with: test_fsm_fuzz %lu %lu\n", failed_at + 1, seed);
+		return 1;
+	}
+	printf("test_fsm_fuzz: ok\n");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Health counters (HEALTH): Lt, Et and the late tick counts from Timer1, across Timer1
+ * wraps. Times of a full Timer1 period (~524ms) or more have to read as 0xffff, not as what
+ * is left after the last wrap, whether or not the ISR has counted the overflow yet.
+ */
+
+#include "host.h"
+
+/* Set Timer1 */
+static void tmr1(unsigned int ticks){
+	TMR1H = ticks >> 8;
+	TMR1L = ticks & 0xff;
+}
+
+/* Timer1 overflows, wraps of them counted by the ISR and the last one left pending if pending */
+static void overflow(unsigned char wraps, unsigned char pending){
+	while(wraps--){
+		TMR1IF = 1;
+		if(wraps || !pending){
+			interrupt_service_routine();
+		}
+	}
+}
+
+/* Longest time kept by health_max() from start, with wraps Timer1 overflows until end */
+static unsigned int measure(unsigned int start, unsigned char wraps, unsigned char pending, unsigned int end){
+	unsigned int s;
+	unsigned char s_wraps;
+
+	health[Lt] = 0;
+	TMR1IF = 0;
+	tmr1(start);
+	s = health_now();
+	s_wraps = health_now_wraps;
+	overflow(wraps, pending);
+	tmr1(end);
+	health_max(Lt, s, s_wraps);
+	return health[Lt];
+}
+
+int main(){
+	unsigned char i;
+
+	host_eeprom_defaults();
+	init();
+
+	// No wrap
+	CHECK(measure(0x1000, 0, 0, 0x1400) == 0x400);
+	// One wrap, counted by the ISR or still pending
+	CHECK(measure(0xff00, 1, 0, 0x0100) == 0x200);
+	CHECK(measure(0xff00, 1, 1, 0x0100) == 0x200);
+	CHECK(measure(0x1000, 1, 0, 0x0800) == 0xf800);
+	// A full period or more saturates
+	CHECK(measure(0x1000, 1, 0, 0x1000) == 0xffff);
+	CHECK(measure(0x1000, 1, 1, 0x2000) == 0xffff);
+	CHECK(measure(0x1000, 2, 0, 0x0800) == 0xffff);
+	CHECK(measure(0x8000, 5, 1, 0x0000) == 0xffff);
+	// Timer1 read just before it overflowed, the pending flag is not for this read
+	TMR1IF = 0;
+	tmr1(0xfff0);
+	health_now();
+	i = health_now_wraps;
+	TMR1IF = 1;
+	tmr1(0xfffe);
+	CHECK(health_now() == 0xfffe && health_now_wraps == i);
+	interrupt_service_routine();
+	CHECK(TMR1IF == 0 && health_wraps == (unsigned char)(i + 1));
+
+	// Late t4 ticks, on time only if less than HEALTH_T4_LATE ticks apart in total
+	TMR1IF = 0;
+	health[t4] = 0;
+	health_sync |= 0x1;
+	tmr1(0x2000);
+	health_tick(t4, HEALTH_T4_LATE);
+	tmr1(0x2000 + 7500);
+	health_tick(t4, HEALTH_T4_LATE);
+	CHECK(health[t4] == 0);
+	// A tick that comes a Timer1 period later looks on time without the wraps
+	overflow(1, 0);
+	tmr1(0x2000 + 7500 + 100);
+	health_tick(t4, HEALTH_T4_LATE);
+	CHECK(health[t4] == 1);
+	overflow(1, 1);
+	tmr1(0x2000 + 7500 + 50);
+	health_tick(t4, HEALTH_T4_LATE);
+	CHECK(health[t4] == 2);
+
+	if(failures){
+		printf("test_health: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_health: ok\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Temperature history (HISTORY) with the temperature unit menu (UNIT_MENU): the ring of buckets
+ * takes the EEPROM the profiles leave, buckets are written in turn with a count of how many have
+ * been written, and changing the unit converts written buckets only.
+ */
+
+#include "host.h"
+
+/* Run the history for an hour at a temperature, with the heating relay on for the first minutes
+ * arguments: temperature, minutes of heating
+ */
+static void hour(int temp, unsigned int minutes){
+	unsigned int i;
+
+	temperature = temp;
+	for(i=0; i<HISTORY_HOUR; i++){
+		LATA5 = (i < minutes * 125 / 2);
+		update_history();
+	}
+	LATA5 = 0;
+}
+
+static unsigned char written(void){
+	return eeprom_read_config(EEADR_HISTORY_LATEST) >> 8;
+}
+
+int main(void){
+	unsigned int used = EEPROM_SET_MENU_BYTE + (EEPROM_WORD_ITEMS << 1);
+	unsigned char b, n;
+
+	printf("%d profiles, %d hours of history, %u of %d bytes of EEPROM used\n", NO_OF_PROFILES, HISTORY_HOURS,
+			used + OSC_CAL_BYTES, 256);
+
+	// At least the minimum, and the rest of EEPROM has no room for another bucket
+	CHECK(HISTORY_HOURS >= HISTORY_MIN_HOURS && HISTORY_HOURS <= HISTORY_MAX_HOURS);
+	CHECK(used + OSC_CAL_BYTES <= 256);
+	CHECK(HISTORY_HOURS == HISTORY_MAX_HOURS || 256 - (used + OSC_CAL_BYTES) < 8);
+	// Without the history the same number of profiles would fit
+	CHECK(EEPROM_PROFILES_FIT >= NO_OF_PROFILES);
+
+	host_eeprom_defaults();
+	history_latest = 0;
+	history_time = 0;
+	CHECK(written() == 0);
+
+	// Two hours, written to the buckets after the latest one
+	hour(200, 6);
+	hour(-55, 0);
+	CHECK(history_latest == 2);
+	CHECK(written() == 2);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_min)) == 200);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_avg)) == 200);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_relays)) == (6 << 8));
+	CHECK((short)eeprom_read_config(EEADR_HISTORY(2, hist_max)) == -55);
+
+	// To Fahrenheit, the written buckets are converted and the others are left at 0
+	convert_config_unit(1);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_min)) == 680);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_max)) == 680);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_avg)) == 680);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_relays)) == (6 << 8));
+	CHECK(eeprom_read_config(EEADR_HISTORY(2, hist_avg)) == 221);
+	for(b=0; b<HISTORY_HOURS; b++){
+		if(b == 1 || b == 2){
+			continue;
+		}
+		for(n=hist_min; n<=hist_relays; n++){
+			CHECK(eeprom_read_config(EEADR_HISTORY(b, n)) == 0);
+		}
+	}
+	CHECK(written() == 2);
+
+	// And back
+	convert_config_unit(0);
+	CHECK(eeprom_read_config(EEADR_HISTORY(1, hist_avg)) == 200);
+	CHECK((short)eeprom_read_config(EEADR_HISTORY(2, hist_avg)) == -55);
+	CHECK(eeprom_read_config(EEADR_HISTORY(0, hist_avg)) == 0);
+
+	// Around the ring, the count stops at the number of buckets and all of them are converted
+	for(n=0; n<HISTORY_HOURS; n++){
+		hour(100 + n, 0);
+	}
+	CHECK(history_latest == (2 + HISTORY_HOURS) % HISTORY_HOURS);
+	CHECK(written() == HISTORY_HOURS);
+	convert_config_unit(1);
+	for(b=0; b<HISTORY_HOURS; b++){
+		CHECK(eeprom_read_config(EEADR_HISTORY(b, hist_min)) != 0);
+	}
+	CHECK(eeprom_read_config(EEADR_HISTORY(history_latest, hist_avg)) == convert_temperature(100 + HISTORY_HOURS - 1, type_temp, 1));
+
+	if(failures){
+		printf("test_history: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_history: ok\n");
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Oscillator calibration (OSC_CAL): init() only drives ICSPCLK (RA1) when picprog holds it high
+ * at power on and probe 2 is not in use. It is then held high, toggled every ms by the Timer2
+ * interrupt for the calibration signal, and an input again after.
+ */
+
+#include "host.h"
+
+/* Power on with ICSPCLK at level, probe 2 setting pb, and the calibration word ticks */
+static void power_on(unsigned char level, unsigned char pb, unsigned int ticks){
+	host_eeprom_defaults();
+	host_eeprom[EEPROM_OSC_CAL_BYTE] = ticks & 0xff;
+	host_eeprom[EEPROM_OSC_CAL_BYTE + 1] = ticks >> 8;
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Pb), pb);
+	hour_ticks = TICKS_PER_HOUR;
+	osc_cal_ms = 0;
+	TRISA1 = 1;
+	LATA1 = 0;
+	RA1 = level;
+	init();
+}
+
+/* Timer2 interrupts for ms, the number of edges on a driven RA1 goes in edges */
+static unsigned int isr_ms(unsigned int ms){
+	unsigned int edges = 0, i;
+	unsigned char last = LATA1;
+
+	for(i=0; i<ms; i++){
+		TMR2IF = 1;
+		interrupt_service_routine();
+		if(!TRISA1 && LATA1 != last){
+			edges++;
+		}
+		last = LATA1;
+	}
+	return edges;
+}
+
+int main(void){
+	// Normal power on, with the probe input open (reads low) or a calibration already there
+	power_on(0, 0, 0xffff);
+	CHECK(TRISA1 == 1 && osc_cal_ms == 0);
+	CHECK(isr_ms(OSC_CAL_HOLD_MS + OSC_CAL_MS) == 0 && TRISA1 == 1);
+	power_on(0, 0, 61000);
+	CHECK(TRISA1 == 1 && hour_ticks == 61000);
+
+	// Probe 2 in use, a hot probe (or picprog) holding RA1 high is not a request
+	power_on(1, 1, 0xffff);
+	CHECK(TRISA1 == 1 && osc_cal_ms == 0);
+
+	// Requested: held high along with picprog, then the signal, then an input again
+	power_on(1, 0, 61000);
+	CHECK(TRISA1 == 0 && LATA1 == 1 && hour_ticks == 61000);
+	CHECK(isr_ms(OSC_CAL_HOLD_MS) == 0 && TRISA1 == 0 && LATA1 == 1);
+	CHECK(isr_ms(OSC_CAL_MS - 1) == OSC_CAL_MS - 1 && TRISA1 == 0);
+	isr_ms(1);
+	CHECK(TRISA1 == 1 && osc_cal_ms == 0);
+	CHECK(isr_ms(100) == 0 && TRISA1 == 1);
+	CHECK(ANSA1 == 1);
+
+	if(failures){
+		printf("test_osc_cal: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_osc_cal: ok\n");
+	return 0;
+}
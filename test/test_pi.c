@@ -0,0 +1,147 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* PI control (PI_CONTROL) against the thermostat, on the same fermenter: settling without
+ * wind up, error and relay cycles once settled, and relay on and off times no shorter than
+ * PI_MIN_ON or the cooling and heating delays.
+ */
+
+#include "host.h"
+
+struct result {
+	int overshoot;			// Furthest above the setpoint, after first reaching it
+	int peak;				// Largest error either way, once settled
+	double mean;			// Average error, once settled
+	unsigned int switches;	// Relay switched on, once settled
+	unsigned int shortest;	// Shortest time a relay was on
+	unsigned int shortest_off;	// Shortest time between relay on times
+};
+
+#define SETPOINT	200
+#define SETTLE		(6L * 3600)
+#define DURATION	(24L * 3600)
+
+/* Run the fermenter for DURATION seconds
+ * arguments: 1 for PI control, cooling and heating delay in minutes (0 keeps the defaults)
+ */
+static struct result run(unsigned char pi_mode, unsigned char delay){
+	struct host_plant plant = { 150, 0, 150, 0.03, 0.05, 300, 20000 };
+	struct result r = { 0, 0, 0, 0, 0xffff, 0xffff };
+	unsigned char on = 0, reached = 0, cycled = 0;
+	unsigned int on_time = 0, off_time = 0;
+	double sum = 0;
+	long t;
+
+	host_eeprom_defaults();
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP), SETPOINT);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Pn), pi_mode);
+	if(delay){
+		eeprom_write_config(EEADR_SET_MENU_ITEM(cd), delay);
+		eeprom_write_config(EEADR_SET_MENU_ITEM(hd), delay);
+	}
+	LATA4 = LATA5 = 0;
+	cooling_delay = heating_delay = 0;
+	pi_integral = pi_credit = 0;
+	pi_output = pi_relay = pi_time = 0;
+	temperature = plant.beer;
+
+	for(t=0; t<DURATION; t++){
+		int error;
+
+		temperature_control();
+		host_plant_step(&plant);
+
+		error = temperature - SETPOINT;
+		if(error >= 0){
+			reached = 1;
+		}
+		if(reached && error > r.overshoot){
+			r.overshoot = error;
+		}
+
+		if(LATA4 || LATA5){
+			on_time++;
+			if(!on){
+				if(t >= SETTLE){
+					r.switches++;
+				}
+				if(cycled && off_time < r.shortest_off){
+					r.shortest_off = off_time;
+				}
+			}
+			on = 1;
+			off_time = 0;
+		} else {
+			off_time++;
+			if(on){
+				if(on_time < r.shortest){
+					r.shortest = on_time;
+				}
+				cycled = 1;
+			}
+			on = 0;
+			on_time = 0;
+		}
+
+		if(t >= SETTLE){
+			if(error > r.peak || -error > r.peak){
+				r.peak = (error < 0) ? -error : error;
+			}
+			sum += error;
+		}
+	}
+	r.mean = sum / (DURATION - SETTLE);
+
+	printf("%s, delay %2u: overshoot %d.%d, peak error %d.%d, mean error %.2f, %u cycles, shortest on %us, off %us\n",
+			pi_mode ? "PI        " : "thermostat", delay, r.overshoot / 10, r.overshoot % 10,
+			r.peak / 10, r.peak % 10, r.mean / 10, r.switches, r.shortest, r.shortest_off);
+	return r;
+}
+
+int main(void){
+	struct result th, pi, pi_hd;
+
+	th = run(0, 0);
+	pi = run(1, 0);
+	pi_hd = run(1, 15);
+
+	// Coming up from 5 degrees below, the integral is held back while the output is saturated
+	CHECK(pi.overshoot <= th.overshoot);
+
+	// Once settled, holds the setpoint at least as well as the thermostat, without cycling more
+	CHECK(pi.peak <= th.peak);
+	CHECK(pi.mean < 1.0 && pi.mean > -1.0);
+	CHECK(pi.switches <= th.switches);
+
+	// On and off for at least PI_MIN_ON minutes, or cd/hd minutes when that is longer
+	CHECK(pi.shortest >= PI_MIN_ON * 60);
+	CHECK(pi.shortest_off >= PI_MIN_ON * 60);
+	CHECK(pi_hd.shortest >= 15 * 60);
+	CHECK(pi_hd.shortest_off >= 15 * 60);
+
+	if(failures){
+		printf("test_pi: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_pi: ok\n");
+	return 0;
+}
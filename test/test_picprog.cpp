@@ -0,0 +1,413 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* picprog.ino programming several targets in lockstep (NO_OF_TARGETS, see Makefile), against
+ * PIC16F1828 models on the ICSP pins. Each model follows the low voltage programming protocol
+ * as it is clocked, with its own ICSPDAT pin, program memory, configuration space and EEPROM.
+ * Targets can be given a flash word that does not program, or be left unconnected.
+ */
+
+#include "arduino_host.h"
+#include "picprog_host.cpp"
+
+#define PIC_PROGRAM_WORDS	4096
+#define PIC_CONFIG_WORDS	32
+#define PIC_DEVICE_ID		0x27C5
+#define PIC_LVP_KEY			0x4D434850UL	// "MCHP"
+
+enum pic_mode {
+	pic_off,
+	pic_key,		// Shifting in the key, after nMCLR went low
+	pic_command,	// Shifting in a command
+	pic_load,		// Shifting in the data of a load command
+	pic_read,		// Shifting out data
+};
+
+struct pic {
+	unsigned int program[PIC_PROGRAM_WORDS];
+	unsigned int config[PIC_CONFIG_WORDS];
+	unsigned char eeprom[256];
+	unsigned int pc, latch, data_out;
+	unsigned char eeprom_latch;		// Last load was for data memory
+	unsigned long shift;
+	unsigned char bits, command, mode, out;
+	unsigned int programmed;		// Words and bytes programmed
+	// Faults
+	unsigned char unconnected;
+	unsigned int bad_word, bad_bits;	// Bits of bad_word that stay 0 once programmed
+};
+
+static pic pics[NO_OF_TARGETS];
+
+static void pic_reset(pic *p) {
+	memset(p, 0, sizeof(*p));
+	for (unsigned int i = 0; i < PIC_PROGRAM_WORDS; i++) {
+		p->program[i] = 0x3fff;
+	}
+	for (unsigned int i = 0; i < PIC_CONFIG_WORDS; i++) {
+		p->config[i] = 0x3fff;
+	}
+	p->config[6] = PIC_DEVICE_ID;
+	memset(p->eeprom, 0xff, sizeof(p->eeprom));
+	p->bad_word = 0xffff;
+}
+
+static unsigned int *pic_word(pic *p) {
+	static unsigned int none;
+	if (p->pc >= 0x8000) {
+		return &p->config[p->pc & (PIC_CONFIG_WORDS - 1)];
+	}
+	if (p->pc < PIC_PROGRAM_WORDS) {
+		return &p->program[p->pc];
+	}
+	none = 0x3fff;
+	return &none;
+}
+
+static void pic_execute(pic *p) {
+	switch (p->command) {
+	case LOAD_CONFIGURATION:
+	case LOAD_DATA_FOR_PROGRAM_MEMORY:
+	case LOAD_DATA_FOR_DATA_MEMORY:
+		p->mode = pic_load;
+		p->bits = 0;
+		p->shift = 0;
+		return;
+	case READ_DATA_FROM_PROGRAM_MEMORY:
+		p->data_out = *pic_word(p);
+		p->mode = pic_read;
+		p->bits = 0;
+		return;
+	case READ_DATA_FROM_DATA_MEMORY:
+		p->data_out = p->eeprom[p->pc & 0xff];
+		p->mode = pic_read;
+		p->bits = 0;
+		return;
+	case INCREMENT_ADDRESS:
+		p->pc = (p->pc & 0x8000) | ((p->pc + 1) & 0x7fff);
+		break;
+	case RESET_ADDRESS:
+		p->pc = 0;
+		break;
+	case BEGIN_INTERNALLY_TIMED_PROGRAMMING:
+	case BEGIN_EXTERNALLY_TIMED_PROGRAMMING:
+		if (p->eeprom_latch) {
+			p->eeprom[p->pc & 0xff] = p->latch;
+		} else {
+			// Flash bits only go from 1 to 0, until erased
+			*pic_word(p) &= p->latch;
+			if (p->pc == p->bad_word) {
+				*pic_word(p) &= ~p->bad_bits;
+			}
+		}
+		p->programmed++;
+		break;
+	case BULK_ERASE_PROGRAM_MEMORY:
+		for (unsigned int i = 0; i < PIC_PROGRAM_WORDS; i++) {
+			p->program[i] = 0x3fff;
+		}
+		if (p->pc >= 0x8000) {
+			// User IDs and configuration words
+			for (unsigned int i = 0; i < 4; i++) {
+				p->config[i] = 0x3fff;
+			}
+			p->config[7] = p->config[8] = 0x3fff;
+		}
+		break;
+	case BULK_ERASE_DATA_MEMORY:
+		memset(p->eeprom, 0xff, sizeof(p->eeprom));
+		break;
+	}
+	p->mode = pic_command;
+	p->bits = 0;
+	p->shift = 0;
+}
+
+/* A bit clocked in on the falling edge of ICSPCLK */
+static void pic_bit_in(pic *p, unsigned char bit) {
+	p->shift |= ((unsigned long) bit) << p->bits;
+	p->bits++;
+
+	switch (p->mode) {
+	case pic_key:
+		// 32 bits of key and one more clock
+		if (p->bits == 33) {
+			p->mode = (p->shift & 0xffffffffUL) == PIC_LVP_KEY ? pic_command : pic_off;
+			p->bits = 0;
+			p->shift = 0;
+		}
+		break;
+	case pic_command:
+		if (p->bits == 6) {
+			p->command = p->shift & 0x3f;
+			pic_execute(p);
+		}
+		break;
+	case pic_load:
+		if (p->bits == 16) {
+			p->latch = (p->shift >> 1) & 0x3fff;
+			p->eeprom_latch = (p->command == LOAD_DATA_FOR_DATA_MEMORY);
+			if (p->command == LOAD_CONFIGURATION) {
+				p->pc = 0x8000;
+			}
+			p->mode = pic_command;
+			p->bits = 0;
+			p->shift = 0;
+		}
+		break;
+	}
+}
+
+static unsigned char pic_dat(unsigned char t) {
+	return host_pin[target_dat[t]].level;
+}
+
+static void host_pin_changed(unsigned char pin) {
+	static unsigned char clk;
+	unsigned char t;
+
+	if (pin == ICSPCLK) {
+		// Only edges clock the targets
+		if (host_pin[ICSPCLK].level == clk) {
+			return;
+		}
+		clk = host_pin[ICSPCLK].level;
+	}
+
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic *p = &pics[t];
+
+		if (pin == nMCLR || pin == VDD1) {
+			// LVP entry, nMCLR going low while powered
+			if (host_pin[VDD1].level && host_pin[nMCLR].mode == OUTPUT && !host_pin[nMCLR].level) {
+				if (p->mode == pic_off) {
+					p->mode = pic_key;
+					p->bits = 0;
+					p->shift = 0;
+					p->pc = 0;
+				}
+			} else {
+				p->mode = pic_off;
+			}
+		} else if (pin == ICSPCLK && !p->unconnected) {
+			if (host_pin[ICSPCLK].level) {
+				if (p->mode == pic_read) {
+					// Start bit, 14 data bits and stop bit
+					p->out = (p->bits >= 1 && p->bits <= 14) ? (p->data_out >> (p->bits - 1)) & 0x1 : 0;
+				}
+			} else if (p->mode == pic_read) {
+				if (++p->bits == 16) {
+					p->mode = pic_command;
+					p->bits = 0;
+					p->shift = 0;
+				}
+			} else if (p->mode != pic_off) {
+				pic_bit_in(p, pic_dat(t));
+			}
+		}
+	}
+}
+
+static unsigned char host_pin_read(unsigned char pin) {
+	for (unsigned char t = 0; t < NO_OF_TARGETS; t++) {
+		if (pin == target_dat[t]) {
+			return pics[t].mode == pic_read && !pics[t].unconnected ? pics[t].out : LOW;
+		}
+	}
+	return LOW;
+}
+
+/* The image in the hex data of the sketch, as it should end up in a target */
+static pic image;
+
+static void image_from_hex(PGM_P hexdata) {
+	unsigned long base = 0;
+
+	while (1) {
+		unsigned char count = hexdata[0], type = hexdata[3];
+		unsigned long address = base + ((unsigned char) hexdata[1] << 8) + (unsigned char) hexdata[2];
+
+		if (type == 1) {
+			return;
+		} else if (type == 4) {
+			base = ((unsigned long) ((unsigned char) hexdata[4] << 8) | (unsigned char) hexdata[5]) << 16;
+		} else if (type == 0) {
+			for (unsigned char i = 0; i < count; i += 2) {
+				unsigned long word = (address + i) >> 1;
+				unsigned int data = (unsigned char) hexdata[4 + i] | ((unsigned char) hexdata[5 + i] << 8);
+				if (word >= HEX_EEPROM_WORD) {
+					image.eeprom[word - HEX_EEPROM_WORD] = data;
+				} else if (word >= HEX_CONFIG_WORD) {
+					image.config[word - HEX_CONFIG_WORD] = data;
+				} else {
+					image.program[word] = data;
+				}
+			}
+		}
+		hexdata += count + 5;
+	}
+}
+
+/* Send a command to the sketch, followed by input for it */
+static void command(char c, const std::string &input = "") {
+	host_serial_in = c + input;
+	host_serial_out.clear();
+	loop();
+}
+
+/* An Intel hex record as sent over serial, with bytes of data counting up from first,
+ * and the high byte of each word cut to 14 bit words
+ */
+static std::string hex_record(unsigned char count, unsigned int address, unsigned char type, unsigned char first) {
+	unsigned char sum = count + (address >> 8) + address + type;
+	char hex[16];
+	std::string record;
+
+	snprintf(hex, sizeof(hex), ":%02X%04X%02X", count, address, type);
+	record = hex;
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned char data = (i & 0x1) ? (first + i) & 0x3f : first + i;
+		snprintf(hex, sizeof(hex), "%02X", data);
+		record += hex;
+		sum += data;
+	}
+	snprintf(hex, sizeof(hex), "%02X\r\n", (unsigned char) -sum);
+	return record + hex;
+}
+
+static int programmed_as_image(unsigned char t) {
+	pic *p = &pics[t];
+	return memcmp(p->program, image.program, sizeof(image.program)) == 0
+			&& memcmp(p->eeprom, image.eeprom, sizeof(image.eeprom)) == 0
+			&& p->config[7] == image.config[7] && p->config[8] == image.config[8]
+			&& p->config[0] == STC1000P_MAGIC_C && p->config[1] == STC1000P_VERSION && p->config[2] == STC1000P_EEPROM_LAYOUT;
+}
+
+static int output_has(const char *s) {
+	return host_serial_out.find(s) != std::string::npos;
+}
+
+static int failures;
+
+#define CHECK(cond)	do { if(!(cond)){ printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
+
+int main(void) {
+	unsigned char t;
+	char line[64];
+
+	pic_reset(&image);
+	image_from_hex(hex_celsius);
+	image_from_hex(hex_eeprom_celsius);
+	image.config[0] = STC1000P_MAGIC_C;
+	image.config[1] = STC1000P_VERSION;
+
+	setup();
+
+	// Each target answers with its device ID
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+		pics[t].config[6] = PIC_DEVICE_ID + t;
+	}
+	command('d');
+	CHECK(output_has("STC-1000 detected."));
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		snprintf(line, sizeof(line), "Target %d device ID is: 0x%X", t, PIC_DEVICE_ID + t);
+		CHECK(output_has(line));
+	}
+
+	// All targets programmed with the same image
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+		memset(pics[t].eeprom, 0x55, sizeof(pics[t].eeprom));
+	}
+	command('a');
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		CHECK(programmed_as_image(t));
+		snprintf(line, sizeof(line), "Target %d OK", t);
+		CHECK(output_has(line));
+	}
+	CHECK(!output_has("FAILED"));
+	printf("%d targets programmed, %u words and bytes each\n", NO_OF_TARGETS, pics[0].programmed);
+
+	// A target with a bad flash word fails, and the others are still programmed all the way
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+	}
+	CHECK(image.program[0x0010] != 0);
+	pics[1].bad_word = 0x0010;
+	pics[1].bad_bits = image.program[0x0010] & -image.program[0x0010];
+	command('a');
+	CHECK(output_has("Target 1: Validation failed for address 0x10"));
+	CHECK(output_has("Target 1 FAILED"));
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		if (t != 1) {
+			CHECK(programmed_as_image(t));
+			snprintf(line, sizeof(line), "Target %d OK", t);
+			CHECK(output_has(line));
+		}
+	}
+	CHECK(pics[1].programmed == pics[0].programmed);
+
+	// With no target connected, programming stops at the first word
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+		pics[t].unconnected = 1;
+	}
+	command('a');
+	CHECK(output_has("Validation failed"));
+	CHECK(!output_has("Programming done"));
+	CHECK(pics[0].programmed == 0);
+
+	// Records from serial of up to 255 bytes, with program memory words of 14 bits
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+	}
+	command('u', hex_record(254, 0x0100, 0, 0x00) + hex_record(0, 0, 1, 0));
+	CHECK(output_has("Programming 127 words at address 0x80"));
+	CHECK(output_has("Programming done"));
+	CHECK(!output_has("FAILED"));
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		CHECK(pics[t].program[0x80] == 0x0100 && pics[t].program[0x80 + 126] == (((253 & 0x3f) << 8) | 252));
+		CHECK(pics[t].program[0x80 + 127] == 0x3fff);
+	}
+
+	// An odd byte count can not be program memory words, nothing is programmed
+	for (t = 0; t < NO_OF_TARGETS; t++) {
+		pic_reset(&pics[t]);
+	}
+	command('u', hex_record(255, 0x0100, 0, 0x00) + hex_record(0, 0, 1, 0));
+	CHECK(output_has("Odd byte count"));
+	CHECK(!output_has("Programming done"));
+	CHECK(pics[0].programmed == 0);
+
+	// EEPROM data differs between units, so keeping it is refused
+	command('b');
+	CHECK(output_has("Not available with multiple targets"));
+
+	if (failures) {
+		printf("test_picprog: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_picprog: ok\n");
+	return 0;
+}
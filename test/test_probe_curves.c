@@ -0,0 +1,144 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Probe curves (PROBE_CURVES) over the whole AD range without alarm: curve 0 gives exactly what the
+ * lookup table of 1.07 gives, the compressed curves stay within the compression error of the tables
+ * NTC/lut calculates for them, and walking a compressed curve gives the same result whichever way
+ * and however far the AD value jumps.
+ */
+
+#include <math.h>
+#include "host.h"
+
+#define AD_LOW		(9 << 8)	// Lowest ad_filter without alarm
+#define AD_HIGH		(248 << 8)	// Lowest ad_filter with alarm
+#define AD_VALUES	(AD_HIGH - AD_LOW)
+#define CURVE_ERROR	2			// Compressed points are within 0.2 degrees Celsius of the table
+
+/* ad_lookup of 1.07 */
+#ifdef FAHRENHEIT
+static const int lookup_1_07[] = { 0, -555, -319, -167, -49, 48, 134, 211, 282, 348, 412, 474, 534, 593, 652, 711, 770, 831, 893, 957, 1025, 1096, 1172, 1253, 1343, 1444, 1559, 1694, 1860, 2078, 2397, 2987 };
+#else
+static const int lookup_1_07[] = { 0, -486, -355, -270, -205, -151, -104, -61, -21, 16, 51, 85, 119, 152, 184, 217, 250, 284, 318, 354, 391, 431, 473, 519, 569, 624, 688, 763, 856, 977, 1154, 1482 };
+#endif
+
+/* beta_curves in NTC/lut.c, for curves 1 and up */
+static const double beta_curves[][2] = {
+	{ 10000.0, 3950.0 },	// 10k B3950
+	{ 5000.0, 3950.0 },		// 5k B3950
+};
+
+static int table[NTC_CURVES][32];
+static short decoded[NTC_CURVES][AD_VALUES];
+
+/* Lookup tables as NTC/lut calculates them (ad_to_r() and beta_rtot() in lut.c), in the unit of the build */
+static void make_tables(void){
+	unsigned char c, i;
+
+	for(i=0; i<32; i++){
+		table[0][i] = lookup_1_07[i];
+	}
+	for(c=1; c<NTC_CURVES; c++){
+		for(i=1; i<32; i++){
+			double r = ((10000.0 * 1024) / (i * 32)) - 10000.0;
+			double t = 1.0 / (1.0 / 298.15 + log(r / beta_curves[c - 1][0]) / beta_curves[c - 1][1]) - 273.15;
+#ifdef FAHRENHEIT
+			t = t * 1.8 + 32.0;
+#endif
+			table[c][i] = (int)round(t * 10.0);
+		}
+	}
+}
+
+/* Interpolate as ad_to_temp() of 1.07 does */
+static int interpolate(const int *lut, unsigned int ad){
+	int a = (ad >> 5) & 0x3f, b = (ad >> 11) & 0x1f;
+
+	return (32 + (64 - a) * lut[b] + a * lut[b + 1]) >> 6;
+}
+
+static short temp(unsigned int ad, unsigned char probe, unsigned char curve){
+	eeprom_write_config(probe ? EEADR_SET_MENU_ITEM(th2) : EEADR_SET_MENU_ITEM(th), curve);
+	return ad_to_temp(ad, probe);
+}
+
+int main(void){
+	unsigned int ad, n, mismatch, worst[NTC_CURVES] = { 0 };
+	unsigned long seed = 1;
+	unsigned char c, p;
+	int error;
+
+	host_eeprom_defaults();
+	make_tables();
+
+	// Up the whole range, each curve on probe 1
+	for(c=0; c<NTC_CURVES; c++){
+		mismatch = 0;
+		for(ad=AD_LOW; ad<AD_HIGH; ad++){
+			decoded[c][ad - AD_LOW] = temp(ad, 0, c);
+			error = decoded[c][ad - AD_LOW] - interpolate(table[c], ad);
+			if(error < 0){
+				error = -error;
+			}
+			if(error > worst[c]){
+				worst[c] = error;
+			}
+			mismatch += (error != 0);
+		}
+		printf("curve %u: %u of %u AD values differ from the table, by %u at most\n", c, mismatch, AD_VALUES, worst[c]);
+	}
+	CHECK(worst[0] == 0);
+#ifdef FAHRENHEIT
+	// Converted from Celsius, 1.8 times the error and the rounding of both conversions
+	CHECK(worst[1] <= 4 && worst[2] <= 4);
+#else
+	CHECK(worst[1] <= CURVE_ERROR && worst[2] <= CURVE_ERROR);
+#endif
+
+	// Down the whole range, on probe 2
+	for(c=0; c<NTC_CURVES; c++){
+		mismatch = 0;
+		for(ad=AD_HIGH; ad-- > AD_LOW; ){
+			mismatch += (temp(ad, 1, c) != decoded[c][ad - AD_LOW]);
+		}
+		CHECK(mismatch == 0);
+	}
+
+	// Jumps either way, alternating probes and changing curves now and then
+	mismatch = 0;
+	for(n=0; n<200000; n++){
+		seed = seed * 1103515245 + 12345;
+		ad = AD_LOW + (seed >> 8) % AD_VALUES;
+		p = (seed >> 4) & 0x1;
+		c = ((n >> 10) + p) % NTC_CURVES;
+		mismatch += (temp(ad, p, c) != decoded[c][ad - AD_LOW]);
+	}
+	CHECK(mismatch == 0);
+
+	if(failures){
+		printf("test_probe_curves: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_probe_curves: ok\n");
+	return 0;
+}
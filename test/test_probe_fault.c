@@ -0,0 +1,175 @@
+/*
+ * STC1000+, improved firmware and Arduino based firmware uploader for the STC-1000 dual stage thermostat.
+ *
+ * Copyright 2014 Mats Staffansson
+ *
+ * This file is part of STC1000+.
+ *
+ * STC1000+ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STC1000+ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STC1000+.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/* Probe fault cutoff (PROBE_FAULT): the main loop of the firmware runs pass by pass (see
+ * host_loop), each pass one 60ms tick of Timer4, with a relay on and the probes in range,
+ * until a probe is unplugged (reads 0, cold) or shorted (reads 1023, hot). The relay a wrong
+ * reading keeps on is heating for an open probe and cooling for a shorted one. The time until
+ * it is off is measured from every tick of the 1s section, which also covers both probes of
+ * the alternating conversions. Built once more without PROBE_FAULT (test_probe_fault_filtered),
+ * where only the alarm on the filtered value cuts off.
+ */
+
+#include <setjmp.h>
+#include "host.h"
+
+#define TICK_MS			60
+#define AD_GOOD			512
+#define AD_OPEN			0
+#define AD_SHORT		1023
+#define OFFSETS			32							// Every tick of two seconds
+#define WARMUP_TICKS	(70 * 1000 / TICK_MS)		// Past the relay delay of 60s after power on
+#define LIMIT_TICKS		(40 * 1000 / TICK_MS)
+#define RECOVER_TICKS	(70 * 1000 / TICK_MS)		// The relay delay of 60s after an alarm
+
+/* Probe 1 converts on AN2, probe 2 on AN1 */
+static const unsigned char probe_channel[2] = { 2, 1 };
+
+static jmp_buf loop_exit;
+
+/* One fault, and when the firmware reacted to it, in ticks from the start */
+static struct {
+	unsigned char probe;
+	unsigned int ad;
+	unsigned long fault_at, fault_end, stop_at;
+	unsigned long tick, on_at, off_at, clear_at, back_at;
+} f;
+
+static unsigned char relay(unsigned int ad){
+	return ad == AD_OPEN ? LATA5 : LATA4;
+}
+
+/* End of a pass of the main loop: note the relay and alarm, set up the next tick */
+static void loop_pass(void){
+	f.tick++;
+	if(f.tick < f.fault_at){
+		f.on_at = relay(f.ad) ? (f.on_at ? f.on_at : f.tick) : 0;
+	} else if(f.tick < f.fault_end){
+		if(!f.off_at && !relay(f.ad)){
+			f.off_at = f.tick;
+		}
+	} else {
+		if(!f.clear_at && !LATA0){
+			f.clear_at = f.tick;
+		}
+		if(!f.back_at && relay(f.ad)){
+			f.back_at = f.tick;
+		}
+	}
+	if(f.tick >= f.stop_at){
+		longjmp(loop_exit, 1);
+	}
+	// The fault is there for the conversions of the passes from fault_at to fault_end
+	host_ad[probe_channel[f.probe]] = (f.tick + 1 >= f.fault_at && f.tick + 1 < f.fault_end) ? f.ad : AD_GOOD;
+	TMR4IF = 1;
+}
+
+/* Power on with the probes in range and a relay on, and fault probe for len ticks,
+ * starting offset ticks after warmup. len 0 is for as long as it takes to cut off.
+ * return: ms from the fault to the relay off, 0 if it stayed on
+ */
+static unsigned long run(unsigned char probe, unsigned int ad, unsigned char pb, unsigned int offset, unsigned int len){
+	memset(&f, 0, sizeof(f));
+	f.probe = probe;
+	f.ad = ad;
+	f.fault_at = WARMUP_TICKS + offset;
+	f.fault_end = f.fault_at + (len ? len : LIMIT_TICKS);
+	f.stop_at = f.fault_end + (len ? RECOVER_TICKS : 0);
+
+	// Heat, or cool, at the temperature of AD_GOOD whatever it is
+	eeprom_write_config(EEADR_SET_MENU_ITEM(SP), ad == AD_OPEN ? TEMP_MAX : TEMP_MIN);
+	eeprom_write_config(EEADR_SET_MENU_ITEM(Pb), pb);
+	host_ad[0] = host_ad[1] = host_ad[2] = host_ad[3] = AD_GOOD;
+	LATA0 = LATA4 = LATA5 = 0;
+	cooling_delay = heating_delay = 60;
+	TMR4IF = 1;
+
+	host_loop = loop_pass;
+	if(!setjmp(loop_exit)){
+		firmware_main();
+	}
+	host_loop = 0;
+
+	CHECK(f.on_at > 0);
+	return f.off_at ? (f.off_at - f.fault_at + 1) * TICK_MS : 0;
+}
+
+int main(void){
+	static const char *names[2] = { "open", "short" };
+	static const unsigned int ads[2] = { AD_OPEN, AD_SHORT };
+	unsigned char probe, type;
+	unsigned int offset;
+
+	host_eeprom_defaults();
+	eeprom_write_config(EEADR_SET_MENU_ITEM(rn), THERMOSTAT_MODE);
+
+	for(probe=0; probe<2; probe++){
+		for(type=0; type<2; type++){
+			unsigned long worst = 0, sum = 0, ms;
+
+			for(offset=0; offset<OFFSETS; offset++){
+				ms = run(probe, ads[type], probe, offset, 0);
+				CHECK(ms > 0);
+				sum += ms;
+				if(ms > worst){
+					worst = ms;
+				}
+			}
+			printf("probe %d %-5s: relay off after %5lu ms on average, %5lu ms at worst\n",
+					probe + 1, names[type], sum / OFFSETS, worst);
+#ifdef PROBE_FAULT
+			// Two conversions of the probe in a row, 120ms apart
+			CHECK(worst <= 2 * 2 * TICK_MS);
+#else
+			// The filtered value takes many seconds to get to the alarm limits
+			CHECK(sum / OFFSETS > 10000);
+#endif
+		}
+	}
+
+	for(type=0; type<2; type++){
+#ifdef PROBE_FAULT
+		// The relay stays off, with the alarm on, until the probe is back. After that the
+		// alarm clears at the next 1s section, and the relay waits out its delay.
+		run(0, ads[type], 0, 0, 100);
+		CHECK(f.off_at > 0 && f.off_at < f.fault_end);
+		CHECK(f.clear_at > 0 && f.clear_at - f.fault_end < 2000 / TICK_MS);
+		CHECK(f.back_at > f.clear_at && f.back_at - f.fault_end <= RECOVER_TICKS);
+#endif
+
+		for(offset=0; offset<OFFSETS; offset++){
+			// A single wrong conversion of each probe (a spike) does not cut off
+			CHECK(run(0, ads[type], 1, offset, 2) == 0);
+			CHECK(run(1, ads[type], 1, offset, 2) == 0);
+			// Probe 2 only counts when it is in use
+			CHECK(run(1, ads[type], 0, offset, 20) == 0);
+		}
+	}
+
+	if(failures){
+		printf("test_probe_fault: %d failed\n", failures);
+		return 1;
+	}
+	printf("test_probe_fault: ok\n");
+	return 0;
+}